@@ -0,0 +1,42 @@
+# Gzips web/live.html into src/live_html.h, so the gateway can serve the live
+# dashboard straight from flash. Runs before every PlatformIO build, and only
+# rewrites the header when the page changed.
+import gzip
+import hashlib
+import os
+
+try:
+    Import("env")
+    project = env["PROJECT_DIR"]
+except NameError:
+    project = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+source = os.path.join(project, "web", "live.html")
+target = os.path.join(project, "src", "live_html.h")
+
+with open(source, "rb") as f:
+    # No timestamp, so the same page always gives the same bytes and ETag.
+    data = gzip.compress(f.read(), compresslevel=9, mtime=0)
+
+etag = hashlib.sha1(data).hexdigest()[:16]
+lines = [
+    "#pragma once",
+    "",
+    "// Generated from web/live.html by scripts/embed_live.py, do not edit.",
+    "",
+    "#include <Arduino.h>",
+    "",
+    '#define LIVE_HTML_ETAG "\\"%s\\""' % etag,
+    "#define LIVE_HTML_SIZE %d" % len(data),
+    "",
+    "const uint8_t LIVE_HTML_GZ[] PROGMEM = {",
+]
+for i in range(0, len(data), 16):
+    lines.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+lines += ["};", ""]
+header = "\n".join(lines)
+
+if not os.path.exists(target) or open(target).read() != header:
+    with open(target, "w") as f:
+        f.write(header)
+    print("Embedded live dashboard, %d bytes gzipped" % len(data))
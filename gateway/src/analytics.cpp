@@ -0,0 +1,179 @@
+#include "analytics.h"
+#include "log.h"
+
+// Weighted sums over the readings, with time in hours relative to the latest
+// reading, which keeps them small.
+struct Trend
+{
+    double s0, st, stt, sg, stg;
+};
+
+struct SensorAnalytics
+{
+    uint8_t mac[6];
+    int64_t lastMs;
+    Trend trend;
+    float peak; // Highest level before the OG was known.
+    Analytics result;
+};
+
+// Radio task only.
+static SensorAnalytics sensors[ANALYTICS_MAX_SENSORS];
+static int sensorCount = 0;
+
+static SensorAnalytics *findSensor(const uint8_t *mac)
+{
+    for (int i = 0; i < sensorCount; i++)
+    {
+        if (memcmp(sensors[i].mac, mac, 6) == 0)
+        {
+            return &sensors[i];
+        }
+    }
+    if (sensorCount >= ANALYTICS_MAX_SENSORS)
+    {
+        return nullptr;
+    }
+    SensorAnalytics *entry = &sensors[sensorCount++];
+    memset(entry, 0, sizeof(SensorAnalytics));
+    memcpy(entry->mac, mac, 6);
+    return entry;
+}
+
+// Move the origin forward by dt hours, ageing every reading by as much.
+static void age(Trend &trend, double dt)
+{
+    trend.stt += -2 * dt * trend.st + dt * dt * trend.s0;
+    trend.st -= dt * trend.s0;
+    trend.stg -= dt * trend.sg;
+
+    double w = exp(-dt / ANALYTICS_TAU);
+    trend.s0 *= w;
+    trend.st *= w;
+    trend.stt *= w;
+    trend.sg *= w;
+    trend.stg *= w;
+}
+
+// Slope per hour and level at the latest reading. False until there are
+// enough readings spread over time.
+static bool fit(const Trend &trend, double &slope, double &level)
+{
+    double det = trend.s0 * trend.stt - trend.st * trend.st;
+    if (trend.s0 < ANALYTICS_MIN_WEIGHT || det < trend.s0 * trend.s0 * ANALYTICS_MIN_SPREAD * ANALYTICS_MIN_SPREAD)
+    {
+        return false;
+    }
+    slope = (trend.s0 * trend.stg - trend.st * trend.sg) / det;
+    level = (trend.sg - slope * trend.st) / trend.s0;
+    return true;
+}
+
+static void restart(SensorAnalytics &entry)
+{
+    memset(&entry.trend, 0, sizeof(Trend));
+    memset(&entry.result, 0, sizeof(Analytics));
+    entry.peak = 0;
+}
+
+void analyticsUpdate(const uint8_t *mac, int64_t receivedMs, float gravity, float targetGravity, Analytics &out)
+{
+    memset(&out, 0, sizeof(Analytics));
+    SensorAnalytics *entry = findSensor(mac);
+    if (!entry)
+    {
+        return;
+    }
+
+    if (entry->trend.s0 > 0)
+    {
+        age(entry->trend, max((int64_t)0, receivedMs - entry->lastMs) / 3600000.0);
+    }
+    entry->lastMs = receivedMs;
+    entry->trend.s0 += 1;
+    entry->trend.sg += gravity;
+
+    Analytics &result = entry->result;
+    double slope, level;
+    if (!fit(entry->trend, slope, level))
+    {
+        out = result;
+        return;
+    }
+    double slopeDay = slope * 24;
+
+    if (result.og > 0 && level > result.og + ANALYTICS_NEW_BATCH_RISE)
+    {
+        LOGI("Gravity rose to %.3f, starting a new batch", level);
+        restart(*entry);
+        entry->lastMs = receivedMs;
+        entry->trend.s0 = 1;
+        entry->trend.sg = gravity;
+        out = result;
+        return;
+    }
+
+    if (result.og == 0)
+    {
+        entry->peak = max(entry->peak, (float)level);
+        if (fabs(slopeDay) < ANALYTICS_STABLE_SLOPE)
+        {
+            result.og = level;
+        }
+        else if (slopeDay < -ANALYTICS_ACTIVE_SLOPE)
+        {
+            result.og = entry->peak;
+        }
+    }
+    if (result.og > 1)
+    {
+        result.attenuation = max(0.0, (result.og - level) / (result.og - 1) * 100);
+    }
+
+    switch (result.stage)
+    {
+    case STAGE_UNKNOWN:
+    case STAGE_LAG:
+    case STAGE_STALLED:
+        if (result.og > 0 && slopeDay < -ANALYTICS_ACTIVE_SLOPE)
+        {
+            result.stage = STAGE_ACTIVE;
+        }
+        else if (result.stage == STAGE_UNKNOWN)
+        {
+            result.stage = STAGE_LAG;
+        }
+        break;
+    case STAGE_ACTIVE:
+        if (fabs(slopeDay) < ANALYTICS_STABLE_SLOPE)
+        {
+            result.stage = result.attenuation >= ANALYTICS_FINISHED_ATTENUATION ? STAGE_FINISHED : STAGE_STALLED;
+        }
+        break;
+    case STAGE_FINISHED:
+        break;
+    }
+
+    result.slope = slopeDay;
+    result.etaHours = 0;
+    if (targetGravity > 0 && level > targetGravity && slope < 0)
+    {
+        double eta = (level - targetGravity) / -slope;
+        if (eta <= ANALYTICS_MAX_ETA)
+        {
+            result.etaHours = eta;
+        }
+    }
+    out = result;
+}
+
+void analyticsReset()
+{
+    sensorCount = 0;
+}
+
+const char *analyticsStageName(uint8_t stage)
+{
+    static const char *names[] = {"unknown", "lag", "active", "stalled", "finished"};
+    return stage < sizeof(names) / sizeof(names[0]) ? names[stage] : "unknown";
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Fermentation analytics per sensor, updated in constant time and memory per
+// reading, without looking at the history.
+//
+// The gravity trend is a least squares line through the readings, with
+// weights decaying exponentially with age (ANALYTICS_TAU hours), so it
+// follows the fermentation as it speeds up and slows down. Its value at the
+// latest reading is the smoothed gravity.
+//
+// The original gravity is the first level the sensor held steady at, or the
+// highest level seen if fermentation took off before it did. From there a
+// sensor goes from lag to active once gravity drops, and to finished or
+// stalled once it stops dropping, depending on whether the attenuation has
+// reached ANALYTICS_FINISHED_ATTENUATION. A level well above the original
+// gravity is taken as a new batch, and everything starts over.
+
+#define ANALYTICS_MAX_SENSORS 16
+#define ANALYTICS_TAU 12.0 // Hours
+// Effective number of readings, and their spread in time (standard
+// deviation, hours), before the trend is trusted.
+#define ANALYTICS_MIN_WEIGHT 3.0
+#define ANALYTICS_MIN_SPREAD 3.0
+// Gravity points per day.
+#define ANALYTICS_STABLE_SLOPE 0.002
+#define ANALYTICS_ACTIVE_SLOPE 0.005
+#define ANALYTICS_FINISHED_ATTENUATION 65.0 // %
+#define ANALYTICS_NEW_BATCH_RISE 0.010
+// ETAs further out than this are not given.
+#define ANALYTICS_MAX_ETA (30 * 24) // Hours
+
+enum FermentationStage : uint8_t
+{
+    STAGE_UNKNOWN = 0, // Too few readings yet.
+    STAGE_LAG,
+    STAGE_ACTIVE,
+    STAGE_STALLED,
+    STAGE_FINISHED
+};
+
+struct Analytics
+{
+    uint8_t stage;
+    float slope;       // Gravity per day, negative while fermenting.
+    float og;          // 0 until known.
+    float attenuation; // Apparent attenuation in %, 0 until the OG is known.
+    float etaHours;    // Until the target gravity, 0 if unknown or reached.
+};
+
+// Take a reading received at receivedMs (gateway uptime) into the sensor's
+// analytics, and fill in the result. targetGravity 0 disables the ETA.
+// Radio task only.
+void analyticsUpdate(const uint8_t *mac, int64_t receivedMs, float gravity, float targetGravity, Analytics &out);
+
+// Forget every sensor, for replaying a capture from a clean start.
+// Radio task only.
+void analyticsReset();
+
+const char *analyticsStageName(uint8_t stage);
@@ -0,0 +1,56 @@
+#include "batch.h"
+#include "cbor.h"
+
+size_t batchEncode(uint8_t *buffer, size_t capacity, const char *gateway, const char *name,
+                   const Reading *readings, const int64_t *timestamps, int count)
+{
+    if (count > BATCH_MAX_READINGS)
+    {
+        return 0;
+    }
+
+    const uint8_t *sensors[BATCH_MAX_READINGS];
+    int sensorIndex[BATCH_MAX_READINGS];
+    int sensorCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int s = 0;
+        while (s < sensorCount && memcmp(sensors[s], readings[i].sensorId, 6) != 0)
+        {
+            s++;
+        }
+        if (s == sensorCount)
+        {
+            sensors[sensorCount++] = readings[i].sensorId;
+        }
+        sensorIndex[i] = s;
+    }
+
+    CborWriter cbor(buffer, capacity);
+    cbor.map(4);
+    cbor.uint(0);
+    cbor.text(gateway);
+    cbor.uint(1);
+    cbor.text(name);
+    cbor.uint(2);
+    cbor.array(sensorCount);
+    for (int s = 0; s < sensorCount; s++)
+    {
+        cbor.bytes(sensors[s], 6);
+    }
+    cbor.uint(3);
+    cbor.array(count);
+    for (int i = 0; i < count; i++)
+    {
+        const Reading &r = readings[i];
+        cbor.array(7);
+        cbor.uint(sensorIndex[i]);
+        cbor.uint(timestamps[i]);
+        cbor.integer(lroundf(r.gravity * 10000));
+        cbor.integer(lroundf(r.data.tilt * 100));
+        cbor.integer(lroundf(r.data.temp * 100));
+        cbor.integer(r.data.volt);
+        cbor.integer(r.data.interval);
+    }
+    return cbor.overflowed() ? 0 : cbor.length();
+}
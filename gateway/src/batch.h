@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Arduino.h>
+#include "reading.h"
+
+// Several readings in one CBOR body, posted to <Tilted API URL>/batch. Keys
+// are small integers, sensor MACs are listed once and referred to by index,
+// and values are fixed point. This must match server/batch.go.
+//
+// {0: gateway ID, 1: gateway name, 2: [sensor MAC (6 bytes), ...],
+//  3: [[sensor index, time (Unix ms, 0 if unknown), gravity (1/10000),
+//       tilt (1/100 degree), temp (1/100 C), volt (mV), interval (s)], ...]}
+
+#define BATCH_MAX_READINGS 32
+
+// Encode up to BATCH_MAX_READINGS readings, with their times in timestamps,
+// into buffer. Returns the length of the body, or 0 if it does not fit.
+size_t batchEncode(uint8_t *buffer, size_t capacity, const char *gateway, const char *name,
+                   const Reading *readings, const int64_t *timestamps, int count);
@@ -0,0 +1,49 @@
+#include "breaker.h"
+#include "log.h"
+
+bool CircuitBreaker::allow(unsigned long now)
+{
+    if (current != BREAKER_OPEN)
+    {
+        return true;
+    }
+    if (now - openedAt < backoffMs)
+    {
+        return false;
+    }
+    LOGI("%s: circuit half open, probing", name);
+    current = BREAKER_HALF_OPEN;
+    return true;
+}
+
+void CircuitBreaker::record(bool success, unsigned long now)
+{
+    if (success)
+    {
+        if (current != BREAKER_CLOSED)
+        {
+            LOGI("%s: probe succeeded, circuit closed", name);
+        }
+        current = BREAKER_CLOSED;
+        failures = 0;
+        backoffMs = BREAKER_BACKOFF_MIN;
+        return;
+    }
+
+    if (current == BREAKER_HALF_OPEN)
+    {
+        // Failed probe, stay away twice as long.
+        backoffMs = min((uint32_t)BREAKER_BACKOFF_MAX, backoffMs * 2);
+        current = BREAKER_OPEN;
+        openedAt = now;
+        LOGW("%s: probe failed, circuit open for %u s", name, backoffMs / 1000);
+        return;
+    }
+
+    if (++failures >= BREAKER_THRESHOLD)
+    {
+        current = BREAKER_OPEN;
+        openedAt = now;
+        LOGW("%s: %u failures in a row, circuit open for %u s", name, failures, backoffMs / 1000);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Circuit breaker tuning. After BREAKER_THRESHOLD consecutive failures an
+// integration is left alone for BREAKER_BACKOFF_MIN ms, doubling for every
+// failed probe up to BREAKER_BACKOFF_MAX.
+#define BREAKER_THRESHOLD 3
+#define BREAKER_BACKOFF_MIN 30000
+#define BREAKER_BACKOFF_MAX 1800000
+
+enum BreakerState
+{
+    BREAKER_CLOSED,    // Calls go through.
+    BREAKER_OPEN,      // Calls are skipped until the backoff has passed.
+    BREAKER_HALF_OPEN  // The next call is a probe deciding open or closed.
+};
+
+// Circuit breaker for one upstream. Only the task making the calls uses it;
+// state() may be read from anywhere. Times are millis().
+class CircuitBreaker
+{
+public:
+    explicit CircuitBreaker(const char *name) : name(name) {}
+
+    // Whether a call may go out now. Once the backoff has passed, an open
+    // breaker goes half open and lets a probe through.
+    bool allow(unsigned long now);
+
+    // The outcome of a call allow() let through.
+    void record(bool success, unsigned long now);
+
+    BreakerState state() const { return current; }
+    uint32_t backoff() const { return backoffMs; }
+
+private:
+    const char *name;
+    volatile BreakerState current = BREAKER_CLOSED;
+    uint8_t failures = 0;
+    uint32_t backoffMs = BREAKER_BACKOFF_MIN;
+    unsigned long openedAt = 0;
+};
@@ -0,0 +1,313 @@
+#include "calibration.h"
+#include <Preferences.h>
+#include "log.h"
+#include "polyfit.h"
+
+#define CALIBRATION_NAMESPACE "calibration"
+// Blob with the MACs of all stored profiles.
+#define CALIBRATION_INDEX_KEY "index"
+
+struct CalibrationEntry
+{
+    CalibrationProfile profile;
+    // Latest reading, not stored.
+    bool seen;
+    float lastTilt;
+    float lastTemp;
+};
+
+// Shared between the radio task and the web server. Everything is copied in
+// and out under the lock; fitting and storing happen outside it.
+static CalibrationEntry entries[CALIBRATION_MAX_SENSORS];
+static int entryCount = 0;
+static portMUX_TYPE calibrationMux = portMUX_INITIALIZER_UNLOCKED;
+
+static Preferences calibrationPrefs;
+
+// Preferences keys are limited to 15 characters, so no colons.
+static void profileKey(const uint8_t *mac, char *key)
+{
+    snprintf(key, 13, "%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+// Call with calibrationMux held.
+static CalibrationEntry *findEntry(const uint8_t *mac, bool add)
+{
+    for (int i = 0; i < entryCount; i++)
+    {
+        if (memcmp(entries[i].profile.mac, mac, 6) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    if (!add || entryCount >= CALIBRATION_MAX_SENSORS)
+    {
+        return nullptr;
+    }
+    CalibrationEntry *entry = &entries[entryCount++];
+    memset(entry, 0, sizeof(CalibrationEntry));
+    memcpy(entry->profile.mac, mac, 6);
+    return entry;
+}
+
+// Store one profile and the index of sensors with points.
+static void storeProfile(const CalibrationProfile &profile)
+{
+    uint8_t index[CALIBRATION_MAX_SENSORS][6];
+    int indexCount = 0;
+    portENTER_CRITICAL(&calibrationMux);
+    for (int i = 0; i < entryCount; i++)
+    {
+        if (entries[i].profile.pointCount > 0)
+        {
+            memcpy(index[indexCount++], entries[i].profile.mac, 6);
+        }
+    }
+    portEXIT_CRITICAL(&calibrationMux);
+
+    char key[13];
+    profileKey(profile.mac, key);
+    calibrationPrefs.begin(CALIBRATION_NAMESPACE, false);
+    if (profile.pointCount == 0)
+    {
+        calibrationPrefs.remove(key);
+    }
+    else
+    {
+        calibrationPrefs.putBytes(key, &profile, sizeof(profile));
+    }
+    calibrationPrefs.putBytes(CALIBRATION_INDEX_KEY, index, indexCount * 6);
+    calibrationPrefs.end();
+}
+
+void calibrationBegin()
+{
+    uint8_t index[CALIBRATION_MAX_SENSORS][6];
+    calibrationPrefs.begin(CALIBRATION_NAMESPACE, true);
+    int indexCount = calibrationPrefs.getBytes(CALIBRATION_INDEX_KEY, index, sizeof(index)) / 6;
+    for (int i = 0; i < indexCount; i++)
+    {
+        char key[13];
+        profileKey(index[i], key);
+        CalibrationEntry &entry = entries[entryCount];
+        memset(&entry, 0, sizeof(entry));
+        if (calibrationPrefs.getBytes(key, &entry.profile, sizeof(CalibrationProfile)) == sizeof(CalibrationProfile))
+        {
+            entryCount++;
+        }
+    }
+    calibrationPrefs.end();
+    LOGI("Loaded %d calibration profiles", entryCount);
+}
+
+void calibrationObserve(const uint8_t *mac, float tilt, float temp)
+{
+    portENTER_CRITICAL(&calibrationMux);
+    CalibrationEntry *entry = findEntry(mac, true);
+    if (entry)
+    {
+        entry->seen = true;
+        entry->lastTilt = tilt;
+        entry->lastTemp = temp;
+    }
+    portEXIT_CRITICAL(&calibrationMux);
+}
+
+static float evaluate(const CalibrationProfile &profile, float tilt)
+{
+    // Horner's method.
+    float x = (tilt - profile.center) / profile.scale;
+    float result = 0;
+    for (int i = profile.degree; i >= 0; i--)
+    {
+        result = result * x + profile.coefficients[i];
+    }
+    return result;
+}
+
+bool calibrationGravity(const uint8_t *mac, float tilt, float &gravity)
+{
+    bool fitted = false;
+    portENTER_CRITICAL(&calibrationMux);
+    CalibrationEntry *entry = findEntry(mac, false);
+    if (entry && entry->profile.degree > 0)
+    {
+        gravity = evaluate(entry->profile, tilt);
+        fitted = true;
+    }
+    portEXIT_CRITICAL(&calibrationMux);
+    return fitted;
+}
+
+bool calibrationAddPoint(const uint8_t *mac, float gravity)
+{
+    CalibrationProfile profile;
+    bool added = false;
+    portENTER_CRITICAL(&calibrationMux);
+    CalibrationEntry *entry = findEntry(mac, false);
+    if (entry && entry->seen && entry->profile.pointCount < CALIBRATION_MAX_POINTS)
+    {
+        entry->profile.points[entry->profile.pointCount++] = {entry->lastTilt, entry->lastTemp, gravity};
+        profile = entry->profile;
+        added = true;
+    }
+    portEXIT_CRITICAL(&calibrationMux);
+
+    if (added)
+    {
+        storeProfile(profile);
+    }
+    return added;
+}
+
+bool calibrationFit(const uint8_t *mac, int degree)
+{
+    CalibrationProfile profile;
+    bool found = false;
+    portENTER_CRITICAL(&calibrationMux);
+    CalibrationEntry *entry = findEntry(mac, false);
+    if (entry)
+    {
+        profile = entry->profile;
+        found = true;
+    }
+    portEXIT_CRITICAL(&calibrationMux);
+
+    if (!found || degree < 1 || degree > CALIBRATION_MAX_DEGREE || profile.pointCount <= degree)
+    {
+        return false;
+    }
+    int n = profile.pointCount;
+
+    // Center and scale tilt to [-1, 1].
+    double center = 0;
+    for (int i = 0; i < n; i++)
+    {
+        center += profile.points[i].tilt;
+    }
+    center /= n;
+    double scale = 0;
+    for (int i = 0; i < n; i++)
+    {
+        scale = max(scale, fabs(profile.points[i].tilt - center));
+    }
+    if (scale == 0)
+    {
+        return false;
+    }
+
+    double x[CALIBRATION_MAX_POINTS], y[CALIBRATION_MAX_POINTS];
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = (profile.points[i].tilt - center) / scale;
+        y[i] = profile.points[i].gravity;
+    }
+    double coefficients[CALIBRATION_MAX_DEGREE + 1];
+    if (!polyfitLeastSquares(x, y, n, degree, coefficients))
+    {
+        return false;
+    }
+
+    profile.degree = degree;
+    profile.center = center;
+    profile.scale = scale;
+    for (int i = 0; i <= CALIBRATION_MAX_DEGREE; i++)
+    {
+        profile.coefficients[i] = i <= degree ? coefficients[i] : 0;
+    }
+
+    // Points may have been added meanwhile, so only update the fit.
+    portENTER_CRITICAL(&calibrationMux);
+    entry->profile.degree = profile.degree;
+    entry->profile.center = profile.center;
+    entry->profile.scale = profile.scale;
+    memcpy(entry->profile.coefficients, profile.coefficients, sizeof(profile.coefficients));
+    profile = entry->profile;
+    portEXIT_CRITICAL(&calibrationMux);
+
+    storeProfile(profile);
+    return true;
+}
+
+void calibrationClear(const uint8_t *mac)
+{
+    CalibrationProfile profile;
+    bool found = false;
+    portENTER_CRITICAL(&calibrationMux);
+    CalibrationEntry *entry = findEntry(mac, false);
+    if (entry)
+    {
+        memset(&entry->profile, 0, sizeof(CalibrationProfile));
+        memcpy(entry->profile.mac, mac, 6);
+        profile = entry->profile;
+        found = true;
+    }
+    portEXIT_CRITICAL(&calibrationMux);
+
+    if (found)
+    {
+        storeProfile(profile);
+    }
+}
+
+void calibrationRender(String &out)
+{
+    static CalibrationEntry copy[CALIBRATION_MAX_SENSORS];
+    portENTER_CRITICAL(&calibrationMux);
+    int count = entryCount;
+    memcpy(copy, entries, count * sizeof(CalibrationEntry));
+    portEXIT_CRITICAL(&calibrationMux);
+
+    char buffer[128];
+    out += '[';
+    for (int s = 0; s < count; s++)
+    {
+        const CalibrationEntry &entry = copy[s];
+        const CalibrationProfile &profile = entry.profile;
+        const uint8_t *mac = profile.mac;
+        snprintf(buffer, sizeof(buffer), "%s{\"sensor\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"degree\":%d,",
+                 s > 0 ? "," : "", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], profile.degree);
+        out += buffer;
+        if (entry.seen)
+        {
+            snprintf(buffer, sizeof(buffer), "\"tilt\":%.2f,\"temp\":%.2f,", entry.lastTilt, entry.lastTemp);
+            out += buffer;
+        }
+
+        double expanded[CALIBRATION_MAX_DEGREE + 1];
+        polyfitExpand(profile, expanded);
+        out += "\"coefficients\":[";
+        for (int i = 0; i <= profile.degree && profile.degree > 0; i++)
+        {
+            snprintf(buffer, sizeof(buffer), "%s%.9g", i > 0 ? "," : "", expanded[i]);
+            out += buffer;
+        }
+        out += "],\"points\":[";
+
+        double squares = 0;
+        for (int i = 0; i < profile.pointCount; i++)
+        {
+            const CalibrationPoint &point = profile.points[i];
+            snprintf(buffer, sizeof(buffer), "%s{\"tilt\":%.2f,\"temp\":%.2f,\"gravity\":%.4f",
+                     i > 0 ? "," : "", point.tilt, point.temp, point.gravity);
+            out += buffer;
+            if (profile.degree > 0)
+            {
+                float fitted = evaluate(profile, point.tilt);
+                float residual = point.gravity - fitted;
+                squares += residual * residual;
+                snprintf(buffer, sizeof(buffer), ",\"fitted\":%.4f,\"residual\":%.4f", fitted, residual);
+                out += buffer;
+            }
+            out += '}';
+        }
+        out += ']';
+        if (profile.degree > 0 && profile.pointCount > 0)
+        {
+            snprintf(buffer, sizeof(buffer), ",\"rms\":%.5f", sqrt(squares / profile.pointCount));
+            out += buffer;
+        }
+        out += '}';
+    }
+    out += ']';
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Per-sensor calibration. Each sensor collects (tilt, temp, reference
+// gravity) points, taken from its latest reading whenever the user enters a
+// hydrometer reading, and gets a polynomial in tilt fitted to them by least
+// squares. Profiles are kept in Preferences, keyed by MAC.
+//
+// Sensors without a fitted profile fall back to the global polynomial
+// setting.
+
+#define CALIBRATION_MAX_SENSORS 16
+#define CALIBRATION_MAX_POINTS 16
+#define CALIBRATION_MAX_DEGREE 3
+
+struct CalibrationPoint
+{
+    float tilt;
+    float temp;
+    float gravity;
+};
+
+struct CalibrationProfile
+{
+    uint8_t mac[6];
+    uint8_t pointCount;
+    uint8_t degree; // 0 until fitted
+    // The polynomial is in (tilt - center) / scale, which keeps the least
+    // squares problem well conditioned. Lowest order first.
+    float center;
+    float scale;
+    float coefficients[CALIBRATION_MAX_DEGREE + 1];
+    CalibrationPoint points[CALIBRATION_MAX_POINTS];
+};
+
+// Load stored profiles. Call once before the radio task starts.
+void calibrationBegin();
+
+// Remember a sensor's latest tilt and temperature. Radio task only.
+void calibrationObserve(const uint8_t *mac, float tilt, float temp);
+
+// Gravity from the sensor's fitted profile. Returns false if it has none.
+bool calibrationGravity(const uint8_t *mac, float tilt, float &gravity);
+
+// Add a point from the sensor's latest reading and the given reference
+// gravity. Returns false if nothing was heard from the sensor yet, or its
+// profile is full.
+bool calibrationAddPoint(const uint8_t *mac, float gravity);
+
+// Fit a polynomial of the given degree (1 to CALIBRATION_MAX_DEGREE) to the
+// sensor's points. Needs more points than the degree, at distinct tilts.
+bool calibrationFit(const uint8_t *mac, int degree);
+
+void calibrationClear(const uint8_t *mac);
+
+// Append all profiles as JSON, with the fitted value and residual per point.
+void calibrationRender(String &out);
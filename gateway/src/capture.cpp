@@ -0,0 +1,146 @@
+#include "capture.h"
+#include <LittleFS.h>
+#include <esp_timer.h>
+#include "log.h"
+
+// The buffer is filled by the WiFi task and drained by the loop task.
+static uint8_t buffer[CAPTURE_BUFFER_SIZE];
+static size_t buffered = 0;
+static portMUX_TYPE captureMux = portMUX_INITIALIZER_UNLOCKED;
+
+static volatile bool active = false;
+static int64_t startMs = 0;
+static uint32_t frames = 0;
+static uint32_t dropped = 0;
+// Loop task only.
+static File file;
+static size_t fileSize = 0;
+
+bool captureStart()
+{
+    captureStop();
+    file = LittleFS.open(CAPTURE_FILE, "w");
+    if (!file)
+    {
+        return false;
+    }
+    fileSize = file.write((const uint8_t *)CAPTURE_MAGIC, 4);
+
+    portENTER_CRITICAL(&captureMux);
+    buffered = 0;
+    frames = 0;
+    dropped = 0;
+    startMs = esp_timer_get_time() / 1000;
+    active = true;
+    portEXIT_CRITICAL(&captureMux);
+    LOGI("Capturing frames to %s", CAPTURE_FILE);
+    return true;
+}
+
+void captureStop()
+{
+    if (!active)
+    {
+        return;
+    }
+    active = false;
+    captureFlush();
+    file.close();
+    LOGI("Captured %u frames, %u dropped", frames, dropped);
+}
+
+File captureOpen()
+{
+    return LittleFS.open(CAPTURE_FILE, "r");
+}
+
+bool captureActive()
+{
+    return active;
+}
+
+void captureFrame(int64_t receivedMs, const uint8_t *mac, int8_t rssi, const uint8_t *data, uint8_t len)
+{
+    if (!active)
+    {
+        return;
+    }
+    CaptureRecord record;
+    memcpy(record.mac, mac, 6);
+    record.rssi = rssi;
+    record.len = len;
+
+    portENTER_CRITICAL(&captureMux);
+    record.timeMs = receivedMs - startMs;
+    if (buffered + sizeof(record) + len <= sizeof(buffer))
+    {
+        memcpy(buffer + buffered, &record, sizeof(record));
+        memcpy(buffer + buffered + sizeof(record), data, len);
+        buffered += sizeof(record) + len;
+        frames++;
+    }
+    else
+    {
+        dropped++;
+    }
+    portEXIT_CRITICAL(&captureMux);
+}
+
+static uint32_t countRecords(const uint8_t *data, size_t len)
+{
+    uint32_t count = 0;
+    for (size_t at = 0; at < len; at += sizeof(CaptureRecord) + ((const CaptureRecord *)(data + at))->len)
+    {
+        count++;
+    }
+    return count;
+}
+
+void captureFlush()
+{
+    // Copied out first, so the callback is never kept waiting on flash.
+    static uint8_t pending[CAPTURE_BUFFER_SIZE];
+    portENTER_CRITICAL(&captureMux);
+    size_t len = buffered;
+    memcpy(pending, buffer, len);
+    buffered = 0;
+    portEXIT_CRITICAL(&captureMux);
+
+    if (len == 0 || !file)
+    {
+        return;
+    }
+    // Whole records only, up to the size limit.
+    size_t fits = 0;
+    while (fits < len)
+    {
+        size_t next = fits + sizeof(CaptureRecord) + ((const CaptureRecord *)(pending + fits))->len;
+        if (fileSize + next > CAPTURE_MAX_SIZE)
+        {
+            break;
+        }
+        fits = next;
+    }
+    fileSize += file.write(pending, fits);
+    if (fits < len)
+    {
+        // Along with whatever arrived since the copy.
+        portENTER_CRITICAL(&captureMux);
+        uint32_t left = countRecords(pending + fits, len - fits) + countRecords(buffer, buffered);
+        buffered = 0;
+        frames -= left;
+        dropped += left;
+        active = false;
+        portEXIT_CRITICAL(&captureMux);
+        LOGW("Capture full, stopping");
+        file.close();
+    }
+}
+
+void captureRender(String &out)
+{
+    char json[128];
+    snprintf(json, sizeof(json), "{\"active\":%s,\"frames\":%u,\"dropped\":%u,\"bytes\":%u}",
+             active ? "true" : "false", frames, dropped, (unsigned)fileSize);
+    out += json;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+#include "frame.h"
+
+// Raw frame capture, for reproducing what a gateway saw in the field. While
+// capturing, every ESP-NOW frame the gateway receives is appended to
+// CAPTURE_FILE as it arrived: receive time, sender MAC, RSSI, length and
+// bytes. The file is downloaded from /capture.bin and fed back with
+// tools/replay, which posts the frames to /replay on any gateway, where they
+// are decoded and calibrated, and published only if asked for.
+//
+// Frames are copied to a RAM buffer by the receive callback and written out
+// by the loop task, so capturing never holds up the radio. Frames arriving
+// while the buffer is full are counted as dropped. The capture stops once
+// the file reaches CAPTURE_MAX_SIZE, and buffered frames that did not fit
+// are counted as dropped too.
+
+#define CAPTURE_FILE "/capture.bin"
+#define CAPTURE_MAX_SIZE (256 * 1024)
+#define CAPTURE_BUFFER_SIZE 4096
+
+// The file starts with CAPTURE_MAGIC, followed by a CaptureRecord per frame,
+// both in frame.h.
+
+// The last capture, once stopped.
+File captureOpen();
+
+// Start a new capture, dropping the previous one. Loop task only.
+bool captureStart();
+void captureStop();
+bool captureActive();
+
+// Record a received frame. Called from the ESP-NOW receive callback.
+void captureFrame(int64_t receivedMs, const uint8_t *mac, int8_t rssi, const uint8_t *data, uint8_t len);
+
+// Write buffered frames to flash. Loop task only.
+void captureFlush();
+
+// Append the capture state as JSON.
+void captureRender(String &out);
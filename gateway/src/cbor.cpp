@@ -0,0 +1,82 @@
+#include "cbor.h"
+
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+
+void CborWriter::put(const uint8_t *data, size_t len)
+{
+    if (overflow || used + len > capacity)
+    {
+        overflow = true;
+        return;
+    }
+    memcpy(buffer + used, data, len);
+    used += len;
+}
+
+// Major type and argument, in the shortest form.
+void CborWriter::head(uint8_t major, uint64_t value)
+{
+    uint8_t out[9];
+    size_t len;
+    if (value < 24)
+    {
+        out[0] = major << 5 | value;
+        len = 1;
+    }
+    else
+    {
+        int size = value <= 0xFF ? 1 : value <= 0xFFFF ? 2 : value <= 0xFFFFFFFF ? 4 : 8;
+        out[0] = major << 5 | (size == 1 ? 24 : size == 2 ? 25 : size == 4 ? 26 : 27);
+        for (int i = 0; i < size; i++)
+        {
+            out[size - i] = value >> (8 * i);
+        }
+        len = size + 1;
+    }
+    put(out, len);
+}
+
+void CborWriter::array(size_t count)
+{
+    head(CBOR_ARRAY, count);
+}
+
+void CborWriter::map(size_t count)
+{
+    head(CBOR_MAP, count);
+}
+
+void CborWriter::uint(uint64_t value)
+{
+    head(CBOR_UINT, value);
+}
+
+void CborWriter::integer(int64_t value)
+{
+    if (value >= 0)
+    {
+        head(CBOR_UINT, value);
+    }
+    else
+    {
+        head(CBOR_NEGINT, -1 - value);
+    }
+}
+
+void CborWriter::bytes(const uint8_t *data, size_t len)
+{
+    head(CBOR_BYTES, len);
+    put(data, len);
+}
+
+void CborWriter::text(const char *text)
+{
+    size_t len = strlen(text);
+    head(CBOR_TEXT, len);
+    put((const uint8_t *)text, len);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Minimal CBOR (RFC 8949) encoder for the batched Tilted uplink. Writes into
+// a fixed buffer; anything that does not fit sets overflowed() rather than
+// being written halfway.
+class CborWriter
+{
+public:
+    CborWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    void array(size_t count);
+    void map(size_t count);
+    void uint(uint64_t value);
+    void integer(int64_t value);
+    void bytes(const uint8_t *data, size_t len);
+    void text(const char *text);
+
+    size_t length() const { return used; }
+    bool overflowed() const { return overflow; }
+
+private:
+    void head(uint8_t major, uint64_t value);
+    void put(const uint8_t *data, size_t len);
+
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used = 0;
+    bool overflow = false;
+};
@@ -0,0 +1,210 @@
+#include "downlink.h"
+#include "log.h"
+#include "sensorota.h"
+
+struct PendingCommands
+{
+    uint8_t mac[6];
+    CommandEntry commands[DOWNLINK_MAX_COMMANDS];
+    uint8_t count;
+    // The first inFlight commands were sent and await the MAC layer ack.
+    uint8_t inFlight;
+};
+
+// Written by the web server, the radio task and the WiFi task.
+static PendingCommands pending[DOWNLINK_MAX_SENSORS];
+static int pendingCount = 0;
+static portMUX_TYPE downlinkMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const struct
+{
+    Command command;
+    const char *name;
+} commandNames[] = {
+    {COMMAND_SET_INTERVAL, "interval"},
+    {COMMAND_CALIBRATION, "calibration"},
+    {COMMAND_OTA_CHECK, "ota"},
+    {COMMAND_TARGET_RUNTIME, "target"},
+};
+
+bool downlinkParseCommand(const String &name, Command &command)
+{
+    for (const auto &entry : commandNames)
+    {
+        if (name == entry.name)
+        {
+            command = entry.command;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *downlinkCommandName(uint8_t command)
+{
+    for (const auto &entry : commandNames)
+    {
+        if (entry.command == command)
+        {
+            return entry.name;
+        }
+    }
+    return "unknown";
+}
+
+// Call with downlinkMux held.
+static PendingCommands *findPending(const uint8_t *mac, bool add)
+{
+    for (int i = 0; i < pendingCount; i++)
+    {
+        if (memcmp(pending[i].mac, mac, 6) == 0)
+        {
+            return &pending[i];
+        }
+    }
+    if (!add || pendingCount >= DOWNLINK_MAX_SENSORS)
+    {
+        return nullptr;
+    }
+    PendingCommands *entry = &pending[pendingCount++];
+    memset(entry, 0, sizeof(PendingCommands));
+    memcpy(entry->mac, mac, 6);
+    return entry;
+}
+
+bool downlinkQueue(const uint8_t *mac, Command command, int32_t value)
+{
+    bool queued = false;
+    portENTER_CRITICAL(&downlinkMux);
+    PendingCommands *entry = findPending(mac, true);
+    if (entry)
+    {
+        // Commands already on their way are left alone.
+        for (int i = entry->inFlight; i < entry->count; i++)
+        {
+            if (entry->commands[i].command == command)
+            {
+                entry->commands[i].value = value;
+                queued = true;
+                break;
+            }
+        }
+        if (!queued && entry->count < DOWNLINK_MAX_COMMANDS)
+        {
+            entry->commands[entry->count++] = {command, value};
+            queued = true;
+        }
+    }
+    portEXIT_CRITICAL(&downlinkMux);
+    return queued;
+}
+
+void downlinkDeliver(const uint8_t *mac, int32_t slotCorrection)
+{
+    CommandFrame frame;
+    frame.type = FRAME_COMMAND;
+    frame.count = 0;
+
+    portENTER_CRITICAL(&downlinkMux);
+    PendingCommands *entry = findPending(mac, false);
+    if (entry && entry->count > 0)
+    {
+        frame.count = entry->count;
+        memcpy(frame.commands, entry->commands, entry->count * sizeof(CommandEntry));
+        entry->inFlight = entry->count;
+    }
+    portEXIT_CRITICAL(&downlinkMux);
+
+    // Sent every time it is needed, so never queued or resent.
+    if (slotCorrection != 0 && frame.count < DOWNLINK_MAX_COMMANDS)
+    {
+        frame.commands[frame.count++] = {COMMAND_SLOT, slotCorrection};
+    }
+    if (frame.count == 0)
+    {
+        return;
+    }
+
+    if (!esp_now_is_peer_exist(mac))
+    {
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, mac, 6);
+        peer.channel = 0; // Whatever channel we are on.
+        peer.ifidx = WIFI_IF_STA;
+        peer.encrypt = false;
+        if (esp_now_add_peer(&peer) != ESP_OK)
+        {
+            LOGW("Could not add %02x:%02x:%02x:%02x:%02x:%02x as peer",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+            return;
+        }
+    }
+
+    size_t len = offsetof(CommandFrame, commands) + frame.count * sizeof(CommandEntry);
+    if (esp_now_send(mac, (const uint8_t *)&frame, len) != ESP_OK)
+    {
+        LOGW("Could not send commands");
+    }
+}
+
+void downlinkSent(const uint8_t *mac, esp_now_send_status_t status)
+{
+    int delivered = 0;
+    bool ota = false;
+    portENTER_CRITICAL(&downlinkMux);
+    PendingCommands *entry = findPending(mac, false);
+    if (entry && entry->inFlight > 0)
+    {
+        if (status == ESP_NOW_SEND_SUCCESS)
+        {
+            delivered = entry->inFlight;
+            for (int i = 0; i < delivered; i++)
+            {
+                ota |= entry->commands[i].command == COMMAND_OTA_CHECK;
+            }
+            memmove(entry->commands, entry->commands + delivered,
+                    (entry->count - delivered) * sizeof(CommandEntry));
+            entry->count -= delivered;
+        }
+        entry->inFlight = 0;
+    }
+    portEXIT_CRITICAL(&downlinkMux);
+
+    if (delivered > 0)
+    {
+        LOGI("Delivered %d commands to %02x:%02x:%02x:%02x:%02x:%02x", delivered,
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    }
+    // The sensor is about to come looking for an update.
+    if (ota && sensorOtaAvailable())
+    {
+        sensorOtaRequestAp();
+    }
+}
+
+void downlinkRender(String &out)
+{
+    PendingCommands copy[DOWNLINK_MAX_SENSORS];
+    portENTER_CRITICAL(&downlinkMux);
+    int count = pendingCount;
+    memcpy(copy, pending, count * sizeof(PendingCommands));
+    portEXIT_CRITICAL(&downlinkMux);
+
+    char entry[96];
+    out += '[';
+    bool first = true;
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *mac = copy[i].mac;
+        for (int c = 0; c < copy[i].count; c++)
+        {
+            snprintf(entry, sizeof(entry),
+                     "%s{\"sensor\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"command\":\"%s\",\"value\":%ld}",
+                     first ? "" : ",", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                     downlinkCommandName(copy[i].commands[c].command), (long)copy[i].commands[c].value);
+            out += entry;
+            first = false;
+        }
+    }
+    out += ']';
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+
+// Gateway to sensor commands.
+//
+// Sensors keep their radio on for a few ms after each reading. When a
+// reading arrives from a sensor with commands waiting, the gateway answers
+// right away with all of them in one frame. Commands stay queued until the
+// sensor has acknowledged the frame at the MAC layer, so a sensor running
+// older firmware, or one that went back to sleep, simply gets them on a
+// later wake.
+
+#define DOWNLINK_MAX_SENSORS 16
+#define DOWNLINK_MAX_COMMANDS 4
+
+// First byte of every frame sent to a sensor.
+#define FRAME_COMMAND 0xC1
+
+enum Command : uint8_t
+{
+    COMMAND_SET_INTERVAL = 1, // Sleep interval in seconds, 0 for the default.
+    COMMAND_CALIBRATION = 2,  // 1 to start calibration mode, 0 to leave it.
+    COMMAND_OTA_CHECK = 3,    // Check for a firmware update before sleeping.
+    COMMAND_TARGET_RUNTIME = 4, // Hours the battery should last, 0 for no target.
+    COMMAND_SLOT = 5 // Milliseconds to move the next wake by, see slots.h. Not queued.
+};
+
+// This must match CommandFrame in the sensor firmware. Only the first count
+// commands are sent.
+struct __attribute__((packed)) CommandEntry
+{
+    uint8_t command;
+    int32_t value;
+};
+
+struct __attribute__((packed)) CommandFrame
+{
+    uint8_t type;
+    uint8_t count;
+    CommandEntry commands[DOWNLINK_MAX_COMMANDS];
+};
+
+// Parse a command name as used on the web interface. Returns false if unknown.
+bool downlinkParseCommand(const String &name, Command &command);
+const char *downlinkCommandName(uint8_t command);
+
+// Queue a command for a sensor. A command of the same kind that has not been
+// sent yet is replaced. Returns false if the queue for the sensor is full.
+bool downlinkQueue(const uint8_t *mac, Command command, int32_t value);
+
+// Send waiting commands to a sensor that just reported, together with its
+// slot correction if it is not 0 and there is room. Radio task only.
+void downlinkDeliver(const uint8_t *mac, int32_t slotCorrection);
+
+// ESP-NOW send callback.
+void downlinkSent(const uint8_t *mac, esp_now_send_status_t status);
+
+// Append the pending commands of all sensors as a JSON array.
+void downlinkRender(String &out);
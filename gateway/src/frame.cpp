@@ -0,0 +1,69 @@
+#include "frame.h"
+
+// Returns false if data is not a relayed frame. Relays never send frames
+// past RELAY_MAX_HOPS, so hops needs no checking.
+static bool unwrapRelayed(const uint8_t *data, int len, const RelayFrame *&frame, int &payloadLen)
+{
+    uint32_t magic;
+    if (len <= (int)RELAY_HEADER_SIZE)
+    {
+        return false;
+    }
+    memcpy(&magic, data, sizeof(magic));
+    if (magic != RELAY_MAGIC)
+    {
+        return false;
+    }
+    frame = (const RelayFrame *)data;
+    payloadLen = len - RELAY_HEADER_SIZE;
+    return true;
+}
+
+bool frameDecode(const uint8_t *mac, int8_t rssi, const uint8_t *data, int len, int64_t receivedMs,
+                 DecodedFrame &out)
+{
+    // Cleared as a whole, padding too, so that replays compare byte for byte.
+    memset(&out.reading, 0, sizeof(Reading));
+    const RelayFrame *relayed;
+    if (unwrapRelayed(data, len, relayed, out.payloadLen))
+    {
+        out.hops = relayed->hops;
+        out.rssi = relayed->rssi;
+        out.payload = relayed->data;
+        memcpy(out.reading.sensorId, relayed->sensor, 6);
+    }
+    else
+    {
+        out.hops = 0;
+        out.rssi = rssi;
+        out.payload = data;
+        out.payloadLen = len;
+        memcpy(out.reading.sensorId, mac, 6);
+    }
+
+    if (out.payloadLen < (int)DATA_STRUCT_MIN_SIZE)
+    {
+        return false;
+    }
+
+    out.reading.receivedMs = receivedMs;
+    memcpy(&out.reading.data, out.payload, min((size_t)out.payloadLen, sizeof(DataStruct)));
+    return true;
+}
+
+bool frameNextCaptured(const uint8_t *capture, size_t size, size_t &pos, CaptureRecord &record,
+                       const uint8_t *&data)
+{
+    if (pos + sizeof(CaptureRecord) > size)
+    {
+        return false;
+    }
+    memcpy(&record, capture + pos, sizeof(CaptureRecord));
+    if (pos + sizeof(CaptureRecord) + record.len > size)
+    {
+        return false;
+    }
+    data = capture + pos + sizeof(CaptureRecord);
+    pos += sizeof(CaptureRecord) + record.len;
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include "reading.h"
+#include "relay.h"
+
+// Turning a received ESP-NOW frame into a reading. Kept apart from the radio
+// task so that captured frames can be replayed through the same code on the
+// host.
+
+// Start of a capture file, followed by records. This must match tools/replay.
+#define CAPTURE_MAGIC "TCP1"
+
+struct __attribute__((packed)) CaptureRecord
+{
+    uint32_t timeMs; // Since the capture started.
+    uint8_t mac[6];
+    int8_t rssi;
+    uint8_t len; // Followed by len bytes of frame.
+};
+
+struct DecodedFrame
+{
+    // Gravity and analytics are left to the caller.
+    Reading reading;
+    int8_t rssi;
+    uint8_t hops; // Relays the frame came through, 0 if heard directly.
+    // The sensor's own frame, within the received one, for relaying it on.
+    const uint8_t *payload;
+    int payloadLen;
+};
+
+// Decode a frame received from mac with rssi. Frames passed on by a relay
+// come out as if heard directly from the sensor. Fields an older sensor
+// leaves out read as zero. Returns false for a frame too short to be a
+// reading, with only the sensor and payload filled in.
+bool frameDecode(const uint8_t *mac, int8_t rssi, const uint8_t *data, int len, int64_t receivedMs,
+                 DecodedFrame &out);
+
+// Read the next record of a capture image, starting at pos just past the
+// magic. Returns false at the end, or at a truncated record.
+bool frameNextCaptured(const uint8_t *capture, size_t size, size_t &pos, CaptureRecord &record,
+                       const uint8_t *&data);
@@ -0,0 +1,30 @@
+#include "gravity.h"
+
+GravityFormula::~GravityFormula()
+{
+    te_free(expr);
+}
+
+bool GravityFormula::compile(const char *expression, int &err)
+{
+    te_free(expr);
+    te_variable vars[] = {{"tilt", &tilt}, {"temp", &temp}};
+    expr = te_compile(expression, vars, 2, &err);
+    return expr != nullptr;
+}
+
+float GravityFormula::evaluate(float tilt, float temp)
+{
+    if (!expr)
+    {
+        return 0;
+    }
+    this->tilt = tilt;
+    this->temp = temp;
+    return round3(te_eval(expr));
+}
+
+float round3(float value)
+{
+    return (int)(value * 1000 + 0.5) / 1000.0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+#include <tinyexpr.h>
+
+// The global gravity polynomial, an expression in tilt and temp, for sensors
+// without a calibration profile. It is compiled once when the settings are
+// loaded rather than for every frame.
+class GravityFormula
+{
+public:
+    GravityFormula() = default;
+    ~GravityFormula();
+    // The compiled expression points at tilt and temp.
+    GravityFormula(const GravityFormula &) = delete;
+    GravityFormula &operator=(const GravityFormula &) = delete;
+
+    // Returns false, leaving no formula, if the expression does not parse,
+    // with err the position where parsing stopped.
+    bool compile(const char *expression, int &err);
+    bool valid() const { return expr != nullptr; }
+
+    // Gravity for a reading, rounded to three decimals. 0 without a formula.
+    float evaluate(float tilt, float temp);
+
+private:
+    double tilt = 0;
+    double temp = 0;
+    te_expr *expr = nullptr;
+};
+
+float round3(float value);
@@ -0,0 +1,211 @@
+#include "live.h"
+#include <esp_timer.h>
+#include <stdarg.h>
+#include "log.h"
+#include "metrics.h"
+
+static QueueHandle_t queue = nullptr;
+static int queueMetric = -1;
+
+// Loop task only.
+static WiFiClient clients[LIVE_MAX_CLIENTS];
+static int clientCount = 0;
+static Reading latest[LIVE_MAX_SENSORS];
+static int latestCount = 0;
+static unsigned long lastWrite = 0;
+// Free heap while nobody is connected, to tell what clients cost.
+static uint32_t idleHeap = 0;
+
+void liveBegin()
+{
+    queue = xQueueCreate(LIVE_QUEUE_LENGTH, sizeof(Reading));
+    queueMetric = metricsRegisterQueue("live", queue, LIVE_QUEUE_LENGTH);
+}
+
+void liveReading(const Reading &reading)
+{
+    if (queue && xQueueSend(queue, &reading, 0) != pdTRUE)
+    {
+        metricsQueueDropped(queueMetric);
+    }
+}
+
+// Appends to the event at out + len, returning the new length, or size if
+// it did not fit. Once an event is cut short, every further append is too.
+static int appendEvent(char *out, size_t size, int len, const char *format, ...)
+{
+    if (len < 0 || len >= (int)size)
+    {
+        return size;
+    }
+    va_list args;
+    va_start(args, format);
+    int added = vsnprintf(out + len, size - len, format, args);
+    va_end(args);
+    return (added < 0 || added >= (int)size - len) ? size : len + added;
+}
+
+// A complete event, as sent to every client, or 0 if it does not fit, as
+// with a wild gravity from a broken polynomial.
+static size_t formatEvent(const Reading &r, char *out, size_t size)
+{
+    int64_t age = esp_timer_get_time() / 1000 - r.receivedMs;
+    int len = appendEvent(out, size, 0,
+                          "event: reading\ndata: {\"sensor\":\"%02x:%02x:%02x:%02x:%02x:%02x\",\"age\":%ld,"
+                          "\"gravity\":%.4f,\"tilt\":%.2f,\"temp\":%.2f,\"volt\":%d,\"interval\":%ld,\"implied\":%s",
+                          r.sensorId[0], r.sensorId[1], r.sensorId[2], r.sensorId[3], r.sensorId[4], r.sensorId[5],
+                          (long)age, r.gravity, r.data.tilt, r.data.temp, r.data.volt, (long)r.data.interval,
+                          r.implied ? "true" : "false");
+    const Analytics &a = r.analytics;
+    if (a.stage != STAGE_UNKNOWN)
+    {
+        len = appendEvent(out, size, len, ",\"stage\":\"%s\",\"gravity_slope\":%.4f",
+                          analyticsStageName(a.stage), a.slope);
+    }
+    if (a.og > 0)
+    {
+        len = appendEvent(out, size, len, ",\"og\":%.4f,\"attenuation\":%.1f", a.og, a.attenuation);
+    }
+    if (a.etaHours > 0)
+    {
+        len = appendEvent(out, size, len, ",\"eta_hours\":%.1f", a.etaHours);
+    }
+    len = appendEvent(out, size, len, "}\n\n");
+    return len < (int)size ? len : 0;
+}
+
+static bool send(WiFiClient &client, const char *data, size_t len)
+{
+    return client.write((const uint8_t *)data, len) == len;
+}
+
+static void updateMetrics()
+{
+    int32_t used = clientCount > 0 ? (int32_t)idleHeap - (int32_t)ESP.getFreeHeap() : 0;
+    metricsLiveClients(clientCount, clientCount > 0 && used > 0 ? used / clientCount : 0);
+}
+
+static void drop(int i)
+{
+    clients[i].stop();
+    clients[i] = clients[--clientCount];
+    clients[clientCount] = WiFiClient();
+    LOGD("Live client dropped, %d left", clientCount);
+    updateMetrics();
+}
+
+bool liveAccept(WiFiClient &client)
+{
+    if (clientCount >= LIVE_MAX_CLIENTS)
+    {
+        metricsLiveRejected();
+        return false;
+    }
+    if (clientCount == 0)
+    {
+        idleHeap = ESP.getFreeHeap();
+    }
+
+    // Events are small and should go out right away.
+    client.setNoDelay(true);
+    client.setTimeout(LIVE_WRITE_TIMEOUT);
+    char header[160];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\nretry: %d\n\n",
+                       LIVE_RETRY);
+    if (!send(client, header, len))
+    {
+        client.stop();
+        return true;
+    }
+    char event[384];
+    for (int i = 0; i < latestCount; i++)
+    {
+        len = formatEvent(latest[i], event, sizeof(event));
+        if (len && !send(client, event, len))
+        {
+            client.stop();
+            return true;
+        }
+    }
+
+    clients[clientCount++] = client;
+    LOGD("Live client connected, %d of %d", clientCount, LIVE_MAX_CLIENTS);
+    updateMetrics();
+    return true;
+}
+
+static void remember(const Reading &reading)
+{
+    for (int i = 0; i < latestCount; i++)
+    {
+        if (memcmp(latest[i].sensorId, reading.sensorId, 6) == 0)
+        {
+            latest[i] = reading;
+            return;
+        }
+    }
+    if (latestCount < LIVE_MAX_SENSORS)
+    {
+        latest[latestCount++] = reading;
+    }
+}
+
+void liveLoop()
+{
+    if (!queue)
+    {
+        return;
+    }
+    for (int i = clientCount - 1; i >= 0; i--)
+    {
+        if (!clients[i].connected())
+        {
+            drop(i);
+        }
+    }
+
+    Reading reading;
+    char event[384];
+    while (xQueueReceive(queue, &reading, 0) == pdTRUE)
+    {
+        remember(reading);
+        if (clientCount == 0)
+        {
+            continue;
+        }
+        size_t len = formatEvent(reading, event, sizeof(event));
+        if (len == 0)
+        {
+            continue;
+        }
+        for (int i = clientCount - 1; i >= 0; i--)
+        {
+            if (!send(clients[i], event, len))
+            {
+                drop(i);
+            }
+        }
+        // Time from the frame arriving to the event being handed to the
+        // network stack. Implied readings were never received.
+        if (!reading.implied && clientCount > 0)
+        {
+            metricsLivePushed(esp_timer_get_time() / 1000 - reading.receivedMs);
+        }
+        lastWrite = millis();
+    }
+
+    if (clientCount > 0 && millis() - lastWrite >= LIVE_KEEPALIVE)
+    {
+        for (int i = clientCount - 1; i >= 0; i--)
+        {
+            if (!send(clients[i], ":\n\n", 3))
+            {
+                drop(i);
+            }
+        }
+        lastWrite = millis();
+        updateMetrics();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include "reading.h"
+
+// Live readings for the dashboard on /live, pushed to browsers as
+// Server-Sent Events on /live/events. Every reading is sent as a "reading"
+// event with JSON data, and a newly connected client first gets the latest
+// reading of every sensor.
+//
+// The radio task only hands readings over through a short queue, never
+// waiting, and everything else happens in the loop task, which owns the web
+// server. A client that stops taking data is dropped after a write times out,
+// and at most LIVE_MAX_CLIENTS are served at once, so a forgotten browser tab
+// costs one socket rather than holding up the ingest path.
+
+#define LIVE_MAX_CLIENTS 4
+#define LIVE_MAX_SENSORS 16
+#define LIVE_QUEUE_LENGTH 8
+// Comment lines sent to idle clients, to notice ones that went away.
+#define LIVE_KEEPALIVE 15000
+// How long a write to a client may block the loop task, in seconds.
+#define LIVE_WRITE_TIMEOUT 1
+// How long a browser waits before reconnecting, in ms.
+#define LIVE_RETRY 5000
+
+void liveBegin();
+
+// Pass on a reading. Any task, never blocks.
+void liveReading(const Reading &reading);
+
+// Take over the client of an /live/events request, writing the response
+// headers and the latest readings. Returns false if the limit is reached.
+// Loop task only.
+bool liveAccept(WiFiClient &client);
+
+// Push queued readings and keepalives to clients. Loop task only.
+void liveLoop();
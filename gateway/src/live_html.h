@@ -0,0 +1,102 @@
+#pragma once
+
+// Generated from web/live.html by scripts/embed_live.py, do not edit.
+
+#include <Arduino.h>
+
+#define LIVE_HTML_ETAG "\"8c85e51acb7ce8a2\""
+#define LIVE_HTML_SIZE 1443
+
+const uint8_t LIVE_HTML_GZ[] PROGMEM = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x57, 0x6d, 0x6f, 0xdb, 0x36,
+    0x10, 0xfe, 0xde, 0x5f, 0x71, 0x75, 0xb1, 0x49, 0x5e, 0x62, 0xd9, 0x4e, 0x9b, 0x2e, 0xf0, 0x4b,
+    0x8a, 0x34, 0xcd, 0xba, 0x0e, 0x69, 0x33, 0x34, 0xc1, 0x80, 0x61, 0x28, 0x0a, 0x5a, 0x3c, 0x4b,
+    0x5c, 0x65, 0x51, 0x23, 0x29, 0x3b, 0x5e, 0x91, 0xff, 0xbe, 0x23, 0x29, 0xcb, 0xb2, 0xec, 0xb4,
+    0xb3, 0x10, 0x47, 0x12, 0xef, 0x8e, 0x77, 0xcf, 0x3d, 0x77, 0x47, 0x4f, 0x9e, 0xbe, 0xb9, 0xb9,
+    0xbc, 0xfb, 0xf3, 0xf7, 0x2b, 0x48, 0xcd, 0x22, 0x3b, 0x7f, 0x32, 0xd9, 0xfc, 0x43, 0xc6, 0xcf,
+    0x9f, 0x00, 0x7d, 0x26, 0x46, 0x98, 0x0c, 0xcf, 0xef, 0x44, 0x66, 0x90, 0xc3, 0xb5, 0x58, 0xe2,
+    0xa4, 0xef, 0x5f, 0xf9, 0xe5, 0x05, 0x1a, 0x06, 0x71, 0xca, 0x94, 0x46, 0x33, 0xed, 0x94, 0x66,
+    0xde, 0x3b, 0xeb, 0x34, 0x97, 0x72, 0xb6, 0xc0, 0x69, 0x67, 0x29, 0x70, 0x55, 0x48, 0x65, 0x3a,
+    0x10, 0xcb, 0xdc, 0x60, 0x4e, 0xa2, 0x2b, 0xc1, 0x4d, 0x3a, 0xe5, 0xb8, 0x14, 0x31, 0xf6, 0xdc,
+    0xc3, 0x31, 0x88, 0x5c, 0x18, 0xc1, 0xb2, 0x9e, 0x8e, 0x59, 0x86, 0xd3, 0xe1, 0xc6, 0x90, 0x36,
+    0xeb, 0xcd, 0x7e, 0xf6, 0x33, 0x93, 0x7c, 0x0d, 0x5f, 0x61, 0x4e, 0x96, 0x7a, 0x73, 0xb6, 0x10,
+    0xd9, 0x7a, 0x04, 0x17, 0x8a, 0xf4, 0x8e, 0x41, 0xb3, 0x5c, 0xf7, 0x34, 0x2a, 0x31, 0x1f, 0xc3,
+    0x82, 0xa9, 0x44, 0xe4, 0x23, 0x18, 0x8c, 0xa1, 0x60, 0x9c, 0x8b, 0x3c, 0x19, 0xc1, 0xc9, 0xa0,
+    0xb8, 0x1f, 0xc3, 0x8c, 0xc5, 0x5f, 0x12, 0x25, 0xcb, 0x9c, 0x8f, 0xe0, 0xd9, 0xfc, 0x85, 0xbd,
+    0xc6, 0xf0, 0x50, 0xdb, 0x4f, 0x87, 0x64, 0xbd, 0xd6, 0xa6, 0xeb, 0x85, 0x55, 0xda, 0xae, 0x3f,
+    0xd3, 0x86, 0x99, 0x52, 0x93, 0x50, 0x2c, 0x33, 0xa9, 0xc8, 0xc6, 0xd9, 0xd9, 0xd9, 0x66, 0xbf,
+    0xde, 0x4c, 0x1a, 0x23, 0x17, 0x23, 0x18, 0xbe, 0x6c, 0x6b, 0x61, 0xae, 0xa5, 0xb2, 0x6a, 0x5c,
+    0xe8, 0x22, 0x63, 0xe4, 0xf5, 0x3c, 0x43, 0x92, 0xb1, 0xdf, 0xbd, 0x95, 0x62, 0xc5, 0x08, 0xec,
+    0xf7, 0x18, 0x12, 0x7b, 0xdb, 0xd6, 0x8f, 0xbc, 0x3e, 0xa9, 0xef, 0xba, 0x3f, 0xa7, 0x50, 0x67,
+    0x52, 0x71, 0x54, 0x3d, 0xc5, 0xb8, 0x28, 0xf5, 0x08, 0x4e, 0xad, 0x66, 0x1d, 0xb3, 0x37, 0xb4,
+    0x20, 0xd7, 0x1c, 0xca, 0x04, 0x42, 0x85, 0x82, 0xbc, 0xef, 0xe9, 0x94, 0x71, 0xb9, 0xb2, 0x51,
+    0x0e, 0x8b, 0x7b, 0x78, 0x4e, 0x7f, 0x2a, 0x99, 0xb1, 0x70, 0x70, 0x6c, 0xaf, 0x68, 0xd8, 0x3d,
+    0xe4, 0x40, 0x7a, 0xb2, 0x01, 0x5f, 0x8b, 0x7f, 0x91, 0xec, 0x3b, 0x78, 0x36, 0x50, 0x9c, 0x9e,
+    0x9e, 0x8e, 0x77, 0xc0, 0x3b, 0xb3, 0xab, 0x4e, 0x7c, 0x85, 0x22, 0x49, 0xcd, 0x08, 0x72, 0xa9,
+    0x16, 0x2c, 0xdb, 0x31, 0x9d, 0x28, 0xb6, 0x14, 0x66, 0xbd, 0x6b, 0xf8, 0xc5, 0x60, 0x4f, 0x75,
+    0x26, 0x33, 0xbe, 0xa3, 0xa8, 0xe4, 0x6a, 0x1f, 0xd0, 0xbf, 0x4b, 0x6d, 0xc4, 0x7c, 0xdd, 0xab,
+    0xb8, 0x36, 0x02, 0x5d, 0x30, 0x22, 0xd9, 0x0c, 0xcd, 0x0a, 0x31, 0xaf, 0x33, 0x65, 0x24, 0xc1,
+    0xdc, 0xca, 0x6d, 0x94, 0xb1, 0x19, 0x66, 0xed, 0xd4, 0x36, 0xd6, 0x59, 0x82, 0xed, 0xd5, 0x26,
+    0x16, 0x27, 0x0e, 0xeb, 0x86, 0xfd, 0xb3, 0xad, 0xfd, 0x49, 0xbf, 0x22, 0xf2, 0xa4, 0xef, 0xeb,
+    0x6b, 0x62, 0x99, 0x5c, 0x71, 0x3c, 0x1d, 0x56, 0x35, 0x46, 0x8b, 0xc3, 0xea, 0x1d, 0x17, 0x4b,
+    0x10, 0x7c, 0xda, 0xf1, 0x7c, 0xeb, 0x9c, 0x5f, 0xca, 0x3c, 0xc7, 0xd8, 0x50, 0x56, 0xa3, 0x28,
+    0x9a, 0xf4, 0x69, 0xb9, 0x2d, 0xe8, 0x29, 0xd6, 0x39, 0x6f, 0x2e, 0xea, 0x58, 0x89, 0xc2, 0x6c,
+    0xcb, 0xa7, 0xdf, 0x87, 0x8f, 0xb4, 0x3d, 0x59, 0xd1, 0xc0, 0x14, 0x42, 0x51, 0xea, 0x94, 0x4a,
+    0x7b, 0xb6, 0x06, 0x93, 0x22, 0x71, 0xcf, 0xe0, 0x8a, 0xad, 0xa9, 0x94, 0xb0, 0x7e, 0xe8, 0x6b,
+    0x15, 0xf7, 0x33, 0x2a, 0xfd, 0x28, 0x8d, 0x6a, 0x33, 0x04, 0xae, 0x36, 0xb0, 0x21, 0xf5, 0x14,
+    0xbe, 0x3e, 0x8c, 0xdb, 0x6b, 0xbe, 0x4c, 0xa6, 0xc0, 0x65, 0x5c, 0x2e, 0x28, 0x11, 0x51, 0x82,
+    0xe6, 0x2a, 0x43, 0x7b, 0xfb, 0x7a, 0xfd, 0x8e, 0x87, 0x81, 0x97, 0x08, 0xba, 0xe3, 0x27, 0xb5,
+    0xea, 0xbc, 0xcc, 0x29, 0x42, 0x99, 0x03, 0x65, 0x36, 0x74, 0xc9, 0x38, 0x86, 0x25, 0xcb, 0x4a,
+    0xec, 0xc2, 0xd7, 0x5a, 0xc8, 0x7e, 0x14, 0x9a, 0x52, 0xe5, 0x10, 0xb8, 0xe0, 0xe3, 0x8c, 0x69,
+    0x3d, 0xed, 0x90, 0x0e, 0xc5, 0x4e, 0xd9, 0xce, 0x37, 0x6f, 0x9c, 0x85, 0xce, 0x79, 0x00, 0x47,
+    0xe0, 0x33, 0x7b, 0x44, 0x1a, 0x7d, 0x2b, 0xe1, 0xe5, 0xdc, 0x8a, 0xb3, 0xdf, 0x5c, 0x71, 0xe8,
+    0x05, 0xdb, 0x78, 0x1e, 0x0e, 0xf9, 0x87, 0x39, 0xd5, 0x5c, 0x28, 0x78, 0xdb, 0x31, 0x1f, 0xbc,
+    0xa2, 0xb8, 0x2b, 0x70, 0xfe, 0x12, 0xfc, 0xd3, 0x78, 0x47, 0x24, 0x43, 0xe3, 0x1a, 0x2e, 0xc9,
+    0x04, 0x93, 0xf4, 0xc4, 0x39, 0x21, 0xb8, 0xf7, 0x80, 0x1e, 0x9b, 0x21, 0x55, 0x95, 0xe1, 0x43,
+    0x50, 0x9b, 0x42, 0x89, 0x8c, 0xfc, 0x45, 0xdc, 0x23, 0x0f, 0x9f, 0x77, 0xbd, 0x96, 0x73, 0x18,
+    0x8e, 0x76, 0x76, 0x71, 0x28, 0x11, 0x8a, 0xc1, 0x1d, 0x2e, 0x0a, 0x54, 0x04, 0xb5, 0xc2, 0xe0,
+    0x98, 0x8c, 0x18, 0x7a, 0xae, 0x2d, 0x0c, 0x9d, 0x05, 0xf8, 0x91, 0x63, 0x32, 0xbe, 0x0c, 0xba,
+    0x8f, 0xda, 0x20, 0x72, 0x7a, 0x65, 0xba, 0x69, 0x29, 0x3b, 0xdd, 0xc7, 0x55, 0x5f, 0x33, 0x63,
+    0x50, 0xad, 0x49, 0x3b, 0x54, 0xd1, 0x52, 0x66, 0x06, 0xfa, 0x30, 0x1c, 0x0c, 0x06, 0xdd, 0xda,
+    0xcc, 0x89, 0xf7, 0xe1, 0x0f, 0xcb, 0x84, 0xa6, 0xba, 0x98, 0x5b, 0x15, 0x62, 0x49, 0xb2, 0x97,
+    0x7e, 0xd7, 0xa8, 0x2d, 0x84, 0x47, 0x53, 0xbf, 0xcb, 0xad, 0x95, 0x72, 0x1e, 0x56, 0xf2, 0x47,
+    0x95, 0xe3, 0x36, 0x51, 0x7e, 0xef, 0x0a, 0xbc, 0xcf, 0x3a, 0x93, 0x05, 0xc2, 0x4f, 0x2d, 0x27,
+    0x2a, 0x20, 0x0a, 0x29, 0x72, 0xa3, 0xfb, 0x9c, 0xad, 0xdb, 0xde, 0x3c, 0x1c, 0xf0, 0x4d, 0x26,
+    0xdf, 0x75, 0xec, 0xe6, 0xad, 0xf3, 0x4a, 0x26, 0x8d, 0xa4, 0xd5, 0xde, 0x5d, 0x10, 0x34, 0x79,
+    0xc9, 0x2c, 0xa3, 0x9c, 0x14, 0xdb, 0x3e, 0xd7, 0xe2, 0x03, 0xe7, 0xd8, 0x0f, 0xff, 0xc7, 0x1d,
+    0x9a, 0xb8, 0x9f, 0x53, 0x59, 0x2a, 0xfd, 0x5d, 0xaf, 0xee, 0xa8, 0x47, 0x11, 0x0b, 0x85, 0xdf,
+    0xb6, 0xd6, 0x6b, 0x6d, 0x0a, 0xe9, 0xb7, 0x77, 0xdd, 0x98, 0xdc, 0xa9, 0x42, 0x42, 0xbf, 0x03,
+    0x9c, 0x19, 0xd6, 0x33, 0xc2, 0x0e, 0x7f, 0xcf, 0x5c, 0x7b, 0x6f, 0x4d, 0x76, 0xf6, 0xcb, 0xcb,
+    0x31, 0x25, 0x8a, 0x99, 0xe2, 0x91, 0xa0, 0x0e, 0xa7, 0x7e, 0xbd, 0x7b, 0x7f, 0x4d, 0xa5, 0x61,
+    0x8d, 0xef, 0x0a, 0x95, 0x05, 0x99, 0xc5, 0x8b, 0x04, 0x75, 0xd8, 0xfd, 0x76, 0x75, 0x36, 0x25,
+    0x5b, 0x50, 0xcc, 0x69, 0x86, 0x85, 0xbe, 0x48, 0xa9, 0x1f, 0xc8, 0xf9, 0xb6, 0x3d, 0xfd, 0x53,
+    0x12, 0x4d, 0x6f, 0x31, 0xa3, 0x1e, 0x2b, 0xd5, 0x45, 0x96, 0x85, 0x81, 0x6d, 0xf7, 0x41, 0xf7,
+    0x10, 0x98, 0x55, 0x8b, 0x23, 0x37, 0xdf, 0x33, 0x93, 0x46, 0x6e, 0x1c, 0x87, 0xe1, 0x1b, 0xda,
+    0x34, 0xca, 0x09, 0xdf, 0x2e, 0xf4, 0xc8, 0x7a, 0x64, 0x51, 0xa0, 0x83, 0x91, 0x0b, 0xbe, 0xbb,
+    0xa1, 0xfd, 0x78, 0xcf, 0x18, 0x49, 0x1a, 0xbc, 0x37, 0x97, 0x7e, 0x5e, 0xd9, 0xce, 0x01, 0x13,
+    0x9a, 0x25, 0x03, 0x78, 0x45, 0x77, 0x36, 0x0d, 0xd4, 0xa9, 0x13, 0x19, 0xc0, 0xc8, 0x2d, 0xfc,
+    0x7c, 0x32, 0xb0, 0x2b, 0x8d, 0x7d, 0x35, 0x99, 0x7e, 0x59, 0x65, 0x8c, 0x06, 0xfd, 0x46, 0xb8,
+    0x25, 0xf1, 0xfc, 0xe5, 0x60, 0x93, 0x55, 0x27, 0xf1, 0x58, 0x62, 0x1b, 0x78, 0x56, 0x30, 0x2d,
+    0xc9, 0x2b, 0x1b, 0x6a, 0x8e, 0x2b, 0xb8, 0xb2, 0x0f, 0xb7, 0xc4, 0x95, 0x18, 0xc3, 0xc0, 0x4d,
+    0x85, 0xbe, 0x5f, 0x6f, 0x32, 0xc5, 0xbf, 0x89, 0xe8, 0x08, 0xe2, 0xc4, 0xaf, 0x85, 0xa6, 0xc0,
+    0xa8, 0x5b, 0x06, 0xca, 0x4f, 0x1e, 0x22, 0x1d, 0xc2, 0xf4, 0xfc, 0xd1, 0xce, 0xf9, 0xdb, 0xed,
+    0xcd, 0x87, 0xa8, 0xb0, 0x87, 0xca, 0x10, 0x1d, 0x88, 0x2d, 0xd0, 0x68, 0x86, 0xdd, 0x6d, 0x87,
+    0x95, 0x6d, 0xb4, 0x5c, 0x43, 0x4a, 0x67, 0x81, 0x4c, 0xe6, 0x89, 0x0d, 0x0e, 0x04, 0x19, 0xc2,
+    0x18, 0xc9, 0x3d, 0xee, 0xe6, 0x5a, 0xb5, 0x31, 0xcd, 0x35, 0x49, 0x07, 0x90, 0xb6, 0xb1, 0x38,
+    0x93, 0xf1, 0x17, 0x10, 0x9a, 0x22, 0x44, 0x4e, 0x1a, 0xc4, 0x20, 0x14, 0xa4, 0xa6, 0x40, 0x0b,
+    0x8e, 0x51, 0x8b, 0xa9, 0x8e, 0xca, 0x53, 0xd8, 0x49, 0xb6, 0xb2, 0x54, 0x39, 0x44, 0xe9, 0xc6,
+    0x1c, 0x50, 0xd5, 0x11, 0xea, 0x93, 0xcd, 0x6b, 0xfb, 0x9d, 0x17, 0xa6, 0xd3, 0x51, 0x99, 0x65,
+    0xfb, 0x5d, 0xf0, 0xa9, 0x37, 0x76, 0x88, 0x89, 0xf5, 0x36, 0x35, 0x8f, 0x63, 0x0a, 0xd6, 0x60,
+    0x35, 0x69, 0xc3, 0x80, 0xaa, 0x2d, 0x38, 0x40, 0xba, 0xaa, 0xe2, 0x5c, 0xd1, 0x7e, 0x60, 0x2e,
+    0xa2, 0xc0, 0xfb, 0x12, 0xec, 0x0b, 0x3f, 0x3e, 0xc2, 0x7d, 0x1c, 0x41, 0x37, 0x62, 0x45, 0x41,
+    0x69, 0xb8, 0x4c, 0x45, 0xc6, 0xc3, 0xca, 0xdb, 0x6f, 0xb5, 0x8e, 0x7d, 0x50, 0xa8, 0x33, 0xb5,
+    0x00, 0xf4, 0x23, 0x76, 0x23, 0xd1, 0x2c, 0xf9, 0x7d, 0xae, 0xc9, 0x9c, 0x9a, 0x7a, 0x4e, 0x46,
+    0x28, 0x1d, 0xc4, 0x2c, 0x7f, 0xb4, 0x68, 0x95, 0x55, 0x60, 0x7f, 0xbf, 0x04, 0x07, 0x54, 0x51,
+    0x29, 0xa9, 0xbe, 0xad, 0x5b, 0xc9, 0x5a, 0x1e, 0xad, 0x69, 0xd6, 0x18, 0xc2, 0x6b, 0x3a, 0x6d,
+    0x56, 0x43, 0x74, 0x79, 0x7d, 0x73, 0x7b, 0xf5, 0x66, 0x27, 0x82, 0x57, 0x10, 0xbc, 0xad, 0x38,
+    0x3a, 0x2b, 0x35, 0x9d, 0xaa, 0x14, 0x66, 0x92, 0x11, 0x23, 0x25, 0x18, 0xb5, 0x26, 0xa2, 0x32,
+    0x6a, 0xc0, 0x94, 0xf4, 0xe0, 0x23, 0xc6, 0xcd, 0xc3, 0x5d, 0xc3, 0x47, 0x6a, 0x1f, 0xef, 0xc8,
+    0x07, 0x45, 0x87, 0x94, 0x70, 0xdb, 0xd5, 0x8e, 0x9b, 0xad, 0x84, 0x8e, 0x2d, 0xd5, 0x19, 0x6f,
+    0xd2, 0xf7, 0x47, 0x4a, 0x3a, 0x46, 0xb8, 0x1f, 0x72, 0xff, 0x01, 0x1c, 0x5a, 0xf7, 0x1d, 0xe0,
+    0x0d, 0x00, 0x00,
+};
@@ -0,0 +1,293 @@
+#include "log.h"
+#include <atomic>
+
+#define LOG_TASK_CORE 1
+#define LOG_TASK_PRIORITY 1
+#define LOG_TASK_STACK 3072
+// How long the drain task sleeps when the ring is empty, in ms.
+#define LOG_DRAIN_INTERVAL 50
+
+// Bounded multi-producer queue: each slot carries a sequence number telling
+// producers and the consumer whose turn it is, so no locks are needed.
+struct LogSlot
+{
+    std::atomic<uint32_t> sequence;
+    LogRecord record;
+};
+
+static LogSlot ring[LOG_RING_SIZE];
+static std::atomic<uint32_t> enqueuePos(0);
+static uint32_t dequeuePos = 0; // single consumer
+static std::atomic<uint32_t> dropped(0);
+static bool ringReady = false;
+
+static void initRing()
+{
+    for (uint32_t i = 0; i < LOG_RING_SIZE; i++)
+    {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ringReady = true;
+}
+
+void logPush(const LogRecord &record)
+{
+    if (!ringReady)
+    {
+        return;
+    }
+
+    uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    for (;;)
+    {
+        slot = &ring[pos & (LOG_RING_SIZE - 1)];
+        uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - pos);
+        if (diff == 0)
+        {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record = record;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+static bool logPop(LogRecord &record)
+{
+    LogSlot *slot = &ring[dequeuePos & (LOG_RING_SIZE - 1)];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if ((int32_t)(sequence - (dequeuePos + 1)) < 0)
+    {
+        return false;
+    }
+    record = slot->record;
+    slot->sequence.store(dequeuePos + LOG_RING_SIZE, std::memory_order_release);
+    dequeuePos++;
+    return true;
+}
+
+void logPack(LogRecord &record, int value)
+{
+    logPack(record, (long)value);
+}
+
+void logPack(LogRecord &record, unsigned int value)
+{
+    logPack(record, (unsigned long)value);
+}
+
+void logPack(LogRecord &record, long value)
+{
+    if (record.argc < LOG_MAX_ARGS)
+    {
+        record.types[record.argc] = LOG_ARG_INT;
+        record.args[record.argc++].i = value;
+    }
+}
+
+void logPack(LogRecord &record, unsigned long value)
+{
+    if (record.argc < LOG_MAX_ARGS)
+    {
+        record.types[record.argc] = LOG_ARG_UINT;
+        record.args[record.argc++].u = value;
+    }
+}
+
+void logPack(LogRecord &record, double value)
+{
+    if (record.argc < LOG_MAX_ARGS)
+    {
+        record.types[record.argc] = LOG_ARG_FLOAT;
+        record.args[record.argc++].f = value;
+    }
+}
+
+void logPack(LogRecord &record, const char *value)
+{
+    if (record.argc >= LOG_MAX_ARGS)
+    {
+        return;
+    }
+    // Strings are copied, truncated to whatever room is left in the record.
+    uint8_t offset = record.textUsed;
+    size_t room = LOG_TEXT_SIZE - offset;
+    if (room > 0)
+    {
+        strlcpy(record.text + offset, value ? value : "(null)", room);
+        record.textUsed += strlen(record.text + offset) + 1;
+        if (record.textUsed > LOG_TEXT_SIZE)
+        {
+            record.textUsed = LOG_TEXT_SIZE;
+        }
+    }
+    record.types[record.argc] = LOG_ARG_TEXT;
+    record.args[record.argc++].u = offset < LOG_TEXT_SIZE ? offset : LOG_TEXT_SIZE - 1;
+}
+
+void logPack(LogRecord &record, const String &value)
+{
+    logPack(record, value.c_str());
+}
+
+static bool isConversion(char c)
+{
+    return strchr("diouxXcsfFeEgGaAp", c) != nullptr;
+}
+
+static bool isLengthModifier(char c)
+{
+    return strchr("hlLqjzt", c) != nullptr;
+}
+
+// Format a record by feeding each conversion of its format string to
+// snprintf with the argument type that was stored for it.
+static size_t formatRecord(const LogRecord &record, char *out, size_t size)
+{
+    static const char levels[] = "-EWID";
+    size_t len = snprintf(out, size, "[%6lu.%03lu][%c] ",
+                          (unsigned long)(record.timestamp / 1000),
+                          (unsigned long)(record.timestamp % 1000),
+                          levels[record.level < sizeof(levels) - 1 ? record.level : 0]);
+    int arg = 0;
+    const char *p = record.format;
+
+    while (*p && len < size - 1)
+    {
+        if (*p != '%')
+        {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Copy the flags, width and precision, dropping any length
+        // modifier since we pick our own from the stored type.
+        char spec[16];
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p && !isConversion(*p) && n < sizeof(spec) - 3)
+        {
+            if (!isLengthModifier(*p))
+            {
+                spec[n++] = *p;
+            }
+            p++;
+        }
+        char conversion = *p ? *p++ : 's';
+
+        if (arg >= record.argc)
+        {
+            break;
+        }
+
+        int written = 0;
+        switch (record.types[arg])
+        {
+        case LOG_ARG_INT:
+        case LOG_ARG_UINT:
+            if (conversion == 'c')
+            {
+                spec[n++] = 'c';
+                spec[n] = '\0';
+                written = snprintf(out + len, size - len, spec, (int)record.args[arg].i);
+            }
+            else
+            {
+                spec[n++] = 'l';
+                spec[n++] = conversion;
+                spec[n] = '\0';
+                if (record.types[arg] == LOG_ARG_INT)
+                {
+                    written = snprintf(out + len, size - len, spec, (long)record.args[arg].i);
+                }
+                else
+                {
+                    written = snprintf(out + len, size - len, spec, (unsigned long)record.args[arg].u);
+                }
+            }
+            break;
+        case LOG_ARG_FLOAT:
+            spec[n++] = conversion;
+            spec[n] = '\0';
+            written = snprintf(out + len, size - len, spec, (double)record.args[arg].f);
+            break;
+        case LOG_ARG_TEXT:
+            spec[n++] = 's';
+            spec[n] = '\0';
+            written = snprintf(out + len, size - len, spec, record.text + record.args[arg].u);
+            break;
+        }
+        arg++;
+
+        if (written > 0)
+        {
+            len += written;
+        }
+        if (len >= size - 1)
+        {
+            len = size - 1;
+        }
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+static void logTask(void *parameter)
+{
+    LogRecord record;
+    char line[192];
+    uint32_t reportedDrops = 0;
+
+    for (;;)
+    {
+        bool wrote = false;
+        while (logPop(record))
+        {
+            formatRecord(record, line, sizeof(line));
+            Serial.println(line);
+            wrote = true;
+        }
+
+        uint32_t drops = dropped.load(std::memory_order_relaxed);
+        if (drops != reportedDrops)
+        {
+            Serial.printf("[log] %u messages dropped\n", drops - reportedDrops);
+            reportedDrops = drops;
+        }
+
+        if (!wrote)
+        {
+            vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL));
+        }
+    }
+}
+
+void logBegin()
+{
+    if (!ringReady)
+    {
+        initRing();
+    }
+    xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK, NULL, LOG_TASK_PRIORITY, NULL, LOG_TASK_CORE);
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Deferred logging. LOGx() calls copy the format pointer and their arguments
+// into a binary record in a lock-free ring buffer, and a low priority task
+// formats and writes the records to Serial. This keeps Serial out of the
+// WiFi callback and the other hot paths.
+//
+// The format must be a string literal, since only the pointer is stored.
+// String arguments are copied into the record, so temporaries are fine.
+// A newline is appended to every message.
+//
+// Messages below LOG_LEVEL are removed at compile time.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Ring size in records, must be a power of two.
+#define LOG_RING_SIZE 64
+#define LOG_MAX_ARGS 8
+// Room for string arguments, shared by all of them in a record.
+#define LOG_TEXT_SIZE 48
+
+enum LogArgType : uint8_t
+{
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_FLOAT,
+    LOG_ARG_TEXT
+};
+
+struct LogRecord
+{
+    const char *format;
+    uint32_t timestamp;
+    uint8_t level;
+    uint8_t argc;
+    uint8_t textUsed;
+    LogArgType types[LOG_MAX_ARGS];
+    union
+    {
+        int32_t i;
+        uint32_t u;
+        float f;
+    } args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE];
+};
+
+// Set up the ring and start the drain task. Call this first in setup();
+// records pushed before it are discarded.
+void logBegin();
+
+// Push a record. Never blocks; drops the record if the ring is full.
+void logPush(const LogRecord &record);
+
+void logPack(LogRecord &record, int value);
+void logPack(LogRecord &record, unsigned int value);
+void logPack(LogRecord &record, long value);
+void logPack(LogRecord &record, unsigned long value);
+void logPack(LogRecord &record, double value);
+void logPack(LogRecord &record, const char *value);
+void logPack(LogRecord &record, const String &value);
+
+template <typename... Args>
+void logWrite(uint8_t level, const char *format, Args... args)
+{
+    LogRecord record;
+    record.format = format;
+    record.timestamp = millis();
+    record.level = level;
+    record.argc = 0;
+    record.textUsed = 0;
+    int unpack[] = {0, (logPack(record, args), 0)...};
+    (void)unpack;
+    logPush(record);
+}
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOGE(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(...) logWrite(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOGW(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(...) logWrite(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOGI(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(...) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOGD(...) do {} while (0)
+#endif
@@ -1,17 +1,31 @@
 #include "WiFi.h"
 #include <esp_wifi.h>
 #include <esp_now.h>
+#include <esp_timer.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include <HTTPClient.h>
-#include <tinyexpr.h>
 #include <Preferences.h>
 #include <InfluxDbClient.h>
 #include <Button2.h>
 #include <TFT_eSPI.h>
 #include <SPI.h>
-#include <CircularBuffer.h>
 #include <WebServer.h>
+#include "reading.h"
+#include "metrics.h"
+#include "publisher.h"
+#include "log.h"
+#include "timeseries.h"
+#include "downlink.h"
+#include "sensorota.h"
+#include "calibration.h"
+#include "relay.h"
+#include "slots.h"
+#include "capture.h"
+#include "gravity.h"
+#include "frame.h"
+#include "live.h"
+#include "live_html.h"
 
 // Button definitions
 #define BUTTON_1 35
@@ -25,11 +39,20 @@ TFT_eSPI tft = TFT_eSPI(135, 240);
 // Preferences
 Preferences preferences;
 
-// Config variables
+// Config variables. Set once by loadSettings() before the tasks start and
+// never changed after that, the radio and publisher tasks read them without
+// locking. The config page only stores new settings, which take effect after
+// the restart that follows.
 String deviceName = "TiltedGateway";
 String wifiSSID = "";
 String wifiPassword = "";
 String polynomial = "";
+// The polynomial, compiled when the settings are loaded.
+GravityFormula gravityFormula;
+// Final gravity the fermentation ETA counts down to, empty for none.
+String targetGravity = "";
+// targetGravity parsed, 0 for none.
+float targetGravityValue = 0;
 String mqttServer = "";
 String mqttTopic = "tilted/data";
 String brewfatherURL = "";
@@ -38,13 +61,30 @@ String influxdbOrg = "";
 String influxdbBucket = "";
 String influxdbToken = "";
 String tiltedURL = "";
+// <tiltedURL>/batch, for the batching Tilted publisher.
+String tiltedBatchURL = "";
 String tiltedUsername = "";
 String tiltedPassword = "";
+// Send readings to the Tilted API in batches, CBOR encoded.
+bool tiltedBatch = false;
+// Forward sensor frames to another gateway instead of publishing them.
+bool relayMode = false;
+// Needed for requests that change sensors or stored data, user "admin".
+String adminPassword = "";
+// Soft AP for sensors fetching firmware. Must match GATEWAY_OTA_PASS in the
+// sensor's credentials.h; the AP stays off while it is shorter than WPA2
+// allows.
+String otaApPassword = "";
 
 // AP mode settings
 const char* apSSID = "TiltedGateway-Setup";
 const char* apPassword = "tilted123";
 
+// Must match GATEWAY_OTA_SSID in the sensor's credentials.h.
+const char* otaApSSID = "TiltedGateway-OTA";
+// Written by the loop task, read when the publish task switches WiFi modes.
+volatile bool otaApActive = false;
+
 // Config mode flag
 bool configMode = false;
 
@@ -53,37 +93,121 @@ WebServer server(80);
 
 #define RETRY_INTERVAL 5000
 
-// MQTT config
-WiFiClient wifiClient;
-PubSubClient mqttClient(wifiClient);
+// the following settings must match the slave settings
+uint8_t mac[] = {0x3A, 0x33, 0x33, 0x33, 0x33, 0x33};
+// ESP-NOW channel while not connected to WiFi. Once connected the gateway
+// stays on the AP's channel, sensors search for it. Relays never connect,
+// they look up the AP's channel instead, see findApChannel().
+uint8_t channel = 1;
 
-// InfluxDB
-InfluxDBClient influxClient;
-Point influxDataPoint("tilted_data");
+// How a frame posted to /replay is handled, see handleReplay().
+enum ReplayMode : uint8_t
+{
+    REPLAY_NONE,   // Heard over the air.
+    REPLAY_DRY,    // Decoded and logged only.
+    REPLAY_PUBLISH // Handled like a frame heard, but never answered.
+};
 
-// Tilted
-WiFiClientSecure secureClient;
+// Raw ESP-NOW frame as handed to us by the receive callback.
+struct RawFrame
+{
+    uint8_t mac[6];
+    int8_t rssi;
+    uint8_t len;
+    int64_t receivedMs; // Gateway uptime, for transmit slots.
+    ReplayMode replay;
+    uint8_t data[ESP_NOW_MAX_DATA_LEN];
+};
 
-// the following three settings must match the slave settings
-uint8_t mac[] = {0x3A, 0x33, 0x33, 0x33, 0x33, 0x33};
-const uint8_t channel = 1;
-struct __attribute__((packed)) DataStruct
+// Task layout. The WiFi stack, and with it the ESP-NOW receive callback,
+// runs on core 0, so frame decoding and the sensor table stay there.
+// Publishing and display share core 1 with the Arduino loop().
+#define RADIO_TASK_CORE 0
+#define RADIO_TASK_PRIORITY 3
+#define RADIO_TASK_STACK 4096
+#define PUBLISH_TASK_CORE 1
+#define PUBLISH_TASK_PRIORITY 2
+#define PUBLISH_TASK_STACK 4096
+#define DISPLAY_TASK_CORE 1
+#define DISPLAY_TASK_PRIORITY 1
+#define DISPLAY_TASK_STACK 4096
+#define STORAGE_TASK_CORE 1
+#define STORAGE_TASK_PRIORITY 1
+#define STORAGE_TASK_STACK 4096
+
+#define RX_QUEUE_LENGTH 8
+#define PUBLISH_QUEUE_LENGTH 8
+#define STORAGE_QUEUE_LENGTH 8
+
+// Maximum number of sensors kept in the sensor table.
+#define MAX_SENSORS 16
+
+// Sensors wake a little late or early. An implied reading is only filled in
+// once the wake it stands for is this far (percent of the interval) overdue.
+#define IMPLIED_READING_SLACK 10
+
+QueueHandle_t rxQueue;
+QueueHandle_t publishQueue;
+QueueHandle_t storageQueue;
+QueueHandle_t displayQueue; // length 1, always holds the newest reading
+
+TaskHandle_t radioTaskHandle;
+TaskHandle_t publishTaskHandle;
+TaskHandle_t displayTaskHandle;
+TaskHandle_t storageTaskHandle;
+
+// Metrics ids of the queues above, for counting drops.
+int rxQueueMetric;
+int publishQueueMetric;
+int storageQueueMetric;
+
+// RSSI of the last ESP-NOW frame seen by the promiscuous callback.
+// Both callbacks run in the WiFi task, so no locking is needed.
+int8_t lastFrameRssi = 0;
+uint8_t lastFrameMac[6];
+
+// Last reading per sensor. Owned by the radio task.
+struct SensorEntry
 {
-    float tilt;
-    float temp;
-    int volt;
-    long interval;
+    uint8_t mac[6];
+    Reading last;
+    unsigned long lastSeen;
+    uint32_t frames;
+    // Readings filled in since the last frame, for sensors that only send
+    // on change, and whether the sensor is overdue.
+    uint32_t implied;
+    bool missed;
 };
 
-uint8_t sensorId[6];
-DataStruct tiltData;
-float tiltGravity = 0;
+SensorEntry sensorTable[MAX_SENSORS];
+int sensorCount = 0;
+
+// Points drawn in the gravity graph, downsampled from the sensor's whole
+// stored history. Owned by the display task.
+#define GRAPH_POINTS 64
+TsPoint graphPoints[GRAPH_POINTS];
 
-// Buffer with readings for graph display.
-// Can be either tilt value or gravity.
-CircularBuffer<float, 24> readingsHistory;
+// Readings are only stored once the clock has been set, since history is
+// keyed by wall time. Anything before this is an unset clock.
+#define MIN_VALID_TIME 1600000000
+#define NTP_SERVER "pool.ntp.org"
 
-volatile boolean haveReading = false;
+// Wall time of a reading in ms. Readings are stamped with the gateway's
+// uptime, so one received before SNTP set the clock, or published long after
+// it arrived, still gets the time it was received. False while the clock is
+// not set.
+bool readingTime(const Reading &reading, int64_t &unixMs)
+{
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    if (now.tv_sec < MIN_VALID_TIME)
+    {
+        return false;
+    }
+    int64_t age = esp_timer_get_time() / 1000 - reading.receivedMs;
+    unixMs = (int64_t)now.tv_sec * 1000 + now.tv_usec / 1000 - age;
+    return true;
+}
 
 // HTML for configuration page
 const char CONFIG_HTML[] PROGMEM = R"rawliteral(
@@ -112,6 +236,17 @@ const char CONFIG_HTML[] PROGMEM = R"rawliteral(
                         <label for="deviceName">Device Name:</label>
                         <input type="text" id="deviceName" name="deviceName" value="%DEVICE_NAME%">
                     </div>
+                    <div class="form-group">
+                        <label><input type="checkbox" name="relayMode" %RELAY_MODE%> Relay: pass sensor readings on to another gateway instead of publishing them</label>
+                    </div>
+                    <div class="form-group">
+                        <label for="adminPassword">Admin Password (user admin, for commands, calibration, uploads and replay outside this page):</label>
+                        <input type="password" id="adminPassword" name="adminPassword" value="%ADMIN_PASSWORD%">
+                    </div>
+                    <div class="form-group">
+                        <label for="otaApPassword">Sensor Firmware AP Password (at least 8 characters, as GATEWAY_OTA_PASS on the sensors):</label>
+                        <input type="password" id="otaApPassword" name="otaApPassword" value="%OTA_AP_PASSWORD%">
+                    </div>
                 </fieldset>
             </div>
             
@@ -136,6 +271,10 @@ const char CONFIG_HTML[] PROGMEM = R"rawliteral(
                         <label for="polynomial">Polynomial:</label>
                         <input type="text" id="polynomial" name="polynomial" value="%POLYNOMIAL%">
                     </div>
+                    <div class="form-group">
+                        <label for="targetGravity">Target gravity, for the fermentation ETA:</label>
+                        <input type="text" id="targetGravity" name="targetGravity" value="%TARGET_GRAVITY%">
+                    </div>
                 </fieldset>
             </div>
             
@@ -200,6 +339,9 @@ const char CONFIG_HTML[] PROGMEM = R"rawliteral(
                         <label for="tiltedPassword">Tilted Password:</label>
                         <input type="password" id="tiltedPassword" name="tiltedPassword" value="%TILTED_PASSWORD%">
                     </div>
+                    <div class="form-group">
+                        <label><input type="checkbox" name="tiltedBatch" %TILTED_BATCH%> Batched: send readings together in compact CBOR (needs a server with /batch)</label>
+                    </div>
                 </fieldset>
             </div>
             
@@ -209,240 +351,544 @@ const char CONFIG_HTML[] PROGMEM = R"rawliteral(
     </html>
     )rawliteral";
 
-float round3(float value)
+// Calibration page, filled in from /calibration.
+const char CALIBRATION_HTML[] PROGMEM = R"rawliteral(
+    <!DOCTYPE html>
+    <html>
+    <head>
+        <title>Tilted Gateway Calibration</title>
+        <meta name="viewport" content="width=device-width, initial-scale=1">
+        <style>
+            body { font-family: Arial, sans-serif; margin: 0; padding: 20px; }
+            table { border-collapse: collapse; margin-bottom: 10px; }
+            td, th { border: 1px solid #ccc; padding: 4px 8px; text-align: right; }
+            .sensor { margin-bottom: 30px; }
+        </style>
+    </head>
+    <body>
+        <h1>Calibration</h1>
+        <p>Take a hydrometer reading, wait for the sensor to report, then add the reading as a point.
+        Fit once there are points across the range you brew in.</p>
+        <div id="sensors">Loading...</div>
+        <script>
+            function post(sensor, params) {
+                params.sensor = sensor;
+                fetch('/calibration', {method: 'POST', body: new URLSearchParams(params)})
+                    .then(r => r.text().then(t => { if (!r.ok) alert(t); load(); }));
+            }
+            function load() {
+                fetch('/calibration').then(r => r.json()).then(profiles => {
+                    let html = profiles.length ? '' : 'No sensors heard yet.';
+                    for (const p of profiles) {
+                        html += '<div class="sensor"><h2>' + p.sensor + '</h2>';
+                        if (p.tilt !== undefined) html += '<p>Latest: tilt ' + p.tilt + ', temp ' + p.temp + '</p>';
+                        html += p.degree ? '<p>Degree ' + p.degree + ' fit, RMS ' + p.rms + ', gravity = ' +
+                            p.coefficients.map((c, i) => c + (i ? ' * tilt^' + i : '')).join(' + ') + '</p>'
+                            : '<p>Not fitted, using the global polynomial.</p>';
+                        html += '<table><tr><th>Tilt</th><th>Temp</th><th>Gravity</th><th>Fitted</th><th>Residual</th></tr>';
+                        for (const q of p.points) {
+                            html += '<tr><td>' + q.tilt + '</td><td>' + q.temp + '</td><td>' + q.gravity + '</td><td>' +
+                                (q.fitted ?? '') + '</td><td>' + (q.residual ?? '') + '</td></tr>';
+                        }
+                        html += '</table>';
+                        const s = "'" + p.sensor + "'";
+                        html += '<input id="g' + p.sensor + '" type="number" step="0.001" placeholder="1.050"> ' +
+                            '<button onclick="post(' + s + ', {action: \'point\', gravity: document.getElementById(\'g' + p.sensor + '\').value})">Add point</button> ' +
+                            '<button onclick="post(' + s + ', {action: \'fit\', degree: 2})">Fit 2nd order</button> ' +
+                            '<button onclick="post(' + s + ', {action: \'fit\', degree: 3})">Fit 3rd order</button> ' +
+                            '<button onclick="post(' + s + ', {action: \'clear\'})">Clear</button></div>';
+                    }
+                    document.getElementById('sensors').innerHTML = html;
+                });
+            }
+            load();
+        </script>
+    </body>
+    </html>
+    )rawliteral";
+
+float calculateGravity(const uint8_t *mac, const DataStruct &data)
 {
-    return (int)(value * 1000 + 0.5) / 1000.0;
+    float fitted;
+    if (calibrationGravity(mac, data.tilt, fitted))
+    {
+        return round3(fitted);
+    }
+    return gravityFormula.evaluate(data.tilt, data.temp);
 }
 
-float calculateGravity()
+// The ESP-NOW receive callback carries no signal strength, so pick it up
+// from the action frame header in promiscuous mode just before delivery.
+void promiscuousCallback(void *buf, wifi_promiscuous_pkt_type_t type)
 {
-    double tilt = tiltData.tilt;
-    double temp = tiltData.temp;
-    float gravity = 0;
-    int err;
-    te_variable vars[] = {{"tilt", &tilt}, {"temp", &temp}};
-    te_expr *expr = te_compile(polynomial.c_str(), vars, 2, &err);
-
-    if (expr)
+    if (type != WIFI_PKT_MGMT)
     {
-        gravity = te_eval(expr);
-        te_free(expr);
+        return;
     }
-    else
+    const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+    const uint8_t *header = packet->payload;
+    // Action frame, sender address at offset 10.
+    if (header[0] != 0xD0)
     {
-        Serial.printf("Could not calculate gravity. Parse error at %d\n", err);
+        return;
     }
-
-    return round3(gravity);
+    lastFrameRssi = packet->rx_ctrl.rssi;
+    memcpy(lastFrameMac, header + 10, 6);
 }
 
+// Runs in the WiFi task. Only copy the frame and hand it to the radio task.
 void receiveCallBackFunction(const uint8_t *senderMac, const uint8_t *incomingData, int len)
 {
-    memcpy(&tiltData, incomingData, len);
-
-    // Copy the MAC address into the data structure for identification
-    memcpy(sensorId, senderMac, 6);
-
-    Serial.printf("Transmitter MacAddr: %02x:%02x:%02x:%02x:%02x:%02x, ", senderMac[0], senderMac[1], senderMac[2], senderMac[3], senderMac[4], senderMac[5]);
-    Serial.printf("\nTilt: %.2f, ", tiltData.tilt);
-    Serial.printf("\nTemperature: %.2f, ", tiltData.temp);
-    Serial.printf("\nVoltage: %d, ", tiltData.volt);
-    Serial.printf("\nInterval: %ld, ", tiltData.interval);
+    RawFrame frame;
+    memcpy(frame.mac, senderMac, 6);
+    frame.rssi = (memcmp(lastFrameMac, senderMac, 6) == 0) ? lastFrameRssi : 0;
+    frame.receivedMs = esp_timer_get_time() / 1000;
+    frame.replay = REPLAY_NONE;
+    frame.len = constrain(len, 0, ESP_NOW_MAX_DATA_LEN);
+    memcpy(frame.data, incomingData, frame.len);
+    captureFrame(frame.receivedMs, frame.mac, frame.rssi, frame.data, frame.len);
+
+    if (xQueueSend(rxQueue, &frame, 0) != pdTRUE)
+    {
+        metricsQueueDropped(rxQueueMetric);
+    }
+}
 
-    haveReading = true;
+// Station mode, keeping the sensor firmware AP up if it is open.
+wifi_mode_t stationMode()
+{
+    return otaApActive ? WIFI_AP_STA : WIFI_STA;
 }
 
 void initEspNow()
 {
-    WiFi.softAPdisconnect(true);
-    WiFi.disconnect();
-    WiFi.mode(WIFI_STA);
-    esp_wifi_set_mac(WIFI_IF_STA, &mac[0]);
+    // Sensors find the gateway on any channel, so ESP-NOW simply shares the
+    // AP's channel and the connection stays up.
+    bool stayConnected = WiFi.status() == WL_CONNECTED;
+
+    wifi_promiscuous_filter_t filter = {.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT};
+    esp_wifi_set_promiscuous_filter(&filter);
+    esp_wifi_set_promiscuous_rx_cb(promiscuousCallback);
+
+    if (!stayConnected)
+    {
+        if (!otaApActive)
+        {
+            WiFi.softAPdisconnect(true);
+        }
+        WiFi.disconnect();
+        WiFi.mode(stationMode());
+        esp_wifi_set_mac(WIFI_IF_STA, &mac[0]);
+        esp_wifi_set_promiscuous(true);
+        esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+    }
+
+    // Promiscuous mode stays on to pick up the RSSI of each frame.
     esp_wifi_set_promiscuous(true);
-    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
-    esp_wifi_set_promiscuous(false);
 
-    Serial.println();
-    Serial.println("ESP-Now Receiver");
-    Serial.printf("Transmitter mac: %s\n", WiFi.macAddress().c_str());
-    Serial.printf("Receiver mac: %s\n", WiFi.softAPmacAddress().c_str());
+    LOGI("ESP-Now Receiver");
+    LOGI("Transmitter mac: %s", WiFi.macAddress());
+    LOGI("Receiver mac: %s", WiFi.softAPmacAddress());
     if (esp_now_init() != ESP_OK)
     {
-        Serial.println("ESP_Now init failed...");
+        LOGE("ESP_Now init failed...");
         delay(RETRY_INTERVAL);
         ESP.restart();
     }
-    Serial.println(WiFi.channel());
+    LOGI("Channel: %d", WiFi.channel());
     esp_now_register_recv_cb(receiveCallBackFunction);
-    Serial.println("Slave ready. Waiting for messages...");
+    esp_now_register_send_cb(downlinkSent);
+    LOGI("Slave ready. Waiting for messages...");
 }
 
-void wifiConnect()
+// Relays share the gateway MAC, so they must not join the AP next to the
+// gateway that publishes. They only scan for it, to sit on its channel with
+// the other gateways. Keeps the default channel if the AP is not found.
+void findApChannel()
 {
     WiFi.mode(WIFI_STA);
+    int found = WiFi.scanNetworks(false, false, false, 300, 0, wifiSSID.c_str());
+    int best = -1;
+    for (int i = 0; i < found; i++)
+    {
+        if (best < 0 || WiFi.RSSI(i) > WiFi.RSSI(best))
+        {
+            best = i;
+        }
+    }
+    if (best >= 0)
+    {
+        channel = WiFi.channel(best);
+        LOGI("Found %s on channel %d", wifiSSID, channel);
+    }
+    else
+    {
+        LOGW("%s not found, staying on channel %d", wifiSSID, channel);
+    }
+    WiFi.scanDelete();
+}
+
+void wifiConnect()
+{
+    if (WiFi.status() == WL_CONNECTED)
+    {
+        return;
+    }
+    metricsWifiReconnect();
+
+    WiFi.mode(stationMode());
     WiFi.begin(wifiSSID.c_str(), wifiPassword.c_str());
 
     int attempts = 0;
     while (WiFi.status() != WL_CONNECTED && attempts < 20) {
         delay(250);
-        Serial.print(".");
         attempts++;
     }
 
     if (WiFi.status() == WL_CONNECTED) {
-        Serial.print("\nWiFi connected, IP address: ");
-        Serial.println(WiFi.localIP());
+        LOGI("WiFi connected, IP address: %s", WiFi.localIP().toString());
     } else {
-        Serial.println("\nWiFi connection failed");
+        LOGW("WiFi connection failed");
     }
 }
 
-void reconnectMQTT()
+String macToString(const uint8_t* mac) {
+    char macStr[18];
+    snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return String(macStr);
+}
+
+bool integrationEnabled(String integration) {
+    return !integration.isEmpty();
+}
+
+// Per-integration timeouts in ms: connect, then the request itself.
+#define TILTED_TIMEOUTS {5000, 10000}
+#define MQTT_TIMEOUTS {3000, 5000}
+#define BREWFATHER_TIMEOUTS {3000, 5000}
+#define INFLUXDB_TIMEOUTS {3000, 5000}
+
+#define PUBLISHER_STACK 6144
+#define PUBLISHER_TLS_STACK 12288
+
+class TiltedPublisher : public Publisher
+{
+public:
+    TiltedPublisher() : Publisher(INTEGRATION_TILTED, TILTED_TIMEOUTS, PUBLISHER_TLS_STACK) {}
+    bool enabled() override { return integrationEnabled(tiltedURL); }
+
+protected:
+    bool send(const Reading &reading) override;
+    bool batching() override { return tiltedBatch; }
+    bool sendBatch(const Reading *readings, int count) override;
+
+private:
+    bool post(const String &url, const char *contentType, const uint8_t *body, size_t len);
+
+    WiFiClientSecure secureClient;
+    HTTPClient http;
+};
+
+class MqttPublisher : public Publisher
+{
+public:
+    MqttPublisher() : Publisher(INTEGRATION_MQTT, MQTT_TIMEOUTS, PUBLISHER_STACK), mqttClient(wifiClient) {}
+    bool enabled() override { return integrationEnabled(mqttServer); }
+
+protected:
+    bool send(const Reading &reading) override;
+
+private:
+    bool connect();
+
+    WiFiClient wifiClient;
+    PubSubClient mqttClient;
+};
+
+class BrewfatherPublisher : public Publisher
+{
+public:
+    BrewfatherPublisher() : Publisher(INTEGRATION_BREWFATHER, BREWFATHER_TIMEOUTS, PUBLISHER_STACK) {}
+    bool enabled() override { return integrationEnabled(brewfatherURL); }
+
+protected:
+    bool send(const Reading &reading) override;
+
+private:
+    WiFiClient wifiClient;
+    HTTPClient http;
+};
+
+class InfluxDBPublisher : public Publisher
+{
+public:
+    InfluxDBPublisher() : Publisher(INTEGRATION_INFLUXDB, INFLUXDB_TIMEOUTS, PUBLISHER_STACK) {}
+    bool enabled() override { return integrationEnabled(influxdbURL); }
+
+protected:
+    bool send(const Reading &reading) override;
+
+private:
+    InfluxDBClient influxClient;
+    bool configured = false;
+};
+
+// A single attempt per reading. Retrying is left to the circuit breaker,
+// so a dead broker costs at most the connect timeout.
+bool MqttPublisher::connect()
 {
     mqttClient.setServer(mqttServer.c_str(), 1883);
+    mqttClient.setSocketTimeout(max(1, (int)(timeouts.request / 1000)));
 
-    int attempts = 0;
-    while (!mqttClient.connected() && attempts < 3) {
-        if (mqttClient.connect(deviceName.c_str())) {
-            Serial.println("MQTT connected!");
-        } else {
-            Serial.print("failed, rc = ");
-            Serial.print(mqttClient.state());
-            Serial.println(" try again in 5 seconds");
-            delay(5000);
-            attempts++;
-        }
+    // PubSubClient has no connect timeout of its own, but it reuses a
+    // socket that is already open.
+    if (!wifiClient.connected() && !wifiClient.connect(mqttServer.c_str(), 1883, timeouts.connect)) {
+        LOGW("MQTT server unreachable");
+        return false;
     }
+
+    if (!mqttClient.connect(deviceName.c_str())) {
+        LOGW("MQTT connect failed, rc = %d", mqttClient.state());
+        wifiClient.stop();
+        return false;
+    }
+
+    LOGI("MQTT connected!");
+    return true;
 }
 
-void publishMQTT()
+// Fermentation analytics as JSON fields, leaving out what is not known yet.
+void addAnalytics(JsonObject obj, const Analytics &analytics)
 {
-    if (!mqttClient.connected())
+    if (analytics.stage != STAGE_UNKNOWN)
+    {
+        obj["stage"] = analyticsStageName(analytics.stage);
+        obj["gravity_slope"] = analytics.slope;
+    }
+    if (analytics.og > 0)
+    {
+        obj["og"] = analytics.og;
+        obj["attenuation"] = analytics.attenuation;
+    }
+    if (analytics.etaHours > 0)
     {
-        reconnectMQTT();
+        obj["eta_hours"] = analytics.etaHours;
     }
+}
 
-    if (!mqttClient.connected()) {
-        Serial.println("Failed to connect to MQTT server");
-        return;
+bool MqttPublisher::send(const Reading &reading)
+{
+    if (!mqttClient.connected() && !connect()) {
+        LOGW("Failed to connect to MQTT server");
+        return false;
     }
 
-    const size_t capacity = JSON_OBJECT_SIZE(5);
+    const size_t capacity = JSON_OBJECT_SIZE(12);
     DynamicJsonDocument doc(capacity);
 
-    doc["gravity"] = tiltGravity;
-    doc["tilt"] = tiltData.tilt;
-    doc["temp"] = tiltData.temp;
-    doc["volt"] = tiltData.volt;
-    doc["interval"] = tiltData.interval;
+    int64_t timestamp;
+    if (readingTime(reading, timestamp))
+    {
+        doc["timestamp"] = timestamp;
+    }
+    doc["gravity"] = reading.gravity;
+    doc["tilt"] = reading.data.tilt;
+    doc["temp"] = reading.data.temp;
+    doc["volt"] = reading.data.volt;
+    doc["interval"] = reading.data.interval;
+    if (reading.data.batteryHours)
+    {
+        doc["battery_hours"] = reading.data.batteryHours;
+    }
+    addAnalytics(doc.as<JsonObject>(), reading.analytics);
 
     String jsonString;
     serializeJson(doc, jsonString);
 
-    mqttClient.publish(mqttTopic.c_str(), jsonString.c_str(), true);
+    bool published = mqttClient.publish(mqttTopic.c_str(), jsonString.c_str(), true);
     mqttClient.disconnect();
+    return published;
 }
 
-void publishBrewfather()
+bool BrewfatherPublisher::send(const Reading &reading)
 {
-    Serial.println("Sending to Brewfather...");
+    LOGD("Sending to Brewfather...");
     const size_t capacity = JSON_OBJECT_SIZE(5);
     DynamicJsonDocument doc(capacity);
 
     doc["name"] = deviceName;
-    doc["temp"] = tiltData.temp;
+    doc["temp"] = reading.data.temp;
     doc["temp_unit"] = "C";
-    doc["gravity"] = tiltGravity;
+    doc["gravity"] = reading.gravity;
     doc["gravity_unit"] = "G";
 
     String jsonBody;
     serializeJson(doc, jsonBody);
 
-    HTTPClient http;
+    // Keep the connection open so readings drained in the same round, and
+    // later rounds while WiFi stays up, skip the TCP setup.
+    http.setReuse(true);
+    http.setConnectTimeout(timeouts.connect);
+    http.setTimeout(timeouts.request);
     http.begin(wifiClient, brewfatherURL.c_str());
     http.addHeader("Content-Type", "application/json");
-    http.POST(jsonBody);
+    int httpResponseCode = http.POST(jsonBody);
     http.end();
+    return httpResponseCode >= 200 && httpResponseCode < 300;
 }
 
-void publishInfluxDB()
+bool InfluxDBPublisher::send(const Reading &reading)
 {
+    // Setting the connection parameters resets the client, so only do it
+    // once to keep the connection open between readings.
+    if (!configured)
+    {
+        influxClient.setConnectionParams(influxdbURL, influxdbOrg, influxdbBucket, influxdbToken);
+        influxClient.setHTTPOptions(HTTPOptions().httpReadTimeout(timeouts.request).connectionReuse(true));
+        influxClient.setWriteOptions(WriteOptions().writePrecision(WritePrecision::MS));
+        configured = true;
+    }
+
+    Point influxDataPoint("tilted_data");
     // Set tags
     influxDataPoint.addTag("name", deviceName.c_str());
     // Add data fields
-    influxDataPoint.addField("gravity", tiltGravity, 3);
-    influxDataPoint.addField("tilt", tiltData.tilt);
-    influxDataPoint.addField("temp", tiltData.temp);
-    influxDataPoint.addField("voltage", tiltData.volt);
-    influxDataPoint.addField("interval", tiltData.interval);
+    influxDataPoint.addField("gravity", reading.gravity, 3);
+    influxDataPoint.addField("tilt", reading.data.tilt);
+    influxDataPoint.addField("temp", reading.data.temp);
+    influxDataPoint.addField("voltage", reading.data.volt);
+    influxDataPoint.addField("interval", reading.data.interval);
+    if (reading.data.batteryHours)
+    {
+        influxDataPoint.addField("battery_hours", reading.data.batteryHours);
+    }
+    const Analytics &analytics = reading.analytics;
+    if (analytics.stage != STAGE_UNKNOWN)
+    {
+        influxDataPoint.addField("stage", analyticsStageName(analytics.stage));
+        influxDataPoint.addField("gravity_slope", analytics.slope, 4);
+    }
+    if (analytics.og > 0)
+    {
+        influxDataPoint.addField("og", analytics.og, 3);
+        influxDataPoint.addField("attenuation", analytics.attenuation, 1);
+    }
+    if (analytics.etaHours > 0)
+    {
+        influxDataPoint.addField("eta_hours", analytics.etaHours, 1);
+    }
+    // Without a clock the server's time is the best there is.
+    int64_t timestamp;
+    if (readingTime(reading, timestamp))
+    {
+        influxDataPoint.setTime((unsigned long long)timestamp);
+    }
 
     if (!influxClient.writePoint(influxDataPoint))
     {
-        Serial.print("InfluxDB write failed: ");
-        Serial.println(influxClient.getLastErrorMessage());
+        LOGW("InfluxDB write failed: %s", influxClient.getLastErrorMessage());
+        return false;
     }
+    return true;
 }
 
-String macToString(const uint8_t* mac) {
-    char macStr[18];
-    snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x",
-             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-    return String(macStr);
-}
-
-void publishTilted(const String& apiUrl, const String& username, const String& password)
+bool TiltedPublisher::send(const Reading &r)
 {
-    if (apiUrl.isEmpty()) {
-        Serial.println("JSON API URL not configured, skipping...");
-        return;
-    }
-
-    Serial.println("Sending to JSON API...");
-    const size_t capacity = JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(5);
+    LOGD("Sending to JSON API...");
+    // Room for the sensor ID and gateway strings, which are copied.
+    const size_t capacity = JSON_OBJECT_SIZE(3) + JSON_OBJECT_SIZE(12) + 128;
     DynamicJsonDocument doc(capacity);
 
     // Create the nested reading object
     JsonObject reading = doc.createNestedObject("reading");
         
-    reading["sensorId"] = macToString(sensorId);
-    reading["gravity"] = tiltGravity;
-    reading["tilt"] = tiltData.tilt;
-    reading["temp"] = tiltData.temp;
-    reading["volt"] = tiltData.volt;
-    reading["interval"] = tiltData.interval;
+    reading["sensorId"] = macToString(r.sensorId);
+    int64_t timestamp;
+    if (readingTime(r, timestamp))
+    {
+        reading["timestamp"] = timestamp;
+    }
+    reading["gravity"] = r.gravity;
+    reading["tilt"] = r.data.tilt;
+    reading["temp"] = r.data.temp;
+    reading["volt"] = r.data.volt;
+    reading["interval"] = r.data.interval;
+    addAnalytics(reading, r.analytics);
     
     // Add gateway identification
     doc["gatewayId"] = WiFi.macAddress();
     doc["gatewayName"] = deviceName;
 
+    unsigned long start = micros();
     String jsonBody;
     serializeJson(doc, jsonBody);
+    LOGD("Encoded 1 reading as JSON in %u bytes, %lu us", jsonBody.length(), micros() - start);
+
+    return post(tiltedURL, "application/json", (const uint8_t *)jsonBody.c_str(), jsonBody.length());
+}
 
+// Posted to <Tilted API URL>/batch, see batch.h.
+#define TILTED_BATCH_BUFFER 2048
+
+bool TiltedPublisher::sendBatch(const Reading *readings, int count)
+{
+    unsigned long start = micros();
+    int64_t timestamps[PUBLISHER_BATCH_MAX];
+    for (int i = 0; i < count; i++)
+    {
+        if (!readingTime(readings[i], timestamps[i]))
+        {
+            timestamps[i] = 0;
+        }
+    }
+
+    // Only used by this publisher's task, and too big for its stack.
+    static uint8_t body[TILTED_BATCH_BUFFER];
+    size_t len = batchEncode(body, sizeof(body), WiFi.macAddress().c_str(), deviceName.c_str(),
+                             readings, timestamps, count);
+    if (!len)
+    {
+        LOGW("Batch of %d readings does not fit in %d bytes", count, TILTED_BATCH_BUFFER);
+        return false;
+    }
+    LOGD("Encoded %d readings as CBOR in %u bytes, %lu us", count, len, micros() - start);
+
+    return post(tiltedBatchURL, "application/cbor", body, len);
+}
+
+bool TiltedPublisher::post(const String &url, const char *contentType, const uint8_t *body, size_t len)
+{
     secureClient.setInsecure();
 
-    HTTPClient http;
-    http.begin(secureClient, apiUrl.c_str());
-    http.addHeader("Content-Type", "application/json");
+    // Reusing the connection saves a full TLS handshake per reading.
+    http.setReuse(true);
+    http.setConnectTimeout(timeouts.connect);
+    http.setTimeout(timeouts.request);
+    http.begin(secureClient, url.c_str());
+    http.addHeader("Content-Type", contentType);
 
     // Add basic authentication
-    http.setAuthorization(username.c_str(), password.c_str());
+    http.setAuthorization(tiltedUsername.c_str(), tiltedPassword.c_str());
     
-    int httpResponseCode = http.POST(jsonBody);
+    int httpResponseCode = http.POST((uint8_t *)body, len);
     
     if (httpResponseCode > 0) {
-        Serial.print("JSON API HTTP Response code: ");
-        Serial.println(httpResponseCode);
+        LOGD("Tilted API HTTP Response code: %d", httpResponseCode);
     } else {
-        Serial.print("JSON API Error code: ");
-        Serial.println(httpResponseCode);
+        LOGW("Tilted API Error code: %d", httpResponseCode);
     }
     
     http.end();
+    return httpResponseCode >= 200 && httpResponseCode < 300;
 }
 
-bool integrationEnabled(String integration) {
-    return !integration.isEmpty();
-}
+TiltedPublisher tiltedPublisher;
+MqttPublisher mqttPublisher;
+BrewfatherPublisher brewfatherPublisher;
+InfluxDBPublisher influxPublisher;
+
+Publisher *publishers[] = {&tiltedPublisher, &mqttPublisher, &brewfatherPublisher, &influxPublisher};
 
 // Load settings from Preferences
 void loadSettings() {
@@ -452,6 +898,7 @@ void loadSettings() {
     wifiSSID = preferences.getString("wifiSSID", "");
     wifiPassword = preferences.getString("wifiPassword", "");
     polynomial = preferences.getString("polynomial", "");
+    targetGravity = preferences.getString("targetGravity", "");
     mqttServer = preferences.getString("mqttServer", "");
     mqttTopic = preferences.getString("mqttTopic", "tilted/data");
     brewfatherURL = preferences.getString("brewfatherURL", "");
@@ -462,39 +909,58 @@ void loadSettings() {
     tiltedURL = preferences.getString("tiltedURL", "");
     tiltedUsername = preferences.getString("tiltedUsername", "");
     tiltedPassword = preferences.getString("tiltedPassword", "");
+    tiltedBatch = preferences.getBool("tiltedBatch", false);
+    relayMode = preferences.getBool("relayMode", false);
+    adminPassword = preferences.getString("adminPassword", "");
+    otaApPassword = preferences.getString("otaApPassword", "");
     
     preferences.end();
+
+    int err;
+    if (!gravityFormula.compile(polynomial.c_str(), err))
+    {
+        LOGE("Could not parse the polynomial. Parse error at %d", err);
+    }
+    targetGravityValue = targetGravity.toFloat();
+    tiltedBatchURL = tiltedURL + "/batch";
     
-    Serial.println("Settings loaded:");
-    Serial.println("Device Name: " + deviceName);
-    Serial.println("WiFi SSID: " + wifiSSID);
-    Serial.println("Polynomial: " + polynomial);
-    Serial.println("MQTT Server: " + mqttServer);
-    Serial.println("Tilted API URL: " + tiltedURL);
+    LOGI("Settings loaded:");
+    LOGI("Device Name: %s", deviceName);
+    LOGI("WiFi SSID: %s", wifiSSID);
+    LOGI("Polynomial: %s", polynomial);
+    LOGI("MQTT Server: %s", mqttServer);
+    LOGI("Tilted API URL: %s", tiltedURL);
+    LOGI("Relay mode: %s", relayMode ? "on" : "off");
 }
 
-// Save settings to Preferences
+// Save the settings posted from the config page to Preferences, leaving
+// the ones in use alone. The caller restarts to apply them.
 void saveSettings() {
     preferences.begin("tilted", false);
     
-    preferences.putString("deviceName", deviceName);
-    preferences.putString("wifiSSID", wifiSSID);
-    preferences.putString("wifiPassword", wifiPassword);
-    preferences.putString("polynomial", polynomial);
-    preferences.putString("mqttServer", mqttServer);
-    preferences.putString("mqttTopic", mqttTopic);
-    preferences.putString("brewfatherURL", brewfatherURL);
-    preferences.putString("influxdbURL", influxdbURL);
-    preferences.putString("influxdbOrg", influxdbOrg);
-    preferences.putString("influxdbBucket", influxdbBucket);
-    preferences.putString("influxdbToken", influxdbToken);
-    preferences.putString("tiltedURL", tiltedURL);
-    preferences.putString("tiltedUsername", tiltedUsername);
-    preferences.putString("tiltedPassword", tiltedPassword);
+    preferences.putString("deviceName", server.arg("deviceName"));
+    preferences.putString("wifiSSID", server.arg("wifiSSID"));
+    preferences.putString("wifiPassword", server.arg("wifiPassword"));
+    preferences.putString("polynomial", server.arg("polynomial"));
+    preferences.putString("targetGravity", server.arg("targetGravity"));
+    preferences.putString("mqttServer", server.arg("mqttServer"));
+    preferences.putString("mqttTopic", server.arg("mqttTopic"));
+    preferences.putString("brewfatherURL", server.arg("brewfatherURL"));
+    preferences.putString("influxdbURL", server.arg("influxdbURL"));
+    preferences.putString("influxdbOrg", server.arg("influxdbOrg"));
+    preferences.putString("influxdbBucket", server.arg("influxdbBucket"));
+    preferences.putString("influxdbToken", server.arg("influxdbToken"));
+    preferences.putString("tiltedURL", server.arg("tiltedURL"));
+    preferences.putString("tiltedUsername", server.arg("tiltedUsername"));
+    preferences.putString("tiltedPassword", server.arg("tiltedPassword"));
+    preferences.putBool("tiltedBatch", server.hasArg("tiltedBatch"));
+    preferences.putBool("relayMode", server.hasArg("relayMode"));
+    preferences.putString("adminPassword", server.arg("adminPassword"));
+    preferences.putString("otaApPassword", server.arg("otaApPassword"));
     
     preferences.end();
     
-    Serial.println("Settings saved");
+    LOGI("Settings saved");
 }
 
 // Replace placeholders in HTML template
@@ -504,6 +970,7 @@ String processTemplate() {
     html.replace("%WIFI_SSID%", wifiSSID);
     html.replace("%WIFI_PASSWORD%", wifiPassword);
     html.replace("%POLYNOMIAL%", polynomial);
+    html.replace("%TARGET_GRAVITY%", targetGravity);
     html.replace("%MQTT_SERVER%", mqttServer);
     html.replace("%MQTT_TOPIC%", mqttTopic);
     html.replace("%BREWFATHER_URL%", brewfatherURL);
@@ -514,6 +981,10 @@ String processTemplate() {
     html.replace("%TILTED_URL%", tiltedURL);
     html.replace("%TILTED_USERNAME%", tiltedUsername);
     html.replace("%TILTED_PASSWORD%", tiltedPassword);
+    html.replace("%TILTED_BATCH%", tiltedBatch ? "checked" : "");
+    html.replace("%RELAY_MODE%", relayMode ? "checked" : "");
+    html.replace("%ADMIN_PASSWORD%", adminPassword);
+    html.replace("%OTA_AP_PASSWORD%", otaApPassword);
     return html;
 }
 
@@ -523,9 +994,8 @@ void startConfigMode() {
     WiFi.mode(WIFI_AP);
     WiFi.softAP(apSSID, apPassword);
     
-    Serial.println("AP Started");
-    Serial.print("IP Address: ");
-    Serial.println(WiFi.softAPIP());
+    LOGI("AP Started");
+    LOGI("IP Address: %s", WiFi.softAPIP().toString());
     
     // Configure web server
     server.on("/", HTTP_GET, []() {
@@ -533,21 +1003,6 @@ void startConfigMode() {
     });
     
     server.on("/save", HTTP_POST, []() {
-        deviceName = server.arg("deviceName");
-        wifiSSID = server.arg("wifiSSID");
-        wifiPassword = server.arg("wifiPassword");
-        polynomial = server.arg("polynomial");
-        mqttServer = server.arg("mqttServer");
-        mqttTopic = server.arg("mqttTopic");
-        brewfatherURL = server.arg("brewfatherURL");
-        influxdbURL = server.arg("influxdbURL");
-        influxdbOrg = server.arg("influxdbOrg");
-        influxdbBucket = server.arg("influxdbBucket");
-        influxdbToken = server.arg("influxdbToken");
-        tiltedURL = server.arg("tiltedURL");
-        tiltedUsername = server.arg("tiltedUsername");
-        tiltedPassword = server.arg("tiltedPassword");
-        
         saveSettings();
         
         server.send(200, "text/html", 
@@ -565,7 +1020,7 @@ void startConfigMode() {
 
 void button1Pressed(Button2 &btn)
 {
-    Serial.println("Button pressed, going into config mode...");
+    LOGI("Button pressed, going into config mode...");
     startConfigMode();
 }
 
@@ -588,6 +1043,24 @@ void screenUpdateVariables(float gravity, float temp, float tilt) {
     tft.setTextPadding(0);
 }
 
+// Fermentation progress, right of the gravity label: attenuation, and the
+// ETA or the stage. Short, to leave the label alone.
+void screenUpdateAnalytics(const Analytics &analytics) {
+    static const char *stages[] = {"", "lag", "ferm", "stall", "done"};
+    char text[24] = "";
+    if (analytics.stage == STAGE_ACTIVE && analytics.etaHours > 0) {
+        snprintf(text, sizeof(text), "%.0f%% %.0fh", analytics.attenuation, min(analytics.etaHours, 999.0f));
+    } else if (analytics.og > 0) {
+        snprintf(text, sizeof(text), "%.0f%% %s", analytics.attenuation, stages[analytics.stage]);
+    } else {
+        snprintf(text, sizeof(text), "%s", stages[analytics.stage]);
+    }
+    tft.setTextDatum(TR_DATUM);
+    tft.setTextPadding(tft.textWidth("100% stall", 2));
+    tft.drawString(text, tft.width(), DATA_SECTION_Y + 25, 2);
+    tft.setTextPadding(0);
+}
+
 void Trace(TFT_eSPI &tft, double x, double y,
            double gx, double gy,
            double w, double h,
@@ -649,9 +1122,9 @@ void Trace(TFT_eSPI &tft, double x, double y,
     oy = y;
 }
 
-void drawGraph() {
+void drawGraph(const TsPoint *points, int count) {
     // No point in drawing the graph if we don't have at least two readings.
-    if (readingsHistory.size() < 2) {
+    if (count < 2) {
         return;
     }
 
@@ -661,36 +1134,44 @@ void drawGraph() {
     // Draw rectangle around graph
     tft.drawRect(0, STATUS_HEIGHT, tft.width(), GRAPH_HEIGHT, TFT_WHITE);
 
-    float minValue = readingsHistory[0];
+    float minValue = points[0].gravity;
     float maxValue = 0;
 
-    for (int i = 0; i < readingsHistory.size(); i++) {
-        if (readingsHistory[i] > maxValue) {
-            maxValue = readingsHistory[i];
+    for (int i = 0; i < count; i++) {
+        if (points[i].gravity > maxValue) {
+            maxValue = points[i].gravity;
         }
-        if (readingsHistory[i] < minValue) {
-            minValue = readingsHistory[i];
+        if (points[i].gravity < minValue) {
+            minValue = points[i].gravity;
         }
     }
-    Serial.printf("Min: %f, Max: %f", minValue, maxValue);
+    LOGD("Min: %f, Max: %f", minValue, maxValue);
+
+    // Points are spaced by time, not by index, since the downsampled series
+    // is not evenly spaced.
+    double first = points[0].time;
+    double last = points[count - 1].time;
+    if (last <= first) {
+        last = first + 1;
+    }
 
     double x, y;
     bool update1 = true;
     double ox = -999, oy = -999; // Force them to be off screen
-    for (int i = 0; i < readingsHistory.size(); i++) {
-        x = i + 1;
-        y = readingsHistory[i];
+    for (int i = 0; i < count; i++) {
+        x = points[i].time;
+        y = points[i].gravity;
         // Adjusted to account for status bar
         Trace(tft, x, y, 0, STATUS_HEIGHT + GRAPH_HEIGHT - 10, tft.width(), GRAPH_HEIGHT - 20, 
-              1, readingsHistory.size(), minValue, maxValue, ox, oy, update1, TFT_YELLOW);
-        Serial.printf("Update %f", x);
+              first, last, minValue, maxValue, ox, oy, update1, TFT_YELLOW);
+        LOGD("Update %f", x);
     }
 
     tft.setTextPadding(tft.textWidth("111.000", 2));
     tft.setTextDatum(ML_DATUM);
-    tft.drawFloat(readingsHistory.first(), 3, 0, DATA_SECTION_Y + 10, 2);
+    tft.drawFloat(points[0].gravity, 3, 0, DATA_SECTION_Y + 10, 2);
     tft.setTextDatum(MR_DATUM);
-    tft.drawFloat(readingsHistory.last(), 3, tft.width(), DATA_SECTION_Y + 10, 2);
+    tft.drawFloat(points[count - 1].gravity, 3, tft.width(), DATA_SECTION_Y + 10, 2);
     tft.setTextPadding(0);
 }
 
@@ -748,70 +1229,861 @@ void updateBatteryIndicator(int voltage) {
     }
 }
 
-void saveReading(float reading)
+// Find the sensor table entry for a MAC, adding it if there is room.
+SensorEntry *findSensor(const uint8_t *mac)
 {
-    readingsHistory.push(reading);
+    for (int i = 0; i < sensorCount; i++)
+    {
+        if (memcmp(sensorTable[i].mac, mac, 6) == 0)
+        {
+            return &sensorTable[i];
+        }
+    }
+    if (sensorCount >= MAX_SENSORS)
+    {
+        return nullptr;
+    }
+    SensorEntry *entry = &sensorTable[sensorCount++];
+    memset(entry, 0, sizeof(SensorEntry));
+    memcpy(entry->mac, mac, 6);
+    return entry;
 }
 
-void setup()
+void dispatchReading(const Reading &reading)
 {
-    Serial.begin(115200);
+    // Keep the newest readings if the publisher falls behind. Relays leave
+    // publishing to the gateway they forward to.
+    if (!relayMode && xQueueSend(publishQueue, &reading, 0) != pdTRUE)
+    {
+        Reading oldest;
+        xQueueReceive(publishQueue, &oldest, 0);
+        xQueueSend(publishQueue, &reading, 0);
+        metricsQueueDropped(publishQueueMetric);
+    }
 
-    btn1.setTapHandler(button1Pressed);
+    if (xQueueSend(storageQueue, &reading, 0) != pdTRUE)
+    {
+        metricsQueueDropped(storageQueueMetric);
+    }
 
-    // Load settings
-    loadSettings();
+    liveReading(reading);
+}
 
-    if (wifiSSID.isEmpty()) {
-        startConfigMode();
-    } else {
-        // Disconnect from AP before initializing ESP-Now.
-        // This is needed because IoTWebConf for some reason sets up the AP with init().
-        //WiFi.softAPdisconnect(true);
-        initEspNow();
+// Sensors that only send on change skip wakes with an unchanged reading.
+// Repeat their last reading for every wake that should have passed, so the
+// integrations keep seeing a reading per interval, until the heartbeat is
+// due. A sensor still quiet after that is reported as missing.
+void fillImpliedReadings()
+{
+    unsigned long now = millis();
+    for (int i = 0; i < sensorCount; i++)
+    {
+        SensorEntry &entry = sensorTable[i];
+        const DataStruct &data = entry.last.data;
+        if (data.heartbeatWakes < 2 || data.interval <= 0 || entry.missed)
+        {
+            continue;
+        }
+        unsigned long interval = data.interval * 1000UL;
+        unsigned long due = (entry.implied + 1) * interval + interval * IMPLIED_READING_SLACK / 100;
+        if (now - entry.lastSeen < due)
+        {
+            continue;
+        }
+        if (entry.implied + 1 >= data.heartbeatWakes)
+        {
+            entry.missed = true;
+            metricsHeartbeatMissed(entry.mac);
+            LOGW("Sensor %s missed its heartbeat", macToString(entry.mac));
+            continue;
+        }
+
+        entry.implied++;
+        Reading reading = entry.last;
+        reading.implied = true;
+        // When the skipped wake was.
+        reading.receivedMs += (int64_t)entry.implied * interval;
+        reading.data.otaMillis = 0;
+        reading.data.otaEnergy = 0;
+        metricsReadingImplied(entry.mac);
+        LOGD("Sensor %s reading unchanged, repeating it", macToString(entry.mac));
+        dispatchReading(reading);
     }
+}
 
-    prepareScreen();
+// Decodes frames from the receive callback, calculates gravity and fans the
+// reading out to the publish and storage tasks. In between frames, fills in
+// readings skipped by sensors.
+void radioTask(void *parameter)
+{
+    RawFrame frame;
+    for (;;)
+    {
+        bool received = xQueueReceive(rxQueue, &frame, pdMS_TO_TICKS(1000)) == pdTRUE;
+        fillImpliedReadings();
+        if (!received)
+        {
+            continue;
+        }
+
+        DecodedFrame decoded;
+        Reading &reading = decoded.reading;
+        if (!frameDecode(frame.mac, frame.rssi, frame.data, frame.len, frame.receivedMs, decoded))
+        {
+            metricsFrameRejected(reading.sensorId);
+            LOGW("Ignoring frame of %d bytes from %s", decoded.payloadLen, macToString(reading.sensorId));
+            continue;
+        }
+        const uint8_t *mac = reading.sensorId;
+
+        // A dry run leaves no trace, not even in the duplicate filter.
+        if (frame.replay == REPLAY_DRY)
+        {
+            reading.gravity = calculateGravity(mac, reading.data);
+            metricsFrameReplayed();
+            LOGI("Replayed MacAddr: %s, Tilt: %.2f, Temperature: %.2f, Voltage: %d, Interval: %ld, Gravity: %.3f",
+                 macToString(reading.sensorId), reading.data.tilt, reading.data.temp,
+                 reading.data.volt, reading.data.interval, reading.gravity);
+            continue;
+        }
+
+        if (relaySeen(mac, reading.data.seq))
+        {
+            metricsFrameDuplicate(mac);
+            LOGD("Dropping duplicate frame %u from %s", reading.data.seq, macToString(mac));
+            continue;
+        }
+
+        metricsFrameReceived(mac, decoded.rssi);
+
+        // The sensor only listens for a moment after sending, so answer
+        // before doing anything else, unless it is out of range behind a relay.
+        // Only the publishing gateway keeps slots, relays would disagree.
+        if (decoded.hops == 0 && frame.replay == REPLAY_NONE)
+        {
+            int32_t correction = relayMode ? 0 : slotCorrection(mac, reading.data.interval, frame.receivedMs);
+            downlinkDeliver(mac, correction);
+        }
+        if (relayMode && frame.replay == REPLAY_NONE)
+        {
+            relayForward(mac, decoded.rssi, decoded.hops, decoded.payload, decoded.payloadLen);
+        }
+        calibrationObserve(mac, reading.data.tilt, reading.data.temp);
+        reading.gravity = calculateGravity(mac, reading.data);
+        analyticsUpdate(mac, reading.receivedMs, reading.gravity, targetGravityValue, reading.analytics);
+
+        LOGI("Transmitter MacAddr: %s, Tilt: %.2f, Temperature: %.2f, Voltage: %d, Interval: %ld, Gravity: %.3f, Samples: %u (%u disturbed)",
+             macToString(reading.sensorId), reading.data.tilt, reading.data.temp,
+             reading.data.volt, reading.data.interval, reading.gravity, reading.data.samples,
+             reading.data.disturbed);
+        if (reading.data.otaMillis)
+        {
+            LOGI("Sensor %s updated its firmware in %u ms using about %u mJ",
+                 macToString(reading.sensorId), reading.data.otaMillis, reading.data.otaEnergy);
+            metricsSensorOta(reading.sensorId, reading.data.otaMillis, reading.data.otaEnergy);
+        }
+        metricsSensorBattery(reading.sensorId, reading.data.batteryHours);
+        metricsSensorSamples(reading.sensorId, reading.data.samples);
+        LOGD("Sensor %s frame %u, RF calibrated: %s, MPU configured: %s, first sample after %u ms",
+             macToString(reading.sensorId), reading.data.seq, reading.data.rfCalibrated ? "yes" : "no",
+             reading.data.mpuConfigured ? "yes" : "no", reading.data.firstSampleMillis);
+        metricsSensorFirstSample(reading.sensorId, reading.data.firstSampleMillis);
+        if (reading.data.flipWaitMillis)
+        {
+            LOGI("Sensor %s waited %u ms for calibration after a reset",
+                 macToString(reading.sensorId), reading.data.flipWaitMillis);
+        }
+        if (reading.data.discoveryMillis)
+        {
+            LOGI("Sensor %s searched %u channels for %u ms to find a gateway",
+                 macToString(reading.sensorId), reading.data.discoveryProbes, reading.data.discoveryMillis);
+            metricsSensorDiscovery(reading.sensorId, reading.data.discoveryMillis);
+        }
+
+        SensorEntry *entry = findSensor(reading.sensorId);
+        if (entry)
+        {
+            entry->last = reading;
+            entry->lastSeen = millis();
+            entry->frames++;
+            entry->implied = 0;
+            if (entry->missed)
+            {
+                LOGI("Sensor %s is back", macToString(reading.sensorId));
+                entry->missed = false;
+            }
+        }
+
+        dispatchReading(reading);
+    }
 }
 
-void loop()
+// Hands every reading to each enabled publisher and moves on to the next.
+// Publishers run in their own tasks with their own queues, so a slow or
+// hanging upstream only backs up its own queue. The round time is recorded
+// by whichever publisher finishes a reading last, see publishRoundBegin().
+void publishTask(void *parameter)
 {
-    btn1.loop();
+    Reading reading;
+    for (;;)
+    {
+        if (xQueueReceive(publishQueue, &reading, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        if (WiFi.status() != WL_CONNECTED)
+        {
+            wifiConnect();
+            // Back on the AP's channel, or the default one if joining failed.
+            initEspNow();
+        }
+
+        uint32_t round = publishRoundBegin();
+        for (Publisher *publisher : publishers)
+        {
+            if (publisher->enabled())
+            {
+                publisher->submit(reading, round);
+            }
+        }
+        publishRoundRelease(round);
+    }
+}
 
-    if (configMode)
+// Appends readings to the sensor's history on flash, which can take a while
+// when a block is flushed or a file trimmed, and then hands them on to the
+// display.
+void storageTask(void *parameter)
+{
+    Reading reading;
+    for (;;)
     {
-        server.handleClient();
+        if (xQueueReceive(storageQueue, &reading, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        int64_t timestamp;
+        if (readingTime(reading, timestamp))
+        {
+            tsAppend(reading.sensorId, timestamp / 1000, reading.gravity, reading.data.temp);
+        }
+        else
+        {
+            LOGD("Clock not set, not storing reading");
+        }
+
+        // The display only ever needs the latest reading.
+        xQueueOverwrite(displayQueue, &reading);
     }
+}
 
-    if (haveReading)
+// Low priority screen updates. Readings arriving while we draw are coalesced
+// into one update by the single slot display queue.
+void displayTask(void *parameter)
+{
+    Reading reading;
+    for (;;)
     {
-        haveReading = false;
-        tiltGravity = calculateGravity();
+        if (xQueueReceive(displayQueue, &reading, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
 
         // Update battery indicator with each new reading
-        updateBatteryIndicator(tiltData.volt);
-        
-        screenUpdateVariables(tiltGravity, tiltData.temp, tiltData.tilt);
-        saveReading(tiltGravity);
-        drawGraph();
-        wifiConnect();
-        if (integrationEnabled(tiltedURL))
+        updateBatteryIndicator(reading.data.volt);
+
+        screenUpdateVariables(reading.gravity, reading.data.temp, reading.data.tilt);
+        screenUpdateAnalytics(reading.analytics);
+        int count = tsQuery(reading.sensorId, 0, UINT32_MAX, graphPoints, GRAPH_POINTS);
+        drawGraph(graphPoints, count);
+    }
+}
+
+void startTasks()
+{
+    rxQueue = xQueueCreate(RX_QUEUE_LENGTH, sizeof(RawFrame));
+    publishQueue = xQueueCreate(PUBLISH_QUEUE_LENGTH, sizeof(Reading));
+    storageQueue = xQueueCreate(STORAGE_QUEUE_LENGTH, sizeof(Reading));
+    displayQueue = xQueueCreate(1, sizeof(Reading));
+    rxQueueMetric = metricsRegisterQueue("rx", rxQueue, RX_QUEUE_LENGTH);
+    publishQueueMetric = metricsRegisterQueue("publish", publishQueue, PUBLISH_QUEUE_LENGTH);
+    storageQueueMetric = metricsRegisterQueue("storage", storageQueue, STORAGE_QUEUE_LENGTH);
+    liveBegin();
+
+    xTaskCreatePinnedToCore(radioTask, "radio", RADIO_TASK_STACK, NULL,
+                            RADIO_TASK_PRIORITY, &radioTaskHandle, RADIO_TASK_CORE);
+    xTaskCreatePinnedToCore(publishTask, "publish", PUBLISH_TASK_STACK, NULL,
+                            PUBLISH_TASK_PRIORITY, &publishTaskHandle, PUBLISH_TASK_CORE);
+    xTaskCreatePinnedToCore(storageTask, "storage", STORAGE_TASK_STACK, NULL,
+                            STORAGE_TASK_PRIORITY, &storageTaskHandle, STORAGE_TASK_CORE);
+    xTaskCreatePinnedToCore(displayTask, "display", DISPLAY_TASK_STACK, NULL,
+                            DISPLAY_TASK_PRIORITY, &displayTaskHandle, DISPLAY_TASK_CORE);
+    metricsRegisterTask("radio", radioTaskHandle);
+    metricsRegisterTask("publish", publishTaskHandle);
+    metricsRegisterTask("storage", storageTaskHandle);
+    metricsRegisterTask("display", displayTaskHandle);
+
+    for (Publisher *publisher : publishers)
+    {
+        publisher->begin();
+    }
+}
+
+// Requests that change sensors, calibration or stored data need the admin
+// password. Without one set they are only taken in config mode, where the
+// gateway is only reachable through its setup AP.
+bool adminAuthorized()
+{
+    if (adminPassword.isEmpty())
+    {
+        return configMode;
+    }
+    return server.authenticate("admin", adminPassword.c_str());
+}
+
+// Like adminAuthorized(), answering the request if it is not.
+bool requireAdmin()
+{
+    if (adminAuthorized())
+    {
+        return true;
+    }
+    if (adminPassword.isEmpty())
+    {
+        server.send(403, "text/plain", "Set an admin password in the configuration first");
+    }
+    else
+    {
+        server.requestAuthentication();
+    }
+    return false;
+}
+
+// Serve a sensor's stored history as JSON, downsampled to at most the
+// requested number of points:
+// /history?sensor=aa:bb:cc:dd:ee:ff&from=<unix time>&to=<unix time>&points=<n>
+void handleHistory()
+{
+    static TsPoint points[TS_MAX_QUERY_POINTS];
+
+    uint8_t sensor[6];
+    if (sscanf(server.arg("sensor").c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &sensor[0], &sensor[1], &sensor[2], &sensor[3], &sensor[4], &sensor[5]) != 6)
+    {
+        server.send(400, "text/plain", "Missing or invalid sensor");
+        return;
+    }
+    uint32_t from = server.hasArg("from") ? strtoul(server.arg("from").c_str(), nullptr, 10) : 0;
+    uint32_t to = server.hasArg("to") ? strtoul(server.arg("to").c_str(), nullptr, 10) : UINT32_MAX;
+    int maxPoints = server.hasArg("points") ? server.arg("points").toInt() : 100;
+
+    int count = tsQuery(sensor, from, to, points, maxPoints);
+
+    String body;
+    body.reserve(32 + count * 40);
+    body += "{\"sensor\":\"";
+    body += macToString(sensor);
+    body += "\",\"points\":[";
+    char point[48];
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(point, sizeof(point), "%s[%lu,%.3f,%.1f]", i > 0 ? "," : "",
+                 (unsigned long)points[i].time, points[i].gravity, points[i].temp);
+        body += point;
+    }
+    body += "]}";
+    server.send(200, "application/json", body);
+}
+
+// Queue a command for a sensor, delivered the next time it reports:
+// POST /command?sensor=aa:bb:cc:dd:ee:ff&command=interval|calibration|ota|target&value=<n>
+// For target the value is the end date as Unix time.
+// GET /command lists the commands still waiting.
+void handleCommand()
+{
+    if (server.method() != HTTP_GET && !requireAdmin())
+    {
+        return;
+    }
+    if (server.method() == HTTP_GET)
+    {
+        String body;
+        downlinkRender(body);
+        server.send(200, "application/json", body);
+        return;
+    }
+
+    uint8_t sensor[6];
+    if (sscanf(server.arg("sensor").c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &sensor[0], &sensor[1], &sensor[2], &sensor[3], &sensor[4], &sensor[5]) != 6)
+    {
+        server.send(400, "text/plain", "Missing or invalid sensor");
+        return;
+    }
+    Command command;
+    if (!downlinkParseCommand(server.arg("command"), command))
+    {
+        server.send(400, "text/plain", "Unknown command");
+        return;
+    }
+    int32_t value = server.arg("value").toInt();
+    if (command == COMMAND_TARGET_RUNTIME && value != 0)
+    {
+        // Given as an end date, sensors only know how long they have left.
+        time_t now = time(nullptr);
+        time_t end = strtoul(server.arg("value").c_str(), nullptr, 10);
+        if (now < MIN_VALID_TIME || end <= now)
         {
-            publishTilted(tiltedURL, tiltedUsername, tiltedPassword);
+            server.send(400, "text/plain", "Clock not set, or end date in the past");
+            return;
         }
-        if (integrationEnabled(mqttServer))
+        value = (end - now + 1800) / 3600;
+    }
+    if (!downlinkQueue(sensor, command, value))
+    {
+        server.send(503, "text/plain", "Too many commands waiting");
+        return;
+    }
+    LOGI("Queued %s command for %s", downlinkCommandName(command), macToString(sensor));
+    server.send(202, "text/plain", "Queued");
+}
+
+// Calibration profiles:
+// GET /calibration lists all profiles as JSON.
+// POST /calibration?sensor=aa:bb:cc:dd:ee:ff&action=point&gravity=<SG> adds a
+// point from the sensor's latest reading.
+// POST /calibration?sensor=...&action=fit&degree=<1-3> fits the points.
+// POST /calibration?sensor=...&action=clear drops the profile.
+void handleCalibration()
+{
+    if (server.method() != HTTP_GET && !requireAdmin())
+    {
+        return;
+    }
+    if (server.method() == HTTP_GET)
+    {
+        String body;
+        calibrationRender(body);
+        server.send(200, "application/json", body);
+        return;
+    }
+
+    uint8_t sensor[6];
+    if (sscanf(server.arg("sensor").c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &sensor[0], &sensor[1], &sensor[2], &sensor[3], &sensor[4], &sensor[5]) != 6)
+    {
+        server.send(400, "text/plain", "Missing or invalid sensor");
+        return;
+    }
+    String action = server.arg("action");
+    if (action == "point")
+    {
+        float gravity = server.arg("gravity").toFloat();
+        if (gravity < 0.9 || gravity > 1.2)
         {
-            publishMQTT();
+            server.send(400, "text/plain", "Gravity out of range");
+            return;
         }
-        if (integrationEnabled(brewfatherURL))
+        if (!calibrationAddPoint(sensor, gravity))
         {
-            publishBrewfather();
+            server.send(409, "text/plain", "No reading from this sensor yet, or too many points");
+            return;
         }
-        if (integrationEnabled(influxdbURL))
+        LOGI("Added calibration point %.4f for %s", gravity, macToString(sensor));
+    }
+    else if (action == "fit")
+    {
+        int degree = server.arg("degree").toInt();
+        if (!calibrationFit(sensor, degree))
         {
-            influxClient.setConnectionParams(influxdbURL, influxdbOrg, influxdbBucket, influxdbToken);
-            publishInfluxDB();
+            server.send(409, "text/plain", "Need more points than the degree, at different tilts");
+            return;
+        }
+        LOGI("Fitted degree %d calibration for %s", degree, macToString(sensor));
+    }
+    else if (action == "clear")
+    {
+        calibrationClear(sensor);
+        LOGI("Cleared calibration for %s", macToString(sensor));
+    }
+    else
+    {
+        server.send(400, "text/plain", "Unknown action");
+        return;
+    }
+    server.send(200, "text/plain", "OK");
+}
+
+// Serve the stored sensor image to ESP8266httpUpdate. Sensors already
+// running it get a 304.
+void handleSensorFirmware()
+{
+    if (!sensorOtaAvailable())
+    {
+        server.send(404, "text/plain", "No sensor firmware");
+        return;
+    }
+    if (server.header("x-ESP8266-sketch-md5") == sensorOtaMd5())
+    {
+        server.send(304);
+        return;
+    }
+    File file = sensorOtaOpen();
+    if (!file)
+    {
+        server.send(500, "text/plain", "Could not open sensor firmware");
+        return;
+    }
+
+    unsigned long start = millis();
+    server.sendHeader("x-MD5", sensorOtaMd5());
+    size_t sent = server.streamFile(file, "application/octet-stream");
+    file.close();
+    LOGI("Sent sensor firmware to %s, %u bytes in %lu ms",
+         server.header("x-ESP8266-STA-MAC"), sent, millis() - start);
+    if (otaApActive)
+    {
+        // Leave the AP up for other sensors told to update.
+        sensorOtaRequestAp();
+    }
+}
+
+// Serve a delta patch from the version the sensor runs to the stored image.
+// Sensors fall back to the full image on 404.
+void handleSensorPatch()
+{
+    if (sensorOtaAvailable() && server.header("x-ESP8266-sketch-md5") == sensorOtaMd5())
+    {
+        server.send(304);
+        return;
+    }
+    File file = sensorOtaOpenPatch(server.header("x-ESP8266-version"));
+    if (!file)
+    {
+        server.send(404, "text/plain", "No patch for this version");
+        return;
+    }
+
+    unsigned long start = millis();
+    size_t sent = server.streamFile(file, "application/octet-stream");
+    file.close();
+    LOGI("Sent sensor patch to %s, %u bytes in %lu ms",
+         server.header("x-ESP8266-STA-MAC"), sent, millis() - start);
+    if (otaApActive)
+    {
+        sensorOtaRequestAp();
+    }
+}
+
+// The live dashboard, gzipped in flash. Browsers revalidate it on every
+// load, and get a 304 unless the firmware brought a different page.
+void handleLive()
+{
+    server.sendHeader("Cache-Control", "no-cache");
+    server.sendHeader("ETag", LIVE_HTML_ETAG);
+    if (server.header("If-None-Match") == LIVE_HTML_ETAG)
+    {
+        server.send(304);
+        return;
+    }
+    server.sendHeader("Content-Encoding", "gzip");
+    server.send_P(200, "text/html", (const char *)LIVE_HTML_GZ, LIVE_HTML_SIZE);
+}
+
+// Server-Sent Events for the dashboard. The live module keeps the connection
+// once the web server is done with the request.
+void handleLiveEvents()
+{
+    WiFiClient client = server.client();
+    if (!liveAccept(client))
+    {
+        server.sendHeader("Retry-After", "60");
+        server.send(503, "text/plain", "Too many live clients");
+    }
+}
+
+// Frame capture:
+// GET /capture shows whether a capture is running and how much it holds.
+// GET /capture.bin downloads it.
+// POST /capture?action=start starts a new one, action=stop stops it.
+void handleCapture()
+{
+    if (server.method() == HTTP_POST)
+    {
+        if (!requireAdmin())
+        {
+            return;
+        }
+        String action = server.arg("action");
+        if (action == "start")
+        {
+            if (!captureStart())
+            {
+                server.send(500, "text/plain", "Could not create capture file");
+                return;
+            }
+        }
+        else if (action == "stop")
+        {
+            captureStop();
+        }
+        else
+        {
+            server.send(400, "text/plain", "Unknown action");
+            return;
+        }
+    }
+    String body;
+    captureRender(body);
+    server.send(200, "application/json", body);
+}
+
+void handleCaptureDownload()
+{
+    if (captureActive())
+    {
+        server.send(409, "text/plain", "Stop the capture first");
+        return;
+    }
+    File file = captureOpen();
+    if (!file)
+    {
+        server.send(404, "text/plain", "No capture");
+        return;
+    }
+    server.streamFile(file, "application/octet-stream");
+    file.close();
+}
+
+static int hexNibble(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decode len bytes starting at byte offset pos of a hex string.
+static bool hexBytes(const String &hex, size_t pos, uint8_t *out, size_t len)
+{
+    if ((pos + len) * 2 > hex.length())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        int high = hexNibble(hex[2 * (pos + i)]), low = hexNibble(hex[2 * (pos + i) + 1]);
+        if (high < 0 || low < 0)
+        {
+            return false;
+        }
+        out[i] = high << 4 | low;
+    }
+    return true;
+}
+
+// Feed captured frames through the radio task, as posted by tools/replay:
+// POST /replay with frames=<capture records, hex encoded>. Pacing is up to
+// the poster. By default replayed frames are only decoded, calibrated and
+// logged, leaving integrations, history, analytics and calibration points
+// alone. With publish=1 they are deduplicated and published like any other,
+// but never answered or relayed. Frames that do not fit in the receive queue
+// within a moment are dropped and counted in the response.
+void handleReplay()
+{
+    if (!requireAdmin())
+    {
+        return;
+    }
+    String hex = server.arg("frames");
+    ReplayMode mode = server.arg("publish") == "1" ? REPLAY_PUBLISH : REPLAY_DRY;
+    size_t len = hex.length() / 2;
+    int accepted = 0, dropped = 0;
+    size_t pos = 0;
+    while (pos < len)
+    {
+        CaptureRecord record;
+        RawFrame frame;
+        if (!hexBytes(hex, pos, (uint8_t *)&record, sizeof(record)) || record.len > ESP_NOW_MAX_DATA_LEN ||
+            !hexBytes(hex, pos + sizeof(record), frame.data, record.len))
+        {
+            break;
+        }
+        pos += sizeof(record) + record.len;
+        memcpy(frame.mac, record.mac, 6);
+        frame.rssi = record.rssi;
+        frame.receivedMs = esp_timer_get_time() / 1000;
+        frame.replay = mode;
+        frame.len = record.len;
+        if (xQueueSend(rxQueue, &frame, pdMS_TO_TICKS(100)) == pdTRUE)
+        {
+            accepted++;
+        }
+        else
+        {
+            dropped++;
+        }
+    }
+    if (pos != len || hex.length() % 2 != 0)
+    {
+        server.send(400, "text/plain", "Invalid or truncated record");
+        return;
+    }
+    char body[64];
+    snprintf(body, sizeof(body), "{\"accepted\":%d,\"dropped\":%d}", accepted, dropped);
+    server.send(200, "application/json", body);
+}
+
+// Store a new sensor image or patch, uploaded as multipart form data:
+// curl -F firmware=@firmware.bin http://<gateway-ip>/sensor/firmware
+// curl -F patch=@update.patch http://<gateway-ip>/sensor/patch
+bool firmwareUploadOk = false;
+
+void handleSensorFirmwareUpload()
+{
+    HTTPUpload &upload = server.upload();
+    switch (upload.status)
+    {
+    case UPLOAD_FILE_START:
+        // Checked again when the upload is answered.
+        firmwareUploadOk = adminAuthorized() && sensorOtaUploadStart(server.uri() == "/sensor/patch");
+        break;
+    case UPLOAD_FILE_WRITE:
+        firmwareUploadOk = firmwareUploadOk && sensorOtaUploadWrite(upload.buf, upload.currentSize);
+        break;
+    case UPLOAD_FILE_END:
+        firmwareUploadOk = firmwareUploadOk && sensorOtaUploadEnd();
+        break;
+    case UPLOAD_FILE_ABORTED:
+        sensorOtaUploadAbort();
+        firmwareUploadOk = false;
+        break;
+    }
+}
+
+// Open the sensor firmware AP when a sensor has been told to update, and
+// close it again once it has been idle for a while. The AP shares the
+// channel with ESP-NOW, so reception carries on.
+void updateSensorOtaAp()
+{
+    bool wanted = sensorOtaApIdle() < SENSOR_OTA_AP_TIMEOUT;
+    if (wanted == otaApActive || configMode)
+    {
+        return;
+    }
+    if (wanted)
+    {
+        if (otaApPassword.length() < 8)
+        {
+            LOGW("No sensor firmware AP password configured, not opening the AP");
+            // Until the next OTA command asks again.
+            sensorOtaCancelAp();
+            return;
+        }
+        otaApActive = true;
+        WiFi.mode(WIFI_AP_STA);
+        WiFi.softAP(otaApSSID, otaApPassword.c_str(), WiFi.channel());
+        LOGI("Sensor firmware AP open on %s", WiFi.softAPIP().toString());
+    }
+    else
+    {
+        otaApActive = false;
+        WiFi.softAPdisconnect(true);
+        LOGI("Sensor firmware AP closed");
+    }
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    logBegin();
+
+    btn1.setTapHandler(button1Pressed);
+
+    // Load settings
+    loadSettings();
+    calibrationBegin();
+
+    prepareScreen();
+
+    tsBegin();
+    sensorOtaBegin();
+    // Synced in the background whenever WiFi is up.
+    configTime(0, 0, NTP_SERVER);
+
+    // Queues must exist before ESP-NOW can deliver anything.
+    startTasks();
+
+    // Health metrics are served in every mode, not only in config mode.
+    server.on("/metrics", HTTP_GET, []() {
+        String body;
+        metricsRender(body);
+        server.send(200, "text/plain; version=0.0.4", body);
+    });
+    server.on("/history", HTTP_GET, handleHistory);
+    server.on("/command", HTTP_ANY, handleCommand);
+    server.on("/calibration", HTTP_ANY, handleCalibration);
+    server.on("/calibration.html", HTTP_GET, []() {
+        server.send_P(200, "text/html", CALIBRATION_HTML);
+    });
+    server.on("/live", HTTP_GET, handleLive);
+    server.on("/live/events", HTTP_GET, handleLiveEvents);
+    server.on("/capture", HTTP_ANY, handleCapture);
+    server.on("/capture.bin", HTTP_GET, handleCaptureDownload);
+    server.on("/replay", HTTP_POST, handleReplay);
+    server.on("/sensor/firmware", HTTP_GET, handleSensorFirmware);
+    auto firmwareUploaded = []() {
+        if (!requireAdmin()) {
+            return;
+        }
+        if (firmwareUploadOk) {
+            server.send(200, "text/plain", "Stored");
+        } else {
+            server.send(400, "text/plain", "Upload failed");
+        }
+    };
+    server.on("/sensor/firmware", HTTP_POST, firmwareUploaded, handleSensorFirmwareUpload);
+    server.on("/sensor/patch", HTTP_GET, handleSensorPatch);
+    server.on("/sensor/patch", HTTP_POST, firmwareUploaded, handleSensorFirmwareUpload);
+    const char *headers[] = {"x-ESP8266-sketch-md5", "x-ESP8266-STA-MAC", "x-ESP8266-version", "If-None-Match"};
+    server.collectHeaders(headers, 4);
+    server.begin();
+
+    // A relay only talks ESP-NOW, so it does without WiFi settings.
+    if (wifiSSID.isEmpty() && !relayMode) {
+        startConfigMode();
+    } else {
+        // Disconnect from AP before initializing ESP-Now.
+        // This is needed because IoTWebConf for some reason sets up the AP with init().
+        //WiFi.softAPdisconnect(true);
+        if (relayMode && !wifiSSID.isEmpty())
+        {
+            findApChannel();
         }
         initEspNow();
+        // Join right away, so sensors find the gateway on the AP's channel
+        // rather than on the default one until the first publish.
+        if (!wifiSSID.isEmpty() && !relayMode)
+        {
+            wifiConnect();
+        }
     }
-}
\ No newline at end of file
+}
+
+void loop()
+{
+    btn1.loop();
+
+    server.handleClient();
+    updateSensorOtaAp();
+    captureFlush();
+    liveLoop();
+
+    // Leave the core to the publish and display tasks between button polls.
+    delay(5);
+}
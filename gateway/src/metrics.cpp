@@ -0,0 +1,513 @@
+#include "metrics.h"
+#include "log.h"
+
+struct SensorMetrics
+{
+    uint8_t mac[6];
+    uint32_t framesReceived;
+    uint32_t framesRejected;
+    uint32_t framesDuplicate;
+    int8_t lastRssi;
+    uint32_t otaDuration;
+    uint32_t otaEnergy;
+    uint32_t batteryHours;
+    uint32_t samples;
+    uint32_t firstSample;
+    uint32_t discoveryDuration;
+    uint32_t discoveries;
+    uint32_t readingsImplied;
+    uint32_t heartbeatsMissed;
+};
+
+struct IntegrationMetrics
+{
+    uint32_t buckets[LATENCY_BUCKET_COUNT + 1];
+    uint32_t latencySum;
+    uint32_t count;
+    uint32_t failures;
+    uint32_t skipped;
+    int breakerState;
+};
+
+struct TaskMetrics
+{
+    const char *name;
+    TaskHandle_t handle;
+};
+
+struct QueueMetrics
+{
+    const char *name;
+    QueueHandle_t handle;
+    int capacity;
+    uint32_t dropped;
+};
+
+static SensorMetrics sensors[METRICS_MAX_SENSORS];
+static volatile int sensorCount = 0;
+static uint32_t sensorOverflow = 0;
+
+static IntegrationMetrics integrations[INTEGRATION_COUNT];
+static IntegrationMetrics rounds;
+static uint32_t wifiReconnects = 0;
+static uint32_t framesReplayed = 0;
+static IntegrationMetrics livePushes;
+static int liveClients = 0;
+static uint32_t liveClientHeap = 0;
+static uint32_t liveRejected = 0;
+
+static TaskMetrics tasks[METRICS_MAX_TASKS];
+static int taskCount = 0;
+static QueueMetrics queues[METRICS_MAX_QUEUES];
+static int queueCount = 0;
+
+const char *integrationName(Integration integration)
+{
+    switch (integration)
+    {
+    case INTEGRATION_TILTED:
+        return "tilted";
+    case INTEGRATION_MQTT:
+        return "mqtt";
+    case INTEGRATION_BREWFATHER:
+        return "brewfather";
+    case INTEGRATION_INFLUXDB:
+        return "influxdb";
+    default:
+        return "unknown";
+    }
+}
+
+// Only ever called from the radio task, so adding an entry needs no lock.
+// The count is published after the MAC is written for the scraping side.
+static SensorMetrics *sensorMetrics(const uint8_t *mac)
+{
+    for (int i = 0; i < sensorCount; i++)
+    {
+        if (memcmp(sensors[i].mac, mac, 6) == 0)
+        {
+            return &sensors[i];
+        }
+    }
+    if (sensorCount >= METRICS_MAX_SENSORS)
+    {
+        sensorOverflow++;
+        return nullptr;
+    }
+    SensorMetrics *entry = &sensors[sensorCount];
+    memcpy(entry->mac, mac, 6);
+    sensorCount = sensorCount + 1;
+    return entry;
+}
+
+void metricsFrameReceived(const uint8_t *mac, int8_t rssi)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->framesReceived++;
+        entry->lastRssi = rssi;
+    }
+}
+
+void metricsFrameRejected(const uint8_t *mac)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->framesRejected++;
+    }
+}
+
+void metricsFrameDuplicate(const uint8_t *mac)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->framesDuplicate++;
+    }
+}
+
+void metricsSensorOta(const uint8_t *mac, uint32_t durationMs, uint32_t energyMj)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->otaDuration = durationMs;
+        entry->otaEnergy = energyMj;
+    }
+}
+
+void metricsSensorBattery(const uint8_t *mac, uint32_t hours)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->batteryHours = hours;
+    }
+}
+
+void metricsSensorSamples(const uint8_t *mac, uint32_t samples)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->samples = samples;
+    }
+}
+
+void metricsSensorFirstSample(const uint8_t *mac, uint32_t durationMs)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->firstSample = durationMs;
+    }
+}
+
+void metricsSensorDiscovery(const uint8_t *mac, uint32_t durationMs)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->discoveryDuration = durationMs;
+        entry->discoveries++;
+    }
+}
+
+void metricsReadingImplied(const uint8_t *mac)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->readingsImplied++;
+    }
+}
+
+void metricsHeartbeatMissed(const uint8_t *mac)
+{
+    SensorMetrics *entry = sensorMetrics(mac);
+    if (entry)
+    {
+        entry->heartbeatsMissed++;
+    }
+}
+
+static void observeLatency(IntegrationMetrics &m, uint32_t latencyMs)
+{
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKET_COUNT && latencyMs > latencyBucketBounds[bucket])
+    {
+        bucket++;
+    }
+    m.buckets[bucket]++;
+    m.latencySum += latencyMs;
+    m.count++;
+}
+
+void metricsPublished(Integration integration, uint32_t latencyMs, bool success)
+{
+    IntegrationMetrics &m = integrations[integration];
+    observeLatency(m, latencyMs);
+    if (!success)
+    {
+        m.failures++;
+    }
+}
+
+void metricsPublishRound(uint32_t latencyMs)
+{
+    observeLatency(rounds, latencyMs);
+}
+
+void metricsPublishSkipped(Integration integration)
+{
+    integrations[integration].skipped++;
+}
+
+void metricsBreakerState(Integration integration, int state)
+{
+    integrations[integration].breakerState = state;
+}
+
+void metricsWifiReconnect()
+{
+    wifiReconnects++;
+}
+
+void metricsFrameReplayed()
+{
+    framesReplayed++;
+}
+
+void metricsLiveClients(int clients, uint32_t heapPerClient)
+{
+    liveClients = clients;
+    liveClientHeap = heapPerClient;
+}
+
+void metricsLiveRejected()
+{
+    liveRejected++;
+}
+
+void metricsLivePushed(uint32_t latencyMs)
+{
+    observeLatency(livePushes, latencyMs);
+}
+
+void metricsRegisterTask(const char *name, TaskHandle_t task)
+{
+    if (taskCount >= METRICS_MAX_TASKS)
+    {
+        LOGW("No room for metrics of task %s", name);
+        return;
+    }
+    tasks[taskCount++] = {name, task};
+}
+
+int metricsRegisterQueue(const char *name, QueueHandle_t queue, int capacity)
+{
+    if (queueCount >= METRICS_MAX_QUEUES)
+    {
+        LOGW("No room for metrics of queue %s", name);
+        return -1;
+    }
+    queues[queueCount] = {name, queue, capacity, 0};
+    return queueCount++;
+}
+
+void metricsQueueDropped(int queue)
+{
+    if (queue >= 0 && queue < queueCount)
+    {
+        queues[queue].dropped++;
+    }
+}
+
+static void appendHeader(String &out, const char *name, const char *type, const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void appendSample(String &out, const char *name, const char *labels, uint32_t value)
+{
+    out += name;
+    if (labels[0])
+    {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+static void appendValue(String &out, uint32_t value)
+{
+    out += value;
+}
+
+static void appendValue(String &out, int8_t value)
+{
+    out += (int)value;
+}
+
+// One sample per sensor of the given field, labelled with the sensor's MAC.
+template <typename T>
+static void appendSensorSamples(String &out, const char *name, const char *type, const char *help,
+                                T SensorMetrics::*field)
+{
+    char labels[64];
+    int count = sensorCount;
+
+    appendHeader(out, name, type, help);
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *mac = sensors[i].mac;
+        snprintf(labels, sizeof(labels), "sensor=\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+                 mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        out += name;
+        out += '{';
+        out += labels;
+        out += "} ";
+        appendValue(out, sensors[i].*field);
+        out += '\n';
+    }
+}
+
+void metricsRender(String &out)
+{
+    char labels[64];
+
+    out.reserve(4096);
+
+    appendSensorSamples(out, "tilted_frames_received_total", "counter",
+                        "ESP-NOW frames accepted per sensor.",
+                        &SensorMetrics::framesReceived);
+    appendSensorSamples(out, "tilted_frames_rejected_total", "counter",
+                        "ESP-NOW frames that could not be decoded, per sensor.",
+                        &SensorMetrics::framesRejected);
+    appendSensorSamples(out, "tilted_readings_implied_total", "counter",
+                        "Readings repeated for sensors that skipped sending an unchanged reading.",
+                        &SensorMetrics::readingsImplied);
+    appendSensorSamples(out, "tilted_sensor_heartbeats_missed_total", "counter",
+                        "Times a sensor stayed quiet for longer than its heartbeat.",
+                        &SensorMetrics::heartbeatsMissed);
+    appendSensorSamples(out, "tilted_frames_duplicate_total", "counter",
+                        "Frames dropped because they already arrived directly or through a relay, per sensor.",
+                        &SensorMetrics::framesDuplicate);
+    appendSensorSamples(out, "tilted_sensor_rssi_dbm", "gauge",
+                        "RSSI of the last frame per sensor.",
+                        &SensorMetrics::lastRssi);
+    appendSensorSamples(out, "tilted_sensor_ota_duration_ms", "gauge",
+                        "Duration of the last firmware update per sensor, as reported by the sensor.",
+                        &SensorMetrics::otaDuration);
+    appendSensorSamples(out, "tilted_sensor_ota_energy_mj", "gauge",
+                        "Estimated energy spent on the last firmware update per sensor.",
+                        &SensorMetrics::otaEnergy);
+    appendSensorSamples(out, "tilted_sensor_battery_runtime_hours", "gauge",
+                        "Remaining battery runtime per sensor, as estimated by the sensor.",
+                        &SensorMetrics::batteryHours);
+    appendSensorSamples(out, "tilted_sensor_samples", "gauge",
+                        "Tilt samples taken by each sensor for its last reading.",
+                        &SensorMetrics::samples);
+    appendSensorSamples(out, "tilted_sensor_first_sample_ms", "gauge",
+                        "Time from each sensor's last wake to its first sample.",
+                        &SensorMetrics::firstSample);
+    appendSensorSamples(out, "tilted_sensor_channel_searches_total", "counter",
+                        "Channel searches reported by each sensor.",
+                        &SensorMetrics::discoveries);
+    appendSensorSamples(out, "tilted_sensor_channel_search_ms", "gauge",
+                        "Duration of each sensor's last channel search.",
+                        &SensorMetrics::discoveryDuration);
+
+    appendHeader(out, "tilted_sensor_table_overflow_total", "counter", "Frames from sensors that did not fit in the metrics table.");
+    appendSample(out, "tilted_sensor_table_overflow_total", "", sensorOverflow);
+
+    appendHeader(out, "tilted_publish_latency_ms", "histogram", "Publish latency per integration.");
+    for (int i = 0; i < INTEGRATION_COUNT; i++)
+    {
+        const IntegrationMetrics &m = integrations[i];
+        const char *name = integrationName((Integration)i);
+        uint32_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKET_COUNT; b++)
+        {
+            cumulative += m.buckets[b];
+            snprintf(labels, sizeof(labels), "integration=\"%s\",le=\"%u\"", name, latencyBucketBounds[b]);
+            appendSample(out, "tilted_publish_latency_ms_bucket", labels, cumulative);
+        }
+        snprintf(labels, sizeof(labels), "integration=\"%s\",le=\"+Inf\"", name);
+        appendSample(out, "tilted_publish_latency_ms_bucket", labels, m.count);
+        snprintf(labels, sizeof(labels), "integration=\"%s\"", name);
+        appendSample(out, "tilted_publish_latency_ms_sum", labels, m.latencySum);
+        appendSample(out, "tilted_publish_latency_ms_count", labels, m.count);
+    }
+
+    appendHeader(out, "tilted_publish_round_ms", "histogram", "Wall-clock time to publish a reading to all integrations.");
+    {
+        uint32_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKET_COUNT; b++)
+        {
+            cumulative += rounds.buckets[b];
+            snprintf(labels, sizeof(labels), "le=\"%u\"", latencyBucketBounds[b]);
+            appendSample(out, "tilted_publish_round_ms_bucket", labels, cumulative);
+        }
+        appendSample(out, "tilted_publish_round_ms_bucket", "le=\"+Inf\"", rounds.count);
+        appendSample(out, "tilted_publish_round_ms_sum", "", rounds.latencySum);
+        appendSample(out, "tilted_publish_round_ms_count", "", rounds.count);
+    }
+
+    appendHeader(out, "tilted_publish_failures_total", "counter", "Failed publishes per integration.");
+    for (int i = 0; i < INTEGRATION_COUNT; i++)
+    {
+        snprintf(labels, sizeof(labels), "integration=\"%s\"", integrationName((Integration)i));
+        appendSample(out, "tilted_publish_failures_total", labels, integrations[i].failures);
+    }
+
+    appendHeader(out, "tilted_publish_skipped_total", "counter", "Readings not sent because the circuit breaker was open.");
+    for (int i = 0; i < INTEGRATION_COUNT; i++)
+    {
+        snprintf(labels, sizeof(labels), "integration=\"%s\"", integrationName((Integration)i));
+        appendSample(out, "tilted_publish_skipped_total", labels, integrations[i].skipped);
+    }
+
+    appendHeader(out, "tilted_publish_breaker_state", "gauge", "Circuit breaker state per integration: 0 closed, 1 open, 2 half open.");
+    for (int i = 0; i < INTEGRATION_COUNT; i++)
+    {
+        snprintf(labels, sizeof(labels), "integration=\"%s\"", integrationName((Integration)i));
+        appendSample(out, "tilted_publish_breaker_state", labels, integrations[i].breakerState);
+    }
+
+    appendHeader(out, "tilted_wifi_reconnects_total", "counter", "Times the gateway had to (re)join the WiFi network.");
+    appendSample(out, "tilted_wifi_reconnects_total", "", wifiReconnects);
+
+    appendHeader(out, "tilted_replayed_frames_total", "counter", "Frames posted to /replay as a dry run, decoded but not published.");
+    appendSample(out, "tilted_replayed_frames_total", "", framesReplayed);
+
+    appendHeader(out, "tilted_live_clients", "gauge", "Clients connected to the live dashboard.");
+    appendSample(out, "tilted_live_clients", "", liveClients);
+    appendHeader(out, "tilted_live_client_heap_bytes", "gauge", "Heap taken per live dashboard client, estimated from the free heap without clients.");
+    appendSample(out, "tilted_live_client_heap_bytes", "", liveClientHeap);
+    appendHeader(out, "tilted_live_rejected_total", "counter", "Live dashboard clients turned away because the limit was reached.");
+    appendSample(out, "tilted_live_rejected_total", "", liveRejected);
+
+    appendHeader(out, "tilted_live_push_ms", "histogram", "Time from a frame arriving to its live event being written.");
+    {
+        uint32_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKET_COUNT; b++)
+        {
+            cumulative += livePushes.buckets[b];
+            snprintf(labels, sizeof(labels), "le=\"%u\"", latencyBucketBounds[b]);
+            appendSample(out, "tilted_live_push_ms_bucket", labels, cumulative);
+        }
+        appendSample(out, "tilted_live_push_ms_bucket", "le=\"+Inf\"", livePushes.count);
+        appendSample(out, "tilted_live_push_ms_sum", "", livePushes.latencySum);
+        appendSample(out, "tilted_live_push_ms_count", "", livePushes.count);
+    }
+
+    appendHeader(out, "tilted_heap_free_bytes", "gauge", "Free heap.");
+    appendSample(out, "tilted_heap_free_bytes", "", ESP.getFreeHeap());
+    appendHeader(out, "tilted_heap_largest_free_block_bytes", "gauge", "Largest allocatable heap block.");
+    appendSample(out, "tilted_heap_largest_free_block_bytes", "", ESP.getMaxAllocHeap());
+
+    appendHeader(out, "tilted_task_stack_high_water_bytes", "gauge", "Minimum free stack seen per task.");
+    for (int i = 0; i < taskCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "task=\"%s\"", tasks[i].name);
+        appendSample(out, "tilted_task_stack_high_water_bytes", labels, uxTaskGetStackHighWaterMark(tasks[i].handle));
+    }
+
+    appendHeader(out, "tilted_queue_depth", "gauge", "Messages waiting per queue.");
+    for (int i = 0; i < queueCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "queue=\"%s\"", queues[i].name);
+        appendSample(out, "tilted_queue_depth", labels, uxQueueMessagesWaiting(queues[i].handle));
+    }
+
+    appendHeader(out, "tilted_queue_capacity", "gauge", "Capacity per queue.");
+    for (int i = 0; i < queueCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "queue=\"%s\"", queues[i].name);
+        appendSample(out, "tilted_queue_capacity", labels, queues[i].capacity);
+    }
+
+    appendHeader(out, "tilted_queue_dropped_total", "counter", "Messages dropped because a queue was full.");
+    for (int i = 0; i < queueCount; i++)
+    {
+        snprintf(labels, sizeof(labels), "queue=\"%s\"", queues[i].name);
+        appendSample(out, "tilted_queue_dropped_total", labels, queues[i].dropped);
+    }
+
+    appendHeader(out, "tilted_uptime_seconds", "counter", "Seconds since boot.");
+    appendSample(out, "tilted_uptime_seconds", "", millis() / 1000);
+}
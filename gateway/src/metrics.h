@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Gateway health counters, exported in Prometheus text format on /metrics.
+// Everything is a fixed-size array so the hot path never allocates; each
+// counter has a single writer task, and 32-bit reads from the web server are
+// atomic on the ESP32.
+
+#define METRICS_MAX_SENSORS 16
+// The radio, publish, storage and display tasks and the rx, publish, storage
+// and live queues, one of each per integration, and room to spare.
+#define METRICS_MAX_TASKS (4 + INTEGRATION_COUNT + 4)
+#define METRICS_MAX_QUEUES (4 + INTEGRATION_COUNT + 4)
+
+enum Integration
+{
+    INTEGRATION_TILTED,
+    INTEGRATION_MQTT,
+    INTEGRATION_BREWFATHER,
+    INTEGRATION_INFLUXDB,
+    INTEGRATION_COUNT
+};
+
+// Upper bounds of the publish latency histogram buckets, in ms.
+// Anything slower lands in the implicit +Inf bucket.
+#define LATENCY_BUCKET_COUNT 8
+static const uint32_t latencyBucketBounds[LATENCY_BUCKET_COUNT] = {50, 100, 250, 500, 1000, 2500, 5000, 10000};
+
+const char *integrationName(Integration integration);
+
+void metricsFrameReceived(const uint8_t *mac, int8_t rssi);
+void metricsFrameRejected(const uint8_t *mac);
+// A frame that already arrived directly or through another relay.
+void metricsFrameDuplicate(const uint8_t *mac);
+// Duration and estimated energy of a sensor's last firmware update.
+void metricsSensorOta(const uint8_t *mac, uint32_t durationMs, uint32_t energyMj);
+void metricsSensorBattery(const uint8_t *mac, uint32_t hours);
+void metricsSensorSamples(const uint8_t *mac, uint32_t samples);
+// Time from a sensor's wake to its first sample.
+void metricsSensorFirstSample(const uint8_t *mac, uint32_t durationMs);
+// Duration of a sensor's last search for the gateway's channel.
+void metricsSensorDiscovery(const uint8_t *mac, uint32_t durationMs);
+// A reading repeated by the gateway for a sensor that skipped sending
+// because nothing changed, and a sensor that went quiet for longer than its
+// heartbeat allows.
+void metricsReadingImplied(const uint8_t *mac);
+void metricsHeartbeatMissed(const uint8_t *mac);
+void metricsPublished(Integration integration, uint32_t latencyMs, bool success);
+void metricsPublishSkipped(Integration integration);
+// Wall-clock time from handing a reading to the publishers to the last of
+// them finishing with it, including time spent in their queues. With
+// publishers running in parallel this should track the slowest integration
+// rather than the sum of them.
+void metricsPublishRound(uint32_t latencyMs);
+void metricsBreakerState(Integration integration, int state);
+void metricsWifiReconnect();
+// A frame posted to /replay and only decoded, without being published.
+void metricsFrameReplayed();
+// Clients of the live dashboard, with an estimate of the heap each one takes,
+// clients turned away for being over the limit, and the time from a frame
+// arriving to its event being written to the clients.
+void metricsLiveClients(int clients, uint32_t heapPerClient);
+void metricsLiveRejected();
+void metricsLivePushed(uint32_t latencyMs);
+
+// Tasks and queues are registered once at startup and sampled on scrape.
+void metricsRegisterTask(const char *name, TaskHandle_t task);
+int metricsRegisterQueue(const char *name, QueueHandle_t queue, int capacity);
+void metricsQueueDropped(int queue);
+
+// Render all metrics in the Prometheus text exposition format.
+void metricsRender(String &out);
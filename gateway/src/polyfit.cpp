@@ -0,0 +1,108 @@
+#include "polyfit.h"
+
+// Uses Householder QR on the Vandermonde matrix, which unlike the normal
+// equations does not square its condition number.
+bool polyfitLeastSquares(const double *x, const double *y, int n, int degree, double *coefficients)
+{
+    const int m = degree + 1;
+    if (n < m || m > CALIBRATION_MAX_DEGREE + 1 || n > CALIBRATION_MAX_POINTS)
+    {
+        return false;
+    }
+
+    double a[CALIBRATION_MAX_POINTS][CALIBRATION_MAX_DEGREE + 1];
+    double b[CALIBRATION_MAX_POINTS];
+    double diagonal[CALIBRATION_MAX_DEGREE + 1];
+    for (int i = 0; i < n; i++)
+    {
+        double power = 1;
+        for (int j = 0; j < m; j++)
+        {
+            a[i][j] = power;
+            power *= x[i];
+        }
+        b[i] = y[i];
+    }
+
+    for (int k = 0; k < m; k++)
+    {
+        double norm = 0;
+        for (int i = k; i < n; i++)
+        {
+            norm += a[i][k] * a[i][k];
+        }
+        norm = sqrt(norm);
+        // Too few distinct tilts for this degree.
+        if (norm < 1e-9)
+        {
+            return false;
+        }
+
+        // Reflect column k onto alpha * e_k. The reflector v is kept in
+        // column k, below and on the diagonal.
+        double alpha = a[k][k] > 0 ? -norm : norm;
+        a[k][k] -= alpha;
+        double vv = 0;
+        for (int i = k; i < n; i++)
+        {
+            vv += a[i][k] * a[i][k];
+        }
+        for (int j = k + 1; j < m; j++)
+        {
+            double dot = 0;
+            for (int i = k; i < n; i++)
+            {
+                dot += a[i][k] * a[i][j];
+            }
+            double f = 2 * dot / vv;
+            for (int i = k; i < n; i++)
+            {
+                a[i][j] -= f * a[i][k];
+            }
+        }
+        double dot = 0;
+        for (int i = k; i < n; i++)
+        {
+            dot += a[i][k] * b[i];
+        }
+        double f = 2 * dot / vv;
+        for (int i = k; i < n; i++)
+        {
+            b[i] -= f * a[i][k];
+        }
+        diagonal[k] = alpha;
+    }
+
+    // Back substitution with R.
+    for (int k = m - 1; k >= 0; k--)
+    {
+        double sum = b[k];
+        for (int j = k + 1; j < m; j++)
+        {
+            sum -= a[k][j] * coefficients[j];
+        }
+        coefficients[k] = sum / diagonal[k];
+    }
+    return true;
+}
+
+void polyfitExpand(const CalibrationProfile &profile, double *out)
+{
+    // sum c_k ((t - center) / scale)^k, expanded term by term with the
+    // binomial theorem.
+    for (int i = 0; i <= CALIBRATION_MAX_DEGREE; i++)
+    {
+        out[i] = 0;
+    }
+    for (int k = 0; k <= profile.degree; k++)
+    {
+        double factor = profile.coefficients[k] / pow(profile.scale, k);
+        double binomial = 1;
+        for (int j = 0; j <= k; j++)
+        {
+            // Coefficient of t^j in (t - center)^k.
+            out[j] += factor * binomial * pow(-profile.center, k - j);
+            binomial = binomial * (k - j) / (j + 1);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <Arduino.h>
+#include "calibration.h"
+
+// The arithmetic behind calibration profiles, kept apart from their storage
+// so it also builds on the host, for the tests in the native environment.
+
+// Least squares fit of a polynomial of the given degree to n points, lowest
+// order coefficient first. Needs at least degree + 1 points, at distinct x,
+// and at most CALIBRATION_MAX_POINTS of them.
+bool polyfitLeastSquares(const double *x, const double *y, int n, int degree, double *coefficients);
+
+// A profile's polynomial, which is in (tilt - center) / scale, expanded into
+// plain powers of tilt, lowest order first. Fills CALIBRATION_MAX_DEGREE + 1
+// coefficients.
+void polyfitExpand(const CalibrationProfile &profile, double *out);
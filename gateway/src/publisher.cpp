@@ -0,0 +1,201 @@
+#include "publisher.h"
+#include "log.h"
+
+struct PublishRound
+{
+    uint32_t id;
+    unsigned long start;
+    int holders;
+    // Whether any publisher took the reading, rounds nobody took are not
+    // counted.
+    bool submitted;
+};
+
+static PublishRound rounds[PUBLISH_ROUNDS];
+static uint32_t nextRound = 1;
+static portMUX_TYPE roundsMux = portMUX_INITIALIZER_UNLOCKED;
+
+uint32_t publishRoundBegin()
+{
+    portENTER_CRITICAL(&roundsMux);
+    uint32_t id = nextRound++;
+    rounds[id % PUBLISH_ROUNDS] = {id, millis(), 1, false};
+    portEXIT_CRITICAL(&roundsMux);
+    return id;
+}
+
+// Taking a hold, or giving it back without counting the round. The publish
+// task holds the round itself until it has submitted to everyone, so giving
+// a hold back never ends it.
+static void publishRoundHold(uint32_t id, bool hold)
+{
+    portENTER_CRITICAL(&roundsMux);
+    PublishRound &round = rounds[id % PUBLISH_ROUNDS];
+    if (round.id == id)
+    {
+        round.holders += hold ? 1 : -1;
+    }
+    portEXIT_CRITICAL(&roundsMux);
+}
+
+static void publishRoundSubmitted(uint32_t id)
+{
+    portENTER_CRITICAL(&roundsMux);
+    PublishRound &round = rounds[id % PUBLISH_ROUNDS];
+    if (round.id == id)
+    {
+        round.submitted = true;
+    }
+    portEXIT_CRITICAL(&roundsMux);
+}
+
+void publishRoundRelease(uint32_t id)
+{
+    // Recorded inside the lock, which keeps the histogram to one writer at a
+    // time across the publisher tasks.
+    portENTER_CRITICAL(&roundsMux);
+    PublishRound &round = rounds[id % PUBLISH_ROUNDS];
+    if (round.id == id && --round.holders == 0 && round.submitted)
+    {
+        metricsPublishRound(millis() - round.start);
+    }
+    portEXIT_CRITICAL(&roundsMux);
+}
+
+Publisher::Publisher(Integration integration, PublisherTimeouts timeouts, uint32_t stackSize)
+    : timeouts(timeouts), id(integration), stackSize(stackSize), breaker(integrationName(integration))
+{
+}
+
+void Publisher::begin()
+{
+    queue = xQueueCreate(PUBLISHER_QUEUE_LENGTH, sizeof(Job));
+    queueMetric = metricsRegisterQueue(integrationName(id), queue, PUBLISHER_QUEUE_LENGTH);
+    TaskHandle_t task;
+    xTaskCreatePinnedToCore(taskEntry, integrationName(id), stackSize, this,
+                            PUBLISHER_TASK_PRIORITY, &task, PUBLISHER_TASK_CORE);
+    metricsRegisterTask(integrationName(id), task);
+}
+
+bool Publisher::submit(const Reading &reading, uint32_t round)
+{
+    // Held before queueing, the task may be done with the job right away.
+    publishRoundHold(round, true);
+    Job job = {reading, round};
+    if (xQueueSend(queue, &job, 0) == pdTRUE)
+    {
+        publishRoundSubmitted(round);
+        return true;
+    }
+    publishRoundHold(round, false);
+    metricsQueueDropped(queueMetric);
+    return false;
+}
+
+void Publisher::taskEntry(void *parameter)
+{
+    static_cast<Publisher *>(parameter)->run();
+}
+
+// One request upstream, unless the circuit breaker is open.
+bool Publisher::attempt(const Reading *readings, int count, bool batched)
+{
+    bool success = false;
+    if (breaker.allow(millis()))
+    {
+        unsigned long start = millis();
+        success = batched ? sendBatch(readings, count) : send(readings[0]);
+        metricsPublished(id, millis() - start, success);
+        breaker.record(success, millis());
+    }
+    else
+    {
+        metricsPublishSkipped(id);
+    }
+    metricsBreakerState(id, breaker.state());
+    return success;
+}
+
+void Publisher::hold(const Job &job)
+{
+    if (!batch)
+    {
+        batch = new Reading[PUBLISHER_BATCH_MAX];
+        batchRounds = new uint32_t[PUBLISHER_BATCH_MAX];
+    }
+    if (batchCount == PUBLISHER_BATCH_MAX)
+    {
+        // The upstream has been down for a while, let the oldest go.
+        if (batchRounds[0])
+        {
+            publishRoundRelease(batchRounds[0]);
+        }
+        memmove(batch, batch + 1, (batchCount - 1) * sizeof(Reading));
+        memmove(batchRounds, batchRounds + 1, (batchCount - 1) * sizeof(uint32_t));
+        batchCount--;
+        metricsQueueDropped(queueMetric);
+    }
+    if (batchCount == 0)
+    {
+        batchStart = millis();
+    }
+    batch[batchCount] = job.reading;
+    batchRounds[batchCount++] = job.round;
+}
+
+void Publisher::flush()
+{
+    bool success = attempt(batch, batchCount, true);
+    // A round ends with the first attempt at its reading, sent or not.
+    for (int i = 0; i < batchCount; i++)
+    {
+        if (batchRounds[i])
+        {
+            publishRoundRelease(batchRounds[i]);
+            batchRounds[i] = 0;
+        }
+    }
+    if (success)
+    {
+        batchCount = 0;
+    }
+    else
+    {
+        LOGD("%s: keeping %d readings for the next batch", integrationName(id), batchCount);
+        batchStart = millis();
+    }
+    batchFailed = !success;
+}
+
+void Publisher::run()
+{
+    Job job;
+    for (;;)
+    {
+        TickType_t wait = portMAX_DELAY;
+        if (batchCount > 0)
+        {
+            unsigned long waited = millis() - batchStart;
+            wait = waited < PUBLISHER_BATCH_WINDOW ? pdMS_TO_TICKS(PUBLISHER_BATCH_WINDOW - waited) : 0;
+        }
+        if (xQueueReceive(queue, &job, wait) == pdTRUE)
+        {
+            if (!batching())
+            {
+                attempt(&job.reading, 1, false);
+                publishRoundRelease(job.round);
+                continue;
+            }
+            hold(job);
+            if (batchFailed || batchCount < PUBLISHER_BATCH_SIZE)
+            {
+                continue;
+            }
+        }
+        else if (batchCount == 0 || millis() - batchStart < PUBLISHER_BATCH_WINDOW)
+        {
+            continue;
+        }
+        flush();
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <Arduino.h>
+#include "reading.h"
+#include "metrics.h"
+#include "breaker.h"
+#include "batch.h"
+
+#define PUBLISHER_QUEUE_LENGTH 8
+// Batching publishers collect readings for up to PUBLISHER_BATCH_WINDOW ms
+// after the first one, or until PUBLISHER_BATCH_SIZE are waiting, and then
+// send them in one request. Readings that could not be sent are kept for the
+// next request, up to PUBLISHER_BATCH_MAX, the oldest going first.
+#define PUBLISHER_BATCH_WINDOW 60000
+#define PUBLISHER_BATCH_SIZE 16
+#define PUBLISHER_BATCH_MAX BATCH_MAX_READINGS
+#define PUBLISHER_TASK_PRIORITY 2
+#define PUBLISHER_TASK_CORE 1
+// Rounds tracked at once. A round still pending when its slot comes around
+// again is forgotten and never counted.
+#define PUBLISH_ROUNDS 32
+
+// Connect and request timeouts for one upstream, in ms.
+struct PublisherTimeouts
+{
+    uint32_t connect;
+    uint32_t request;
+};
+
+// One integration. Every publisher runs in its own task with its own queue,
+// so a hanging upstream only ever delays its own readings.
+class Publisher
+{
+public:
+    Publisher(Integration integration, PublisherTimeouts timeouts, uint32_t stackSize);
+    virtual ~Publisher() {}
+
+    // Whether the integration is configured at all.
+    virtual bool enabled() = 0;
+
+    void begin();
+
+    // Queue a reading without blocking, as part of the given round. Returns
+    // false if the reading could not be queued.
+    bool submit(const Reading &reading, uint32_t round);
+
+    Integration integration() const { return id; }
+    BreakerState breakerState() const { return breaker.state(); }
+
+protected:
+    // Send one reading upstream, honouring the timeouts. Runs in the
+    // publisher's own task.
+    virtual bool send(const Reading &reading) = 0;
+
+    // Publishers that can send several readings in one request return true
+    // here, and then get their readings collected into batches of up to
+    // PUBLISHER_BATCH_MAX in sendBatch() instead. A batch counts as a single
+    // request for metrics and the circuit breaker, and stays until it is
+    // accepted.
+    virtual bool batching() { return false; }
+    virtual bool sendBatch(const Reading *readings, int count) { return false; }
+
+    const PublisherTimeouts timeouts;
+
+private:
+    struct Job
+    {
+        Reading reading;
+        uint32_t round;
+    };
+
+    static void taskEntry(void *parameter);
+    void run();
+    bool attempt(const Reading *readings, int count, bool batched);
+    void hold(const Job &job);
+    void flush();
+
+    const Integration id;
+    const uint32_t stackSize;
+    // The readings waiting to be sent as a batch, and the rounds they belong
+    // to, 0 once released. Allocated on first use, only used by the
+    // publisher's task.
+    Reading *batch = nullptr;
+    uint32_t *batchRounds = nullptr;
+    int batchCount = 0;
+    unsigned long batchStart = 0;
+    // The last attempt failed, so only the window ends the wait for the next.
+    bool batchFailed = false;
+    QueueHandle_t queue = nullptr;
+    int queueMetric = -1;
+    CircuitBreaker breaker;
+};
+
+// A round is one reading handed to every enabled publisher. It starts when
+// publishing begins, every publisher that queues the reading holds on to it
+// until done, and whoever lets go last records the time since the start with
+// metricsPublishRound(). Rounds never wait on each other.
+uint32_t publishRoundBegin();
+// Let go of a round. The publish task calls this once it has submitted the
+// reading to every publisher.
+void publishRoundRelease(uint32_t round);
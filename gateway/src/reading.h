@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+#include "analytics.h"
+
+// Frame sent by the sensor. This must match DataStruct in the sensor firmware.
+// Fields after interval were added later and older sensors leave them out,
+// so frames are accepted from DATA_STRUCT_MIN_SIZE bytes and missing fields
+// read as zero. New fields go at the end.
+struct __attribute__((packed)) DataStruct
+{
+    float tilt;
+    float temp;
+    int volt;
+    long interval;
+    // Duration and estimated energy of the last firmware update, sent once
+    // on the first wake after it.
+    uint32_t otaMillis;
+    uint32_t otaEnergy; // mJ
+    uint32_t batteryHours; // Estimated remaining runtime, 0 if unknown.
+    // The sensor skips sending while its reading is unchanged, but sends at
+    // least every this many wakes. 0 for sensors that send on every wake.
+    uint32_t heartbeatWakes;
+    uint32_t samples; // Tilt samples the sensor averaged, more when it moves.
+    uint32_t disturbed; // Samples it discarded because it was being moved.
+    uint32_t seq; // Counts up per frame, for dropping relayed duplicates.
+    // Time and frames the sensor spent searching channels for a gateway,
+    // sent once after each search.
+    uint32_t discoveryMillis;
+    uint32_t discoveryProbes;
+    uint32_t rfCalibrated; // The sensor did a full RF calibration this wake.
+    uint32_t firstSampleMillis; // Time from wake to the first MPU sample.
+    uint32_t mpuConfigured; // The MPU had lost its configuration and was set up again.
+    // Time the sensor waited to be flipped into calibration mode after a
+    // reset, sent once after each wait.
+    uint32_t flipWaitMillis;
+};
+
+#define DATA_STRUCT_MIN_SIZE offsetof(DataStruct, otaMillis)
+
+// A decoded frame together with the sender and calculated gravity.
+// Readings are passed between tasks by value through FreeRTOS queues.
+struct Reading
+{
+    uint8_t sensorId[6];
+    DataStruct data;
+    float gravity;
+    // Repeated by the gateway for a wake where the sensor did not send.
+    bool implied;
+    // Gateway uptime when the frame arrived, which keeps counting without
+    // a clock. Turned into wall time when the reading is stored or published.
+    int64_t receivedMs;
+    Analytics analytics;
+};
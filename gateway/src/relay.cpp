@@ -0,0 +1,89 @@
+#include "relay.h"
+#include "log.h"
+
+struct SeenEntry
+{
+    uint8_t mac[6];
+    uint32_t seq[RELAY_SEEN_DEPTH];
+    uint8_t next;
+};
+
+// Radio task only.
+static SeenEntry seen[RELAY_MAX_SENSORS];
+static int seenCount = 0;
+
+static const uint8_t broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+void relayForward(const uint8_t *sensor, int8_t rssi, uint8_t hops, const uint8_t *data, int len)
+{
+    if (hops >= RELAY_MAX_HOPS || len > (int)sizeof(RelayFrame::data))
+    {
+        return;
+    }
+
+    if (!esp_now_is_peer_exist(broadcastMac))
+    {
+        esp_now_peer_info_t peer = {};
+        memcpy(peer.peer_addr, broadcastMac, 6);
+        peer.channel = 0; // Whatever channel we are on.
+        peer.ifidx = WIFI_IF_STA;
+        peer.encrypt = false;
+        if (esp_now_add_peer(&peer) != ESP_OK)
+        {
+            LOGW("Could not add broadcast peer");
+            return;
+        }
+    }
+
+    RelayFrame frame;
+    frame.magic = RELAY_MAGIC;
+    frame.hops = hops + 1;
+    memcpy(frame.sensor, sensor, 6);
+    frame.rssi = rssi;
+    memcpy(frame.data, data, len);
+    for (int i = 0; i < RELAY_REPEATS; i++)
+    {
+        if (esp_now_send(broadcastMac, (const uint8_t *)&frame, RELAY_HEADER_SIZE + len) != ESP_OK)
+        {
+            LOGW("Could not relay frame");
+            return;
+        }
+    }
+}
+
+bool relaySeen(const uint8_t *sensor, uint32_t seq)
+{
+    if (seq == 0)
+    {
+        return false;
+    }
+
+    SeenEntry *entry = nullptr;
+    for (int i = 0; i < seenCount; i++)
+    {
+        if (memcmp(seen[i].mac, sensor, 6) == 0)
+        {
+            entry = &seen[i];
+            break;
+        }
+    }
+    if (!entry)
+    {
+        // Take over the first slot when full, at worst letting a duplicate
+        // through.
+        entry = &seen[seenCount < RELAY_MAX_SENSORS ? seenCount++ : 0];
+        memset(entry, 0, sizeof(SeenEntry));
+        memcpy(entry->mac, sensor, 6);
+    }
+
+    for (int i = 0; i < RELAY_SEEN_DEPTH; i++)
+    {
+        if (entry->seq[i] == seq)
+        {
+            return true;
+        }
+    }
+    entry->seq[entry->next] = seq;
+    entry->next = (entry->next + 1) % RELAY_SEEN_DEPTH;
+    return false;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_now.h>
+
+// Relaying sensor frames between gateways, for sensors out of range of the
+// gateway that publishes.
+//
+// A gateway in relay mode forwards every sensor frame it hears, wrapped with
+// the sensor's MAC and the RSSI it was heard with, as an ESP-NOW broadcast.
+// Relays share the sensors' gateway MAC, so broadcasting is the one way to
+// reach the next hop. Every gateway unwraps relayed frames as if it heard
+// the sensor itself, and relays forward them again until RELAY_MAX_HOPS.
+// Since a frame can arrive directly and through any number of relays, each
+// gateway drops frames whose (sensor MAC, sequence number) it has already
+// seen.
+
+#define RELAY_MAX_HOPS 3
+#define RELAY_MAX_SENSORS 32
+// Sequence numbers remembered per sensor.
+#define RELAY_SEEN_DEPTH 4
+
+// Broadcasts are not acknowledged, so each is sent this many times.
+#define RELAY_REPEATS 2
+
+// Marks a relayed frame. Read as the tilt float of a sensor frame it is far
+// outside any possible angle, so the two cannot be confused.
+#define RELAY_MAGIC 0x594C5254 // "TRLY"
+
+struct __attribute__((packed)) RelayFrame
+{
+    uint32_t magic;
+    uint8_t hops; // Relays the frame went through.
+    uint8_t sensor[6];
+    int8_t rssi; // As heard by the first relay.
+    uint8_t data[ESP_NOW_MAX_DATA_LEN - 12];
+};
+
+#define RELAY_HEADER_SIZE offsetof(RelayFrame, data)
+
+// Forward a sensor frame, heard directly (hops 0) or through relays.
+// Radio task only.
+void relayForward(const uint8_t *sensor, int8_t rssi, uint8_t hops, const uint8_t *data, int len);
+
+// Whether this sequence number was already seen from the sensor, remembering
+// it if not. Sequence number 0 is never a duplicate, older sensors send no
+// sequence number. Radio task only.
+bool relaySeen(const uint8_t *sensor, uint32_t seq);
@@ -0,0 +1,261 @@
+#include "sensorota.h"
+#include <LittleFS.h>
+#include <MD5Builder.h>
+#include "log.h"
+
+#define SENSOR_OTA_DIR "/sensor"
+#define SENSOR_OTA_IMAGE SENSOR_OTA_DIR "/firmware.bin"
+#define SENSOR_OTA_UPLOAD SENSOR_OTA_DIR "/firmware.tmp"
+#define SENSOR_OTA_MD5 SENSOR_OTA_DIR "/firmware.md5"
+
+#define SENSOR_OTA_PATCH_FORMAT SENSOR_OTA_DIR "/p%08x.bin"
+
+// First byte of every ESP8266 application image.
+#define ESP8266_IMAGE_MAGIC 0xE9
+
+#define PATCH_MAGIC "TDP1"
+#define PATCH_VERSION_LEN 40
+
+// This must match the header written by tools/sensorpatch.
+struct __attribute__((packed)) PatchHeader
+{
+    char magic[4];
+    char fromVersion[PATCH_VERSION_LEN];
+    char toVersion[PATCH_VERSION_LEN];
+    uint32_t oldSize;
+    char oldMd5[32];
+    uint32_t newSize;
+    char newMd5[32];
+};
+
+// Only touched by the web server, which runs in the loop task.
+static char md5[33] = "";
+static File upload;
+static MD5Builder uploadMd5;
+static size_t uploadSize = 0;
+static bool uploadPatch = false;
+
+static volatile unsigned long apRequested = 0;
+static volatile bool apEverRequested = false;
+
+void sensorOtaBegin()
+{
+    if (!LittleFS.exists(SENSOR_OTA_DIR))
+    {
+        LittleFS.mkdir(SENSOR_OTA_DIR);
+    }
+    if (!LittleFS.exists(SENSOR_OTA_IMAGE) || !LittleFS.exists(SENSOR_OTA_MD5))
+    {
+        return;
+    }
+    File file = LittleFS.open(SENSOR_OTA_MD5, "r");
+    if (file && file.readBytes(md5, 32) == 32)
+    {
+        md5[32] = '\0';
+        LOGI("Sensor firmware available, MD5 %s", md5);
+    }
+    else
+    {
+        md5[0] = '\0';
+    }
+    file.close();
+}
+
+bool sensorOtaAvailable()
+{
+    return md5[0] != '\0';
+}
+
+const char *sensorOtaMd5()
+{
+    return md5;
+}
+
+File sensorOtaOpen()
+{
+    return LittleFS.open(SENSOR_OTA_IMAGE, "r");
+}
+
+// Patches are named after a hash of the version they update from, since
+// version strings are too long for LittleFS names.
+static void patchPath(const char *fromVersion, char *path, size_t size)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (int i = 0; i < PATCH_VERSION_LEN && fromVersion[i]; i++)
+    {
+        hash = (hash ^ (uint8_t)fromVersion[i]) * 16777619u;
+    }
+    snprintf(path, size, SENSOR_OTA_PATCH_FORMAT, hash);
+}
+
+static bool readPatchHeader(File &file, PatchHeader &header)
+{
+    return file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+           memcmp(header.magic, PATCH_MAGIC, 4) == 0;
+}
+
+File sensorOtaOpenPatch(const String &fromVersion)
+{
+    char name[PATCH_VERSION_LEN] = "";
+    strncpy(name, fromVersion.c_str(), sizeof(name));
+    char path[32];
+    patchPath(name, path, sizeof(path));
+    if (!sensorOtaAvailable() || !LittleFS.exists(path))
+    {
+        return File();
+    }
+
+    File file = LittleFS.open(path, "r");
+    PatchHeader header;
+    if (!file || !readPatchHeader(file, header) ||
+        strncmp(header.fromVersion, name, PATCH_VERSION_LEN) != 0 ||
+        memcmp(header.newMd5, md5, 32) != 0)
+    {
+        file.close();
+        return File();
+    }
+    file.seek(0);
+    return file;
+}
+
+static void removePatches()
+{
+    File dir = LittleFS.open(SENSOR_OTA_DIR);
+    String path;
+    while ((path = dir.getNextFileName()).length() > 0)
+    {
+        if (path.substring(path.lastIndexOf('/') + 1).startsWith("p"))
+        {
+            LittleFS.remove(path);
+        }
+    }
+    dir.close();
+}
+
+bool sensorOtaUploadStart(bool patch)
+{
+    uploadPatch = patch;
+    upload = LittleFS.open(SENSOR_OTA_UPLOAD, "w");
+    uploadMd5.begin();
+    uploadSize = 0;
+    return (bool)upload;
+}
+
+bool sensorOtaUploadWrite(const uint8_t *data, size_t len)
+{
+    if (!upload)
+    {
+        return false;
+    }
+    bool valid = uploadPatch ? len >= 4 && memcmp(data, PATCH_MAGIC, 4) == 0
+                             : len > 0 && data[0] == ESP8266_IMAGE_MAGIC;
+    if (uploadSize == 0 && !valid)
+    {
+        LOGW("Upload is not a sensor %s", uploadPatch ? "patch" : "image");
+        sensorOtaUploadAbort();
+        return false;
+    }
+    if (upload.write(data, len) != len)
+    {
+        LOGW("Could not store sensor firmware, filesystem full?");
+        sensorOtaUploadAbort();
+        return false;
+    }
+    uploadMd5.add(data, len);
+    uploadSize += len;
+    return true;
+}
+
+// Keep an uploaded patch if it leads to the stored image.
+static bool storePatch()
+{
+    File file = LittleFS.open(SENSOR_OTA_UPLOAD, "r");
+    PatchHeader header;
+    bool valid = file && readPatchHeader(file, header);
+    file.close();
+    if (!valid || !sensorOtaAvailable() || memcmp(header.newMd5, md5, 32) != 0)
+    {
+        LOGW("Patch does not lead to the stored sensor firmware");
+        LittleFS.remove(SENSOR_OTA_UPLOAD);
+        return false;
+    }
+
+    char path[32];
+    patchPath(header.fromVersion, path, sizeof(path));
+    LittleFS.remove(path);
+    if (!LittleFS.rename(SENSOR_OTA_UPLOAD, path))
+    {
+        return false;
+    }
+    char fromVersion[PATCH_VERSION_LEN + 1] = "";
+    strncat(fromVersion, header.fromVersion, PATCH_VERSION_LEN);
+    LOGI("Stored sensor patch from %s, %u bytes", fromVersion, uploadSize);
+    return true;
+}
+
+bool sensorOtaUploadEnd()
+{
+    if (!upload || uploadSize == 0)
+    {
+        sensorOtaUploadAbort();
+        return false;
+    }
+    upload.close();
+    if (uploadPatch)
+    {
+        return storePatch();
+    }
+    uploadMd5.calculate();
+
+    // Invalidate first, so a reboot halfway leaves no image rather than an
+    // image with the wrong MD5.
+    md5[0] = '\0';
+    LittleFS.remove(SENSOR_OTA_MD5);
+    LittleFS.remove(SENSOR_OTA_IMAGE);
+    if (!LittleFS.rename(SENSOR_OTA_UPLOAD, SENSOR_OTA_IMAGE))
+    {
+        return false;
+    }
+    File file = LittleFS.open(SENSOR_OTA_MD5, "w");
+    if (!file)
+    {
+        return false;
+    }
+    file.print(uploadMd5.toString());
+    file.close();
+
+    uploadMd5.getChars(md5);
+    removePatches();
+    LOGI("Stored sensor firmware, %u bytes, MD5 %s", uploadSize, md5);
+    return true;
+}
+
+void sensorOtaUploadAbort()
+{
+    if (upload)
+    {
+        upload.close();
+    }
+    LittleFS.remove(SENSOR_OTA_UPLOAD);
+    uploadSize = 0;
+}
+
+void sensorOtaRequestAp()
+{
+    apRequested = millis();
+    apEverRequested = true;
+}
+
+uint32_t sensorOtaApIdle()
+{
+    if (!apEverRequested)
+    {
+        return UINT32_MAX;
+    }
+    return millis() - apRequested;
+}
+
+void sensorOtaCancelAp()
+{
+    apEverRequested = false;
+}
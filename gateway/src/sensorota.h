@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FS.h>
+
+// Sensor firmware kept on the gateway's LittleFS and served to sensors over a
+// short-lived soft AP, speaking the protocol of ESP8266httpUpdate: the sensor
+// sends the MD5 of its running sketch, and gets either 304 or the image with
+// its MD5 in the x-MD5 header, which the updater checks before switching to
+// the new image.
+//
+// Next to the full image the gateway keeps delta patches made with
+// tools/sensorpatch, one per firmware version they update from. A patch is
+// only served while the full image it produces is the stored one, so
+// uploading a new image drops all patches.
+//
+// The soft AP is only brought up once a sensor has been sent an OTA command,
+// and taken down again after SENSOR_OTA_AP_TIMEOUT without requests.
+
+#define SENSOR_OTA_AP_TIMEOUT 120000
+
+// Load the stored image's MD5. Call after tsBegin() has mounted LittleFS.
+void sensorOtaBegin();
+
+bool sensorOtaAvailable();
+const char *sensorOtaMd5();
+File sensorOtaOpen();
+// Open the patch from the given versionTimestamp to the stored image, if any.
+File sensorOtaOpenPatch(const String &fromVersion);
+
+// Storing an image or patch from a web upload. A new image only replaces the
+// old one once it has been written completely.
+bool sensorOtaUploadStart(bool patch);
+bool sensorOtaUploadWrite(const uint8_t *data, size_t len);
+bool sensorOtaUploadEnd();
+void sensorOtaUploadAbort();
+
+// Ask for the soft AP, from any task. Also keeps an open AP from timing out.
+void sensorOtaRequestAp();
+// Milliseconds since the AP was last requested, or UINT32_MAX if never.
+uint32_t sensorOtaApIdle();
+// Forget a request for the AP that cannot be served.
+void sensorOtaCancelAp();
@@ -0,0 +1,52 @@
+#include "slots.h"
+#include "log.h"
+
+// Radio task only. A sensor's slot is its index.
+static uint8_t slots[SLOT_MAX_SENSORS][6];
+static int slotCount = 0;
+static bool slotsFull = false;
+
+static int findSlot(const uint8_t *mac)
+{
+    for (int i = 0; i < slotCount; i++)
+    {
+        if (memcmp(slots[i], mac, 6) == 0)
+        {
+            return i;
+        }
+    }
+    if (slotCount >= SLOT_MAX_SENSORS)
+    {
+        if (!slotsFull)
+        {
+            LOGW("All %d transmit slots taken, new sensors are left alone", SLOT_MAX_SENSORS);
+            slotsFull = true;
+        }
+        return -1;
+    }
+    memcpy(slots[slotCount], mac, 6);
+    return slotCount++;
+}
+
+int32_t slotCorrection(const uint8_t *mac, uint32_t interval, int64_t receivedMs)
+{
+    int slot = findSlot(mac);
+    if (slot < 0 || interval == 0)
+    {
+        return 0;
+    }
+
+    // Slots wrap around in intervals too short to hold them all.
+    int64_t period = (int64_t)interval * 1000;
+    int64_t correction = ((int64_t)slot * SLOT_WIDTH) % period - receivedMs % period;
+    // Take the shorter way round.
+    if (correction > period / 2)
+    {
+        correction -= period;
+    }
+    else if (correction <= -period / 2)
+    {
+        correction += period;
+    }
+    return (correction > -SLOT_TOLERANCE && correction < SLOT_TOLERANCE) ? 0 : (int32_t)correction;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Transmit slots. Sensors wake on their own timers, which drift, so with
+// enough of them their frames end up colliding now and then. The gateway
+// gives every sensor a slot of SLOT_WIDTH ms, in the order it first hears
+// them, and wants each sensor's frames at its slot's offset into the
+// sensor's interval. Along with any commands, the sensor is told how far off
+// each frame was and moves its next wake by that much.
+//
+// Slots are kept in RAM only, so after a restart the gateway hands them out
+// again and sensors move once.
+
+#define SLOT_WIDTH 2000
+// Every slot of the sensors' default interval of 30 minutes can be handed
+// out. More sensors than that would not fit in the interval without sharing
+// slots, and later ones are left alone.
+#define SLOT_INTERVAL 1800
+#define SLOT_MAX_SENSORS (SLOT_INTERVAL * 1000 / SLOT_WIDTH)
+// Frames this close to their slot need no correction.
+#define SLOT_TOLERANCE 250
+
+// Milliseconds the sensor should move its next wake by, for a frame received
+// at receivedMs (gateway uptime) from a sensor that wakes every interval
+// seconds. 0 if it is on time. Radio task only.
+int32_t slotCorrection(const uint8_t *mac, uint32_t interval, int64_t receivedMs);
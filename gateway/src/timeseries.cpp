@@ -0,0 +1,591 @@
+#include "timeseries.h"
+#include <LittleFS.h>
+#include "log.h"
+#include "tscodec.h"
+
+#define TS_ROOT "/ts"
+#define TS_STATE_MAGIC 0x54530001
+
+#define SECONDS_PER_HOUR 3600
+#define SECONDS_PER_DAY 86400
+
+struct __attribute__((packed)) BlockHeader
+{
+    uint32_t firstTime;
+    uint32_t lastTime;
+    int32_t firstGravity;
+    int32_t firstTemp;
+    uint16_t bytes;
+    uint8_t count;
+};
+
+struct Accumulator
+{
+    uint32_t start;
+    uint16_t count;
+    int16_t gravityMin;
+    int16_t gravityMax;
+    int32_t gravitySum;
+    int32_t tempSum;
+};
+
+// Everything needed to keep appending after a reboot, saved on every append.
+struct SeriesState
+{
+    uint32_t magic;
+    BlockHeader header;
+    uint16_t bitPos;
+    uint32_t prevTime;
+    int32_t prevDelta;
+    int32_t prevGravity;
+    int32_t prevTemp;
+    Accumulator hour;
+    Accumulator day;
+    uint8_t data[TS_BLOCK_BYTES];
+};
+
+static SemaphoreHandle_t tsMutex;
+
+// Scratch space, only touched with tsMutex held.
+static SeriesState state;
+static uint8_t blockData[TS_BLOCK_BYTES];
+static double bucketTime[TS_MAX_QUERY_POINTS];
+static double bucketGravity[TS_MAX_QUERY_POINTS];
+static uint32_t bucketCount[TS_MAX_QUERY_POINTS];
+static int16_t nextBucket[TS_MAX_QUERY_POINTS];
+
+//------------------------------------------------------------
+// Files
+
+// Opening a missing file logs an error in the core, so check first.
+static File openForRead(const char *path)
+{
+    if (!LittleFS.exists(path))
+    {
+        return File();
+    }
+    return LittleFS.open(path, "r");
+}
+
+static void seriesPath(const uint8_t *mac, const char *file, char *path, size_t size)
+{
+    snprintf(path, size, TS_ROOT "/%02x%02x%02x%02x%02x%02x%s%s",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], file[0] ? "/" : "", file);
+}
+
+static bool loadState(const uint8_t *mac)
+{
+    char path[40];
+    seriesPath(mac, "open.bin", path, sizeof(path));
+    File file = openForRead(path);
+    bool valid = file && file.read((uint8_t *)&state, sizeof(state)) == sizeof(state) && state.magic == TS_STATE_MAGIC;
+    if (file)
+    {
+        file.close();
+    }
+    if (!valid)
+    {
+        memset(&state, 0, sizeof(state));
+        state.magic = TS_STATE_MAGIC;
+    }
+    return valid;
+}
+
+static bool saveState(const uint8_t *mac)
+{
+    char path[40];
+    seriesPath(mac, "", path, sizeof(path));
+    if (!LittleFS.exists(path))
+    {
+        LittleFS.mkdir(path);
+    }
+    seriesPath(mac, "open.bin", path, sizeof(path));
+    File file = LittleFS.open(path, "w");
+    if (!file)
+    {
+        return false;
+    }
+    bool ok = file.write((const uint8_t *)&state, sizeof(state)) == sizeof(state);
+    file.close();
+    return ok;
+}
+
+// Drop everything before offset by copying the rest to a new file.
+static void dropHead(const char *path, size_t offset)
+{
+    char tmpPath[44];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    File src = openForRead(path);
+    File dst = LittleFS.open(tmpPath, "w");
+    if (!src || !dst)
+    {
+        return;
+    }
+    src.seek(offset);
+    uint8_t buffer[128];
+    size_t n;
+    while ((n = src.read(buffer, sizeof(buffer))) > 0)
+    {
+        dst.write(buffer, n);
+    }
+    src.close();
+    dst.close();
+    LittleFS.remove(path);
+    LittleFS.rename(tmpPath, path);
+}
+
+// Keep block files under their limit by dropping whole blocks, oldest first,
+// down to three quarters of the limit so this does not run on every append.
+static void trimBlocks(const char *path, size_t limit)
+{
+    File file = openForRead(path);
+    if (!file)
+    {
+        return;
+    }
+    size_t size = file.size();
+    if (size <= limit)
+    {
+        file.close();
+        return;
+    }
+    size_t offset = 0;
+    BlockHeader header;
+    while (size - offset > limit * 3 / 4 && file.read((uint8_t *)&header, sizeof(header)) == sizeof(header))
+    {
+        offset += sizeof(header) + header.bytes;
+        file.seek(offset);
+    }
+    file.close();
+    dropHead(path, offset);
+}
+
+static void trimRecords(const char *path, size_t recordSize, size_t limit)
+{
+    File file = openForRead(path);
+    if (!file)
+    {
+        return;
+    }
+    size_t size = file.size();
+    file.close();
+    if (size <= limit)
+    {
+        return;
+    }
+    size_t keep = (limit * 3 / 4) / recordSize * recordSize;
+    dropHead(path, size - keep);
+}
+
+//------------------------------------------------------------
+// Writing
+
+static void accumulate(Accumulator &acc, int32_t gravity, int32_t temp)
+{
+    if (acc.count == 0 || gravity < acc.gravityMin)
+    {
+        acc.gravityMin = gravity;
+    }
+    if (acc.count == 0 || gravity > acc.gravityMax)
+    {
+        acc.gravityMax = gravity;
+    }
+    acc.gravitySum += gravity;
+    acc.tempSum += temp;
+    acc.count++;
+}
+
+// Close the aggregate for the previous period once a reading from a new
+// period arrives, then add the reading.
+static void rollup(const uint8_t *mac, const char *file, Accumulator &acc, uint32_t periodStart,
+                   int32_t gravity, int32_t temp, size_t limit)
+{
+    if (acc.count > 0 && acc.start != periodStart)
+    {
+        TsAggregate aggregate;
+        aggregate.start = acc.start;
+        aggregate.count = acc.count;
+        aggregate.gravityMin = acc.gravityMin;
+        aggregate.gravityMax = acc.gravityMax;
+        aggregate.gravityMean = acc.gravitySum / acc.count;
+        aggregate.tempMean = acc.tempSum / acc.count;
+
+        char path[40];
+        seriesPath(mac, file, path, sizeof(path));
+        File out = LittleFS.open(path, "a");
+        if (out)
+        {
+            out.write((const uint8_t *)&aggregate, sizeof(aggregate));
+            out.close();
+        }
+        trimRecords(path, sizeof(TsAggregate), limit);
+        memset(&acc, 0, sizeof(acc));
+    }
+    if (acc.count == 0)
+    {
+        acc.start = periodStart;
+    }
+    accumulate(acc, gravity, temp);
+}
+
+static void flushBlock(const uint8_t *mac)
+{
+    char path[40];
+    seriesPath(mac, "raw.bin", path, sizeof(path));
+    File out = LittleFS.open(path, "a");
+    if (out)
+    {
+        out.write((const uint8_t *)&state.header, sizeof(state.header));
+        out.write(state.data, state.header.bytes);
+        out.close();
+    }
+    trimBlocks(path, TS_RAW_MAX_BYTES);
+    state.header.count = 0;
+}
+
+bool tsBegin()
+{
+    tsMutex = xSemaphoreCreateMutex();
+    if (!LittleFS.begin(true))
+    {
+        LOGE("LittleFS mount failed, history is not kept");
+        return false;
+    }
+    if (!LittleFS.exists(TS_ROOT))
+    {
+        LittleFS.mkdir(TS_ROOT);
+    }
+    LOGI("LittleFS: %u of %u bytes used", LittleFS.usedBytes(), LittleFS.totalBytes());
+    return true;
+}
+
+bool tsAppend(const uint8_t *mac, uint32_t time, float gravity, float temp)
+{
+    int32_t g = lroundf(gravity * TS_GRAVITY_SCALE);
+    int32_t t = lroundf(temp * TS_TEMP_SCALE);
+
+    xSemaphoreTake(tsMutex, portMAX_DELAY);
+
+    loadState(mac);
+
+    // Blocks and aggregates are only ever appended, so a clock that jumped
+    // backwards would break the ordering queries rely on.
+    if (state.header.count > 0 && time < state.prevTime)
+    {
+        xSemaphoreGive(tsMutex);
+        LOGW("Dropping reading from before the last stored one");
+        return false;
+    }
+
+    rollup(mac, "hourly.bin", state.hour, time - time % SECONDS_PER_HOUR, g, t, TS_HOURLY_MAX_BYTES);
+    rollup(mac, "daily.bin", state.day, time - time % SECONDS_PER_DAY, g, t, TS_DAILY_MAX_BYTES);
+
+    if (state.header.count > 0 &&
+        (state.bitPos + TS_MAX_POINT_BITS > TS_BLOCK_BYTES * 8 || state.header.count == UINT8_MAX))
+    {
+        flushBlock(mac);
+    }
+
+    if (state.header.count == 0)
+    {
+        state.header.firstTime = time;
+        state.header.firstGravity = g;
+        state.header.firstTemp = t;
+        state.bitPos = 0;
+        state.prevDelta = 0;
+        memset(state.data, 0, sizeof(state.data));
+    }
+    else
+    {
+        int32_t delta = (int32_t)(time - state.prevTime);
+        tsEncodeTimestamp(state.data, state.bitPos, delta - state.prevDelta);
+        tsEncodeValue(state.data, state.bitPos, g - state.prevGravity);
+        tsEncodeValue(state.data, state.bitPos, t - state.prevTemp);
+        state.prevDelta = delta;
+    }
+
+    state.prevTime = time;
+    state.prevGravity = g;
+    state.prevTemp = t;
+    state.header.lastTime = time;
+    state.header.count++;
+    state.header.bytes = (state.bitPos + 7) / 8;
+
+    bool ok = saveState(mac);
+
+    xSemaphoreGive(tsMutex);
+    return ok;
+}
+
+//------------------------------------------------------------
+// Reading
+
+template <typename Visitor>
+static void visitBlock(const BlockHeader &header, const uint8_t *data, uint32_t from, uint32_t to, Visitor &visit)
+{
+    uint32_t time = header.firstTime;
+    int32_t gravity = header.firstGravity;
+    int32_t temp = header.firstTemp;
+    int32_t delta = 0;
+    uint16_t pos = 0;
+
+    for (int i = 0; i < header.count; i++)
+    {
+        if (i > 0)
+        {
+            delta += tsDecodeTimestamp(data, pos);
+            time += delta;
+            gravity += tsDecodeValue(data, pos);
+            temp += tsDecodeValue(data, pos);
+        }
+        if (time >= from && time <= to)
+        {
+            visit(time, gravity, temp);
+        }
+    }
+}
+
+// Aggregates stand in for raw readings from before the next finer level
+// starts, plotted at the middle of their period.
+template <typename Visitor>
+static void visitAggregates(const char *path, uint32_t period, uint32_t until, uint32_t from, uint32_t to, Visitor &visit)
+{
+    File file = openForRead(path);
+    if (!file)
+    {
+        return;
+    }
+    TsAggregate aggregate;
+    while (file.read((uint8_t *)&aggregate, sizeof(aggregate)) == sizeof(aggregate))
+    {
+        if (aggregate.start + period > until)
+        {
+            break;
+        }
+        uint32_t time = aggregate.start + period / 2;
+        if (time >= from && time <= to)
+        {
+            visit(time, aggregate.gravityMean, aggregate.tempMean);
+        }
+    }
+    file.close();
+}
+
+static uint32_t firstAggregateStart(const char *path, uint32_t otherwise)
+{
+    File file = openForRead(path);
+    if (!file)
+    {
+        return otherwise;
+    }
+    TsAggregate aggregate;
+    uint32_t start = otherwise;
+    if (file.read((uint8_t *)&aggregate, sizeof(aggregate)) == sizeof(aggregate))
+    {
+        start = aggregate.start;
+    }
+    file.close();
+    return start;
+}
+
+// Call visit(time, gravity, temp) for every stored point in [from, to],
+// oldest first. Expects the sensor's state to be loaded.
+template <typename Visitor>
+static void forEachPoint(const uint8_t *mac, uint32_t from, uint32_t to, Visitor visit)
+{
+    char rawPath[40], hourlyPath[40], dailyPath[40];
+    seriesPath(mac, "raw.bin", rawPath, sizeof(rawPath));
+    seriesPath(mac, "hourly.bin", hourlyPath, sizeof(hourlyPath));
+    seriesPath(mac, "daily.bin", dailyPath, sizeof(dailyPath));
+
+    uint32_t rawStart = state.header.count > 0 ? state.header.firstTime : UINT32_MAX;
+    File raw = openForRead(rawPath);
+    BlockHeader header;
+    if (raw && raw.read((uint8_t *)&header, sizeof(header)) == sizeof(header))
+    {
+        rawStart = header.firstTime;
+        raw.seek(0);
+    }
+    uint32_t hourlyStart = firstAggregateStart(hourlyPath, rawStart);
+
+    // Raw blocks can reach back further than the trimmed hourly file, so
+    // daily aggregates stop at whichever finer level starts first.
+    visitAggregates(dailyPath, SECONDS_PER_DAY, min(hourlyStart, rawStart), from, to, visit);
+    visitAggregates(hourlyPath, SECONDS_PER_HOUR, rawStart, from, to, visit);
+
+    if (raw)
+    {
+        while (raw.read((uint8_t *)&header, sizeof(header)) == sizeof(header))
+        {
+            if (header.lastTime < from || header.firstTime > to || header.bytes > TS_BLOCK_BYTES)
+            {
+                raw.seek(raw.position() + header.bytes);
+                continue;
+            }
+            if (raw.read(blockData, header.bytes) != header.bytes)
+            {
+                break;
+            }
+            visitBlock(header, blockData, from, to, visit);
+        }
+        raw.close();
+    }
+
+    if (state.header.count > 0)
+    {
+        visitBlock(state.header, state.data, from, to, visit);
+    }
+}
+
+static TsPoint toPoint(uint32_t time, int32_t gravity, int32_t temp)
+{
+    TsPoint point;
+    point.time = time;
+    point.gravity = (float)gravity / TS_GRAVITY_SCALE;
+    point.temp = (float)temp / TS_TEMP_SCALE;
+    return point;
+}
+
+int tsQuery(const uint8_t *mac, uint32_t from, uint32_t to, TsPoint *out, int maxPoints)
+{
+    maxPoints = constrain(maxPoints, 0, TS_MAX_QUERY_POINTS);
+    if (maxPoints == 0)
+    {
+        return 0;
+    }
+
+    xSemaphoreTake(tsMutex, portMAX_DELAY);
+    loadState(mac);
+
+    // First pass: how many points, and over what span.
+    uint32_t count = 0, first = 0, last = 0;
+    int32_t lastGravity = 0;
+    forEachPoint(mac, from, to, [&](uint32_t time, int32_t gravity, int32_t temp) {
+        if (count == 0)
+        {
+            first = time;
+        }
+        last = time;
+        lastGravity = gravity;
+        count++;
+    });
+
+    int n = 0;
+    if (count <= (uint32_t)maxPoints || maxPoints < 3)
+    {
+        // Few enough to return as is, or too few buckets for LTTB to make
+        // sense, in which case spread the points evenly.
+        uint32_t index = 0;
+        forEachPoint(mac, from, to, [&](uint32_t time, int32_t gravity, int32_t temp) {
+            if (n < maxPoints && (uint64_t)index * maxPoints / count >= (uint32_t)n)
+            {
+                out[n++] = toPoint(time, gravity, temp);
+            }
+            index++;
+        });
+        xSemaphoreGive(tsMutex);
+        return n;
+    }
+
+    // Largest-Triangle-Three-Buckets with buckets of equal time. The first
+    // and last points are kept; from every bucket in between the point
+    // forming the largest triangle with the previously selected point and
+    // the average of the next bucket is selected.
+    int buckets = maxPoints - 2;
+    uint32_t span = last - first + 1;
+    auto bucketOf = [&](uint32_t time) {
+        int bucket = (uint64_t)(time - first) * buckets / span;
+        return bucket < buckets ? bucket : buckets - 1;
+    };
+
+    // Second pass: bucket averages.
+    for (int b = 0; b < buckets; b++)
+    {
+        bucketTime[b] = 0;
+        bucketGravity[b] = 0;
+        bucketCount[b] = 0;
+    }
+    uint32_t index = 0;
+    forEachPoint(mac, from, to, [&](uint32_t time, int32_t gravity, int32_t temp) {
+        if (index > 0 && index < count - 1)
+        {
+            int b = bucketOf(time);
+            bucketTime[b] += time - first;
+            bucketGravity[b] += gravity;
+            bucketCount[b]++;
+        }
+        index++;
+    });
+    int next = -1;
+    for (int b = buckets - 1; b >= 0; b--)
+    {
+        nextBucket[b] = next;
+        if (bucketCount[b] > 0)
+        {
+            bucketTime[b] /= bucketCount[b];
+            bucketGravity[b] /= bucketCount[b];
+            next = b;
+        }
+    }
+
+    // Third pass: select.
+    double ax = 0, ay = 0;
+    int current = -1;
+    double bestArea = -1;
+    TsPoint best;
+    index = 0;
+    forEachPoint(mac, from, to, [&](uint32_t time, int32_t gravity, int32_t temp) {
+        if (index == 0)
+        {
+            out[n++] = toPoint(time, gravity, temp);
+            ay = gravity;
+        }
+        else if (index == count - 1)
+        {
+            if (current >= 0 && n < maxPoints - 1)
+            {
+                out[n++] = best;
+            }
+            out[n++] = toPoint(time, gravity, temp);
+        }
+        else
+        {
+            int b = bucketOf(time);
+            if (b != current)
+            {
+                if (current >= 0 && n < maxPoints - 1)
+                {
+                    out[n++] = best;
+                    ax = best.time - first;
+                    ay = best.gravity * TS_GRAVITY_SCALE;
+                }
+                current = b;
+                bestArea = -1;
+            }
+
+            double cx, cy;
+            if (nextBucket[b] >= 0)
+            {
+                cx = bucketTime[nextBucket[b]];
+                cy = bucketGravity[nextBucket[b]];
+            }
+            else
+            {
+                cx = last - first;
+                cy = lastGravity;
+            }
+            double px = time - first;
+            double area = fabs((ax - cx) * (gravity - ay) - (ax - px) * (cy - ay));
+            if (area > bestArea)
+            {
+                bestArea = area;
+                best = toPoint(time, gravity, temp);
+            }
+        }
+        index++;
+    });
+
+    xSemaphoreGive(tsMutex);
+    return n;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Per-sensor time-series store on LittleFS.
+//
+// Readings are packed into blocks of a few hundred bytes: timestamps as
+// delta-of-delta and values as fixed-point deltas, both with short prefix
+// codes, so a sensor reporting at a steady interval costs a few bits per
+// reading. Every reading also feeds running hourly and daily aggregates.
+//
+// Each sensor has its own directory with:
+//   open.bin    the block being filled plus the running aggregates
+//   raw.bin     full blocks, oldest first
+//   hourly.bin  one TsAggregate per hour
+//   daily.bin   one TsAggregate per day
+//
+// When raw.bin grows past TS_RAW_MAX_BYTES the oldest blocks are dropped;
+// that period is still covered by the hourly aggregates, and once those are
+// trimmed, by the daily ones. Queries stitch the levels together, coarsest
+// first, and downsample the result.
+
+#define TS_BLOCK_BYTES 256
+#define TS_RAW_MAX_BYTES 32768
+#define TS_HOURLY_MAX_BYTES 24576
+#define TS_DAILY_MAX_BYTES 8192
+
+// Upper bound on the number of points a query can return.
+#define TS_MAX_QUERY_POINTS 240
+
+// Fixed-point scales. Gravity arrives rounded to 0.001, temperature to 0.1.
+#define TS_GRAVITY_SCALE 1000
+#define TS_TEMP_SCALE 10
+
+struct TsPoint
+{
+    uint32_t time;
+    float gravity;
+    float temp;
+};
+
+struct __attribute__((packed)) TsAggregate
+{
+    uint32_t start;
+    uint16_t count;
+    int16_t gravityMin;
+    int16_t gravityMax;
+    int16_t gravityMean;
+    int16_t tempMean;
+};
+
+// Mount the filesystem. Returns false if it could not be mounted or formatted.
+bool tsBegin();
+
+// Append one reading. Time is in seconds.
+bool tsAppend(const uint8_t *mac, uint32_t time, float gravity, float temp);
+
+// Return at most maxPoints points between from and to (inclusive),
+// downsampled with Largest-Triangle-Three-Buckets on gravity when there are
+// more. Returns the number of points written to out.
+int tsQuery(const uint8_t *mac, uint32_t from, uint32_t to, TsPoint *out, int maxPoints);
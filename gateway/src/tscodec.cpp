@@ -0,0 +1,132 @@
+#include "tscodec.h"
+
+static void writeBits(uint8_t *data, uint16_t &pos, uint32_t value, uint8_t bits)
+{
+    for (int i = bits - 1; i >= 0; i--)
+    {
+        uint8_t mask = 0x80 >> (pos & 7);
+        if (value & (1UL << i))
+        {
+            data[pos >> 3] |= mask;
+        }
+        else
+        {
+            data[pos >> 3] &= ~mask;
+        }
+        pos++;
+    }
+}
+
+static uint32_t readBits(const uint8_t *data, uint16_t &pos, uint8_t bits)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < bits; i++)
+    {
+        value = (value << 1) | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+        pos++;
+    }
+    return value;
+}
+
+static int32_t readSigned(const uint8_t *data, uint16_t &pos, uint8_t bits)
+{
+    uint32_t value = readBits(data, pos, bits);
+    if (bits == 32)
+    {
+        return (int32_t)value;
+    }
+    uint32_t sign = 1UL << (bits - 1);
+    return (int32_t)((value ^ sign) - sign);
+}
+
+// As in Gorilla: a steady interval costs one bit.
+void tsEncodeTimestamp(uint8_t *data, uint16_t &pos, int32_t dod)
+{
+    if (dod == 0)
+    {
+        writeBits(data, pos, 0b0, 1);
+    }
+    else if (dod >= -64 && dod < 64)
+    {
+        writeBits(data, pos, 0b10, 2);
+        writeBits(data, pos, dod & 0x7F, 7);
+    }
+    else if (dod >= -256 && dod < 256)
+    {
+        writeBits(data, pos, 0b110, 3);
+        writeBits(data, pos, dod & 0x1FF, 9);
+    }
+    else if (dod >= -2048 && dod < 2048)
+    {
+        writeBits(data, pos, 0b1110, 4);
+        writeBits(data, pos, dod & 0xFFF, 12);
+    }
+    else
+    {
+        writeBits(data, pos, 0b1111, 4);
+        writeBits(data, pos, (uint32_t)dod, 32);
+    }
+}
+
+int32_t tsDecodeTimestamp(const uint8_t *data, uint16_t &pos)
+{
+    if (readBits(data, pos, 1) == 0)
+    {
+        return 0;
+    }
+    if (readBits(data, pos, 1) == 0)
+    {
+        return readSigned(data, pos, 7);
+    }
+    if (readBits(data, pos, 1) == 0)
+    {
+        return readSigned(data, pos, 9);
+    }
+    if (readBits(data, pos, 1) == 0)
+    {
+        return readSigned(data, pos, 12);
+    }
+    return readSigned(data, pos, 32);
+}
+
+// Readings are rounded on the sensor, so an unchanged value is common and
+// costs one bit.
+void tsEncodeValue(uint8_t *data, uint16_t &pos, int32_t delta)
+{
+    if (delta == 0)
+    {
+        writeBits(data, pos, 0b0, 1);
+    }
+    else if (delta >= -32 && delta < 32)
+    {
+        writeBits(data, pos, 0b10, 2);
+        writeBits(data, pos, delta & 0x3F, 6);
+    }
+    else if (delta >= -2048 && delta < 2048)
+    {
+        writeBits(data, pos, 0b110, 3);
+        writeBits(data, pos, delta & 0xFFF, 12);
+    }
+    else
+    {
+        writeBits(data, pos, 0b111, 3);
+        writeBits(data, pos, (uint32_t)delta, 32);
+    }
+}
+
+int32_t tsDecodeValue(const uint8_t *data, uint16_t &pos)
+{
+    if (readBits(data, pos, 1) == 0)
+    {
+        return 0;
+    }
+    if (readBits(data, pos, 1) == 0)
+    {
+        return readSigned(data, pos, 6);
+    }
+    if (readBits(data, pos, 1) == 0)
+    {
+        return readSigned(data, pos, 12);
+    }
+    return readSigned(data, pos, 32);
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Bit-level encoding of the points in a time-series block, see timeseries.h.
+// Every point after a block's first is a timestamp delta-of-delta followed
+// by the gravity and temperature deltas, each with a short prefix code.
+// Positions are in bits from the start of data, and move past what was
+// written or read.
+
+// Worst case size of one encoded point: a 36 bit timestamp and two 35 bit values.
+#define TS_MAX_POINT_BITS 106
+
+void tsEncodeTimestamp(uint8_t *data, uint16_t &pos, int32_t dod);
+int32_t tsDecodeTimestamp(const uint8_t *data, uint16_t &pos);
+
+// Fixed-point value deltas.
+void tsEncodeValue(uint8_t *data, uint16_t &pos, int32_t delta);
+int32_t tsDecodeValue(const uint8_t *data, uint16_t &pos);
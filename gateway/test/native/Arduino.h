@@ -0,0 +1,42 @@
+#pragma once
+
+// Just enough of the Arduino core to build the modules that do not touch the
+// hardware on the host, for the tests in the native environment.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define PI 3.1415926535897932384626433832795
+
+// Mixed argument types, as in the ESP32 core.
+template <class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+    return (b < a) ? b : a;
+}
+
+template <class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a)
+{
+    return (a < b) ? b : a;
+}
+
+// The clock only moves when a test sets it.
+inline unsigned long nativeMillis = 0;
+
+inline unsigned long millis()
+{
+    return nativeMillis;
+}
+
+class String : public std::string
+{
+public:
+    using std::string::string;
+    String(const std::string &s) : std::string(s) {}
+};
@@ -0,0 +1,5 @@
+#pragma once
+
+// The frame size limit relay.h needs, without the ESP-NOW API.
+
+#define ESP_NOW_MAX_DATA_LEN 250
@@ -0,0 +1,143 @@
+#include <unity.h>
+#include "analytics.h"
+
+#define READING_INTERVAL (30 * 60 * 1000LL)
+
+// Sensor state is kept per MAC, so every test uses a sensor of its own.
+static void makeMac(uint8_t *mac, uint8_t test)
+{
+    const uint8_t base[6] = {0x5c, 0xcf, 0x7f, 0, 0, test};
+    memcpy(mac, base, 6);
+}
+
+// Feeds readings every READING_INTERVAL from start for the given hours, with
+// gravity falling by slope points per day from level. Returns the time after
+// the last reading.
+static int64_t feed(const uint8_t *mac, int64_t start, double hours, double level, double slope,
+                    float target, Analytics &out)
+{
+    int64_t t = start;
+    for (; t < start + (int64_t)(hours * 3600000); t += READING_INTERVAL)
+    {
+        double gravity = level + slope * (t - start) / 86400000.0;
+        analyticsUpdate(mac, t, gravity, target, out);
+    }
+    return t;
+}
+
+void test_unknown_until_spread_over_time()
+{
+    uint8_t mac[6];
+    makeMac(mac, 1);
+    Analytics out;
+    // Plenty of readings, but all within a few minutes.
+    for (int i = 0; i < 20; i++)
+    {
+        analyticsUpdate(mac, i * 10000LL, 1.050, 0, out);
+        TEST_ASSERT_EQUAL_UINT8(STAGE_UNKNOWN, out.stage);
+    }
+    TEST_ASSERT_EQUAL_FLOAT(0, out.og);
+}
+
+// A steady decline comes out as its slope, and the ETA as the time left to
+// the target at that slope.
+void test_slope_and_eta_of_a_steady_decline()
+{
+    uint8_t mac[6];
+    makeMac(mac, 2);
+    Analytics out;
+    int64_t end = feed(mac, 0, 48, 1.050, -0.010, 1.010, out);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, -0.010, out.slope);
+
+    double level = 1.050 - 0.010 * (end - READING_INTERVAL) / 86400000.0;
+    TEST_ASSERT_FLOAT_WITHIN(0.5, (level - 1.010) / 0.010 * 24, out.etaHours);
+}
+
+// Lag at a steady OG, active while gravity drops, finished once it settles
+// well attenuated.
+void test_stages_of_a_fermentation()
+{
+    uint8_t mac[6];
+    makeMac(mac, 3);
+    Analytics out;
+    int64_t t = feed(mac, 0, 12, 1.050, 0, 0, out);
+    TEST_ASSERT_EQUAL_STRING("lag", analyticsStageName(out.stage));
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 1.050, out.og);
+
+    t = feed(mac, t, 48, 1.050, -0.019, 0, out);
+    TEST_ASSERT_EQUAL_STRING("active", analyticsStageName(out.stage));
+    TEST_ASSERT_TRUE(out.attenuation > 50);
+
+    feed(mac, t, 96, 1.012, 0, 0, out);
+    TEST_ASSERT_EQUAL_STRING("finished", analyticsStageName(out.stage));
+    TEST_ASSERT_FLOAT_WITHIN(1, 76, out.attenuation);
+    TEST_ASSERT_EQUAL_FLOAT(0, out.etaHours);
+}
+
+// Gravity that stops dropping early counts as stalled, and picks up again.
+void test_stall_and_restart()
+{
+    uint8_t mac[6];
+    makeMac(mac, 4);
+    Analytics out;
+    int64_t t = feed(mac, 0, 12, 1.060, 0, 0, out);
+    t = feed(mac, t, 24, 1.060, -0.020, 0, out);
+    TEST_ASSERT_EQUAL_STRING("active", analyticsStageName(out.stage));
+
+    t = feed(mac, t, 96, 1.040, 0, 0, out);
+    TEST_ASSERT_EQUAL_STRING("stalled", analyticsStageName(out.stage));
+
+    feed(mac, t, 24, 1.040, -0.020, 0, out);
+    TEST_ASSERT_EQUAL_STRING("active", analyticsStageName(out.stage));
+}
+
+// Without a steady start, the highest level seen becomes the OG once the
+// fermentation takes off. The trend is only trusted after some hours, by
+// which time the level has dropped a little.
+void test_og_from_peak_when_already_fermenting()
+{
+    uint8_t mac[6];
+    makeMac(mac, 5);
+    Analytics out;
+    feed(mac, 0, 24, 1.055, -0.015, 0, out);
+    TEST_ASSERT_EQUAL_STRING("active", analyticsStageName(out.stage));
+    TEST_ASSERT_TRUE(out.og > 1.048 && out.og <= 1.055);
+}
+
+// Moving the sensor to a fresh batch starts everything over.
+void test_new_batch()
+{
+    uint8_t mac[6];
+    makeMac(mac, 6);
+    Analytics out;
+    int64_t t = feed(mac, 0, 12, 1.050, 0, 0, out);
+    t = feed(mac, t, 48, 1.050, -0.019, 0, out);
+    t = feed(mac, t, 96, 1.012, 0, 0, out);
+    TEST_ASSERT_EQUAL_STRING("finished", analyticsStageName(out.stage));
+
+    // The jump takes a few readings to show in the trend, and the new batch
+    // needs a few hours of its own.
+    feed(mac, t, 24, 1.062, 0, 0, out);
+    TEST_ASSERT_EQUAL_STRING("lag", analyticsStageName(out.stage));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 1.062, out.og);
+}
+
+void test_stage_names()
+{
+    TEST_ASSERT_EQUAL_STRING("unknown", analyticsStageName(STAGE_UNKNOWN));
+    TEST_ASSERT_EQUAL_STRING("stalled", analyticsStageName(STAGE_STALLED));
+    TEST_ASSERT_EQUAL_STRING("unknown", analyticsStageName(200));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_unknown_until_spread_over_time);
+    RUN_TEST(test_slope_and_eta_of_a_steady_decline);
+    RUN_TEST(test_stages_of_a_fermentation);
+    RUN_TEST(test_stall_and_restart);
+    RUN_TEST(test_og_from_peak_when_already_fermenting);
+    RUN_TEST(test_new_batch);
+    RUN_TEST(test_stage_names);
+    return UNITY_END();
+}
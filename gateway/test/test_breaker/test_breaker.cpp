@@ -0,0 +1,118 @@
+#include <unity.h>
+#include "breaker.h"
+
+// These only drive the breaker's state machine with the outcomes of calls.
+// Whether the publishers' timeouts hold against a real upstream, and whether
+// one hanging upstream leaves the others alone, is checked against a gateway
+// with tools/upstream.
+
+// Feeds the breaker a reading every interval ms from start until end, the
+// way Publisher::run() does, with every call that goes out succeeding or
+// failing. Returns the number of calls that went out.
+static int publish(CircuitBreaker &breaker, bool up, unsigned long start, unsigned long end, unsigned long interval)
+{
+    int calls = 0;
+    for (unsigned long now = start; now < end; now += interval)
+    {
+        if (breaker.allow(now))
+        {
+            calls++;
+            breaker.record(up, now);
+        }
+    }
+    return calls;
+}
+
+void test_opens_after_threshold()
+{
+    CircuitBreaker breaker("test");
+    for (int i = 0; i < BREAKER_THRESHOLD - 1; i++)
+    {
+        TEST_ASSERT_TRUE(breaker.allow(i));
+        breaker.record(false, i);
+        TEST_ASSERT_EQUAL(BREAKER_CLOSED, breaker.state());
+    }
+    breaker.record(false, 10);
+    TEST_ASSERT_EQUAL(BREAKER_OPEN, breaker.state());
+    TEST_ASSERT_FALSE(breaker.allow(10 + BREAKER_BACKOFF_MIN - 1));
+}
+
+// A success in between starts the count over.
+void test_success_resets_count()
+{
+    CircuitBreaker breaker("test");
+    breaker.record(false, 0);
+    breaker.record(false, 0);
+    breaker.record(true, 0);
+    breaker.record(false, 0);
+    breaker.record(false, 0);
+    TEST_ASSERT_EQUAL(BREAKER_CLOSED, breaker.state());
+}
+
+// Every failed probe doubles the backoff, up to the maximum, and a good one
+// closes the breaker and resets it.
+void test_probes_back_off()
+{
+    CircuitBreaker breaker("test");
+    unsigned long now = 0;
+    for (int i = 0; i < BREAKER_THRESHOLD; i++)
+    {
+        breaker.record(false, now);
+    }
+    uint32_t expected = BREAKER_BACKOFF_MIN;
+    for (int i = 0; i < 10; i++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(expected, breaker.backoff());
+        TEST_ASSERT_FALSE(breaker.allow(now + breaker.backoff() - 1));
+        now += breaker.backoff();
+        TEST_ASSERT_TRUE(breaker.allow(now));
+        TEST_ASSERT_EQUAL(BREAKER_HALF_OPEN, breaker.state());
+        breaker.record(false, now);
+        TEST_ASSERT_EQUAL(BREAKER_OPEN, breaker.state());
+        expected = min((uint32_t)BREAKER_BACKOFF_MAX, expected * 2);
+    }
+    TEST_ASSERT_EQUAL_UINT32(BREAKER_BACKOFF_MAX, breaker.backoff());
+
+    now += breaker.backoff();
+    TEST_ASSERT_TRUE(breaker.allow(now));
+    breaker.record(true, now);
+    TEST_ASSERT_EQUAL(BREAKER_CLOSED, breaker.state());
+    TEST_ASSERT_EQUAL_UINT32(BREAKER_BACKOFF_MIN, breaker.backoff());
+}
+
+// With every call failing for a day of readings every minute, only the
+// probes go out, fewer and fewer of them.
+void test_probes_while_down()
+{
+    CircuitBreaker breaker("down");
+    const unsigned long hour = 3600000UL;
+    int firstHour = publish(breaker, false, 0, hour, 60000);
+    int rest = publish(breaker, false, hour, 24 * hour, 60000);
+    TEST_ASSERT_LESS_THAN(10, firstHour);
+    TEST_ASSERT_LESS_THAN(60, firstHour + rest);
+    TEST_ASSERT_TRUE(rest / 23.0 < firstHour);
+    TEST_ASSERT_EQUAL(BREAKER_OPEN, breaker.state());
+}
+
+// Once calls succeed again, the next probe closes the breaker, and every
+// reading goes out again.
+void test_recovers()
+{
+    CircuitBreaker breaker("recover");
+    const unsigned long hour = 3600000UL;
+    publish(breaker, false, 0, hour, 60000);
+    publish(breaker, true, hour, 2 * hour, 60000);
+    TEST_ASSERT_EQUAL(BREAKER_CLOSED, breaker.state());
+    TEST_ASSERT_EQUAL(60, publish(breaker, true, 2 * hour, 3 * hour, 60000));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_opens_after_threshold);
+    RUN_TEST(test_success_resets_count);
+    RUN_TEST(test_probes_back_off);
+    RUN_TEST(test_probes_while_down);
+    RUN_TEST(test_recovers);
+    return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+#include "polyfit.h"
+
+static double evaluate(const double *coefficients, int degree, double x)
+{
+    double result = 0;
+    for (int i = degree; i >= 0; i--)
+    {
+        result = result * x + coefficients[i];
+    }
+    return result;
+}
+
+// Points on a polynomial of the fitted degree come back exactly.
+void test_fit_recovers_polynomial()
+{
+    const double expected[] = {1.05, -0.021, 0.0034, -0.0007};
+    double x[8], y[8];
+    for (int i = 0; i < 8; i++)
+    {
+        x[i] = -1 + i * 2.0 / 7;
+        y[i] = evaluate(expected, 3, x[i]);
+    }
+    double coefficients[CALIBRATION_MAX_DEGREE + 1];
+    TEST_ASSERT_TRUE(polyfitLeastSquares(x, y, 8, 3, coefficients));
+    for (int i = 0; i <= 3; i++)
+    {
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, expected[i], coefficients[i]);
+    }
+}
+
+// A line through noisy points matches the closed form regression.
+void test_fit_line_matches_regression()
+{
+    const double x[] = {-1, -0.5, 0, 0.25, 0.5, 1};
+    const double y[] = {1.060, 1.052, 1.041, 1.037, 1.030, 1.021};
+    const int n = 6;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (int i = 0; i < n; i++)
+    {
+        sx += x[i];
+        sy += y[i];
+        sxx += x[i] * x[i];
+        sxy += x[i] * y[i];
+    }
+    double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    double intercept = (sy - slope * sx) / n;
+
+    double coefficients[CALIBRATION_MAX_DEGREE + 1];
+    TEST_ASSERT_TRUE(polyfitLeastSquares(x, y, n, 1, coefficients));
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, intercept, coefficients[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-12, slope, coefficients[1]);
+}
+
+void test_fit_rejects_too_few_points()
+{
+    const double x[] = {-1, 0, 1};
+    const double y[] = {1.05, 1.03, 1.01};
+    double coefficients[CALIBRATION_MAX_DEGREE + 1];
+    TEST_ASSERT_FALSE(polyfitLeastSquares(x, y, 3, 3, coefficients));
+    TEST_ASSERT_FALSE(polyfitLeastSquares(x, y, 0, 1, coefficients));
+}
+
+// Four points at only two tilts cannot pin down a quadratic.
+void test_fit_rejects_repeated_tilts()
+{
+    const double x[] = {0.5, 0.5, -0.5, -0.5};
+    const double y[] = {1.02, 1.021, 1.05, 1.051};
+    double coefficients[CALIBRATION_MAX_DEGREE + 1];
+    TEST_ASSERT_FALSE(polyfitLeastSquares(x, y, 4, 2, coefficients));
+    TEST_ASSERT_TRUE(polyfitLeastSquares(x, y, 4, 1, coefficients));
+}
+
+// The expanded coefficients give the same gravity as the profile's own
+// centered and scaled polynomial.
+void test_expand_matches_profile()
+{
+    CalibrationProfile profile = {};
+    profile.degree = 3;
+    profile.center = 45.5;
+    profile.scale = 20;
+    profile.coefficients[0] = 1.031;
+    profile.coefficients[1] = 0.028;
+    profile.coefficients[2] = 0.0041;
+    profile.coefficients[3] = -0.0009;
+
+    double expanded[CALIBRATION_MAX_DEGREE + 1];
+    polyfitExpand(profile, expanded);
+    for (double tilt = 25; tilt <= 70; tilt += 5)
+    {
+        double scaled = (tilt - profile.center) / profile.scale;
+        double coefficients[] = {profile.coefficients[0], profile.coefficients[1],
+                                 profile.coefficients[2], profile.coefficients[3]};
+        TEST_ASSERT_DOUBLE_WITHIN(1e-9, evaluate(coefficients, 3, scaled), evaluate(expanded, 3, tilt));
+    }
+}
+
+// Terms above the fitted degree are left at zero.
+void test_expand_clears_unused_terms()
+{
+    CalibrationProfile profile = {};
+    profile.degree = 1;
+    profile.center = 40;
+    profile.scale = 10;
+    profile.coefficients[0] = 1.04;
+    profile.coefficients[1] = 0.02;
+    profile.coefficients[3] = 5; // Left over from an earlier fit.
+
+    double expanded[CALIBRATION_MAX_DEGREE + 1];
+    polyfitExpand(profile, expanded);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, 1.04 - 0.02 * 4, expanded[0]);
+    TEST_ASSERT_DOUBLE_WITHIN(1e-6, 0.002, expanded[1]);
+    TEST_ASSERT_EQUAL_DOUBLE(0, expanded[2]);
+    TEST_ASSERT_EQUAL_DOUBLE(0, expanded[3]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_fit_recovers_polynomial);
+    RUN_TEST(test_fit_line_matches_regression);
+    RUN_TEST(test_fit_rejects_too_few_points);
+    RUN_TEST(test_fit_rejects_repeated_tilts);
+    RUN_TEST(test_expand_matches_profile);
+    RUN_TEST(test_expand_clears_unused_terms);
+    return UNITY_END();
+}
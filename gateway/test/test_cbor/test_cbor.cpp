@@ -0,0 +1,119 @@
+#include <unity.h>
+#include "cbor.h"
+
+static uint8_t buffer[64];
+
+static void assertEncoded(const CborWriter &writer, const uint8_t *expected, size_t len)
+{
+    TEST_ASSERT_FALSE(writer.overflowed());
+    TEST_ASSERT_EQUAL_size_t(len, writer.length());
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(expected, buffer, len);
+}
+
+// Examples from RFC 8949, appendix A.
+void test_unsigned_integers()
+{
+    const struct
+    {
+        uint64_t value;
+        uint8_t bytes[9];
+        size_t len;
+    } cases[] = {
+        {0, {0x00}, 1},
+        {23, {0x17}, 1},
+        {24, {0x18, 0x18}, 2},
+        {100, {0x18, 0x64}, 2},
+        {1000, {0x19, 0x03, 0xe8}, 3},
+        {1000000, {0x1a, 0x00, 0x0f, 0x42, 0x40}, 5},
+        {1000000000000, {0x1b, 0x00, 0x00, 0x00, 0xe8, 0xd4, 0xa5, 0x10, 0x00}, 9},
+        {UINT64_MAX, {0x1b, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, 9},
+    };
+    for (const auto &c : cases)
+    {
+        CborWriter writer(buffer, sizeof(buffer));
+        writer.uint(c.value);
+        assertEncoded(writer, c.bytes, c.len);
+    }
+}
+
+void test_signed_integers()
+{
+    const struct
+    {
+        int64_t value;
+        uint8_t bytes[9];
+        size_t len;
+    } cases[] = {
+        {10, {0x0a}, 1},
+        {-1, {0x20}, 1},
+        {-10, {0x29}, 1},
+        {-100, {0x38, 0x63}, 2},
+        {-1000, {0x39, 0x03, 0xe7}, 3},
+        {INT64_MIN, {0x3b, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, 9},
+    };
+    for (const auto &c : cases)
+    {
+        CborWriter writer(buffer, sizeof(buffer));
+        writer.integer(c.value);
+        assertEncoded(writer, c.bytes, c.len);
+    }
+}
+
+void test_strings()
+{
+    CborWriter empty(buffer, sizeof(buffer));
+    empty.text("");
+    const uint8_t emptyBytes[] = {0x60};
+    assertEncoded(empty, emptyBytes, sizeof(emptyBytes));
+
+    CborWriter text(buffer, sizeof(buffer));
+    text.text("IETF");
+    const uint8_t textBytes[] = {0x64, 0x49, 0x45, 0x54, 0x46};
+    assertEncoded(text, textBytes, sizeof(textBytes));
+
+    const uint8_t data[] = {1, 2, 3, 4};
+    CborWriter bytes(buffer, sizeof(buffer));
+    bytes.bytes(data, sizeof(data));
+    const uint8_t bytesBytes[] = {0x44, 0x01, 0x02, 0x03, 0x04};
+    assertEncoded(bytes, bytesBytes, sizeof(bytesBytes));
+}
+
+// {1: 2, 3: [4, 5]}
+void test_containers()
+{
+    CborWriter writer(buffer, sizeof(buffer));
+    writer.map(2);
+    writer.uint(1);
+    writer.uint(2);
+    writer.uint(3);
+    writer.array(2);
+    writer.uint(4);
+    writer.uint(5);
+    const uint8_t expected[] = {0xa2, 0x01, 0x02, 0x03, 0x82, 0x04, 0x05};
+    assertEncoded(writer, expected, sizeof(expected));
+}
+
+// A value that does not fit is not written at all, and nothing after it is.
+void test_overflow()
+{
+    memset(buffer, 0, sizeof(buffer));
+    CborWriter writer(buffer, 4);
+    writer.uint(1);
+    writer.uint(1000000);
+    TEST_ASSERT_TRUE(writer.overflowed());
+    TEST_ASSERT_EQUAL_size_t(1, writer.length());
+    writer.uint(2);
+    TEST_ASSERT_EQUAL_size_t(1, writer.length());
+    TEST_ASSERT_EQUAL_UINT8(0, buffer[1]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_unsigned_integers);
+    RUN_TEST(test_signed_integers);
+    RUN_TEST(test_strings);
+    RUN_TEST(test_containers);
+    RUN_TEST(test_overflow);
+    return UNITY_END();
+}
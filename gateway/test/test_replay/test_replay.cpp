@@ -0,0 +1,242 @@
+#include <unity.h>
+#include "frame.h"
+#include "gravity.h"
+#include "analytics.h"
+#include "batch.h"
+
+// Replays a capture through the gateway's decode, gravity, analytics and
+// batch encoding, as the radio task and the batching Tilted publisher run
+// them. A capture downloaded from /capture.bin can be replayed too:
+//
+//   TILTED_CAPTURE=capture.bin pio test -e native -f test_replay -v
+//
+// prints every reading and batch, so that two runs, or two versions of the
+// gateway, can be diffed. TILTED_POLYNOMIAL overrides the polynomial.
+
+#define POLYNOMIAL "0.00000166*tilt^3 - 0.000105*tilt^2 + 0.00476*tilt + 0.934"
+#define TARGET_GRAVITY 1.010
+#define BATCH_READINGS 8
+#define MAX_READINGS 256
+#define MAX_CAPTURE (256 * 1024)
+
+struct Replay
+{
+    Reading readings[MAX_READINGS];
+    int count;
+    int rejected;
+    // Batch bodies, one after another, as the publisher would post them.
+    uint8_t batches[MAX_READINGS * 64];
+    size_t batchesLen;
+};
+
+static const uint8_t directMac[6] = {0x5c, 0xcf, 0x7f, 0, 0, 1};
+static const uint8_t relayedMac[6] = {0x5c, 0xcf, 0x7f, 0, 0, 2};
+static const uint8_t relayMac[6] = {0x24, 0x6f, 0x28, 0, 0, 3};
+
+static uint8_t capture[MAX_CAPTURE];
+static Replay first, second;
+
+static void append(size_t &size, uint32_t timeMs, const uint8_t *mac, int8_t rssi, const void *data, uint8_t len)
+{
+    CaptureRecord record;
+    record.timeMs = timeMs;
+    memcpy(record.mac, mac, 6);
+    record.rssi = rssi;
+    record.len = len;
+    memcpy(capture + size, &record, sizeof(record));
+    memcpy(capture + size + sizeof(record), data, len);
+    size += sizeof(record) + len;
+}
+
+// A day of readings every 30 minutes from a fermenting sensor heard
+// directly, and one heard through a relay, plus a frame from an older sensor
+// and a runt.
+static size_t buildCapture()
+{
+    size_t size = 4;
+    memcpy(capture, CAPTURE_MAGIC, 4);
+    for (int i = 0; i < 48; i++)
+    {
+        uint32_t t = i * 1800000u;
+        DataStruct data = {};
+        data.tilt = 60 - i * 0.5f;
+        data.temp = 20;
+        data.volt = 3900;
+        data.interval = 1800;
+        data.seq = i + 1;
+        append(size, t, directMac, -60, &data, sizeof(data));
+
+        RelayFrame relayed = {};
+        relayed.magic = RELAY_MAGIC;
+        relayed.hops = 1;
+        memcpy(relayed.sensor, relayedMac, 6);
+        relayed.rssi = -80;
+        data.tilt = 40;
+        memcpy(relayed.data, &data, sizeof(data));
+        append(size, t + 1000, relayMac, -50, &relayed, RELAY_HEADER_SIZE + sizeof(data));
+    }
+    DataStruct old = {};
+    old.tilt = 50;
+    old.temp = 18;
+    old.volt = 3700;
+    old.interval = 900;
+    append(size, 48 * 1800000u, directMac, -61, &old, DATA_STRUCT_MIN_SIZE);
+    append(size, 48 * 1800000u + 1000, directMac, -61, &old, DATA_STRUCT_MIN_SIZE - 1);
+    return size;
+}
+
+static void flush(Replay &out, int from)
+{
+    int64_t timestamps[BATCH_READINGS];
+    for (int i = from; i < out.count; i++)
+    {
+        timestamps[i - from] = out.readings[i].receivedMs;
+    }
+    size_t len = batchEncode(out.batches + out.batchesLen, sizeof(out.batches) - out.batchesLen,
+                             "24:6F:28:00:00:00", "Replay", out.readings + from, timestamps, out.count - from);
+    TEST_ASSERT_TRUE(len > 0);
+    out.batchesLen += len;
+}
+
+static bool replay(const uint8_t *data, size_t size, const char *polynomial, Replay &out)
+{
+    if (size < 4 || memcmp(data, CAPTURE_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    GravityFormula formula;
+    int err;
+    TEST_ASSERT_TRUE(formula.compile(polynomial, err));
+    analyticsReset();
+    out.count = 0;
+    out.rejected = 0;
+    out.batchesLen = 0;
+
+    size_t pos = 4;
+    int batchStart = 0;
+    CaptureRecord record;
+    const uint8_t *frame;
+    while (out.count < MAX_READINGS && frameNextCaptured(data, size, pos, record, frame))
+    {
+        DecodedFrame decoded;
+        if (!frameDecode(record.mac, record.rssi, frame, record.len, record.timeMs, decoded))
+        {
+            out.rejected++;
+            continue;
+        }
+        Reading &reading = decoded.reading;
+        reading.gravity = formula.evaluate(reading.data.tilt, reading.data.temp);
+        analyticsUpdate(reading.sensorId, reading.receivedMs, reading.gravity, TARGET_GRAVITY, reading.analytics);
+        out.readings[out.count++] = reading;
+        if (out.count - batchStart == BATCH_READINGS)
+        {
+            flush(out, batchStart);
+            batchStart = out.count;
+        }
+    }
+    if (out.count > batchStart)
+    {
+        flush(out, batchStart);
+    }
+    return true;
+}
+
+void test_decodes_direct_relayed_and_old_frames()
+{
+    size_t size = buildCapture();
+    TEST_ASSERT_TRUE(replay(capture, size, POLYNOMIAL, first));
+    TEST_ASSERT_EQUAL_INT(97, first.count);
+    TEST_ASSERT_EQUAL_INT(1, first.rejected);
+
+    TEST_ASSERT_EQUAL_MEMORY(directMac, first.readings[0].sensorId, 6);
+    TEST_ASSERT_EQUAL_FLOAT(60, first.readings[0].data.tilt);
+    TEST_ASSERT_EQUAL_UINT32(1, first.readings[0].data.seq);
+    TEST_ASSERT_EQUAL_INT64(0, first.readings[0].receivedMs);
+
+    // Relayed frames come out as the sensor's own.
+    TEST_ASSERT_EQUAL_MEMORY(relayedMac, first.readings[1].sensorId, 6);
+    TEST_ASSERT_EQUAL_FLOAT(40, first.readings[1].data.tilt);
+    TEST_ASSERT_EQUAL_INT64(1000, first.readings[1].receivedMs);
+
+    // Fields an older sensor leaves out read as zero.
+    const Reading &old = first.readings[96];
+    TEST_ASSERT_EQUAL_INT(3700, old.data.volt);
+    TEST_ASSERT_EQUAL_UINT32(0, old.data.seq);
+    TEST_ASSERT_EQUAL_UINT32(0, old.data.samples);
+}
+
+void test_gravity_from_polynomial()
+{
+    size_t size = buildCapture();
+    TEST_ASSERT_TRUE(replay(capture, size, POLYNOMIAL, first));
+    for (int i = 0; i < first.count; i++)
+    {
+        double tilt = first.readings[i].data.tilt;
+        double gravity = 0.00000166 * tilt * tilt * tilt - 0.000105 * tilt * tilt + 0.00476 * tilt + 0.934;
+        TEST_ASSERT_FLOAT_WITHIN(0.0006, gravity, first.readings[i].gravity);
+    }
+    // Steady tilt, steady gravity, and a falling one is seen fermenting.
+    TEST_ASSERT_EQUAL_FLOAT(first.readings[1].gravity, first.readings[95].gravity);
+    TEST_ASSERT_EQUAL_UINT8(STAGE_ACTIVE, first.readings[94].analytics.stage);
+    TEST_ASSERT_TRUE(first.readings[94].analytics.slope < 0);
+}
+
+// The same capture always comes out the same, down to the bytes posted.
+void test_replay_is_deterministic()
+{
+    size_t size = buildCapture();
+    TEST_ASSERT_TRUE(replay(capture, size, POLYNOMIAL, first));
+    TEST_ASSERT_TRUE(replay(capture, size, POLYNOMIAL, second));
+    TEST_ASSERT_EQUAL_INT(first.count, second.count);
+    TEST_ASSERT_EQUAL_MEMORY(first.readings, second.readings, first.count * sizeof(Reading));
+    TEST_ASSERT_EQUAL_size_t(first.batchesLen, second.batchesLen);
+    TEST_ASSERT_EQUAL_MEMORY(first.batches, second.batches, first.batchesLen);
+}
+
+// A capture cut off in the middle of a record, here the runt, replays up to
+// it.
+void test_truncated_capture()
+{
+    size_t size = buildCapture();
+    TEST_ASSERT_TRUE(replay(capture, size - 3, POLYNOMIAL, first));
+    TEST_ASSERT_EQUAL_INT(97, first.count);
+    TEST_ASSERT_EQUAL_INT(0, first.rejected);
+    TEST_ASSERT_FALSE(replay(capture + 1, size - 1, POLYNOMIAL, first));
+}
+
+void test_capture_file()
+{
+    const char *path = getenv("TILTED_CAPTURE");
+    if (!path)
+    {
+        TEST_IGNORE_MESSAGE("Set TILTED_CAPTURE to replay a capture file");
+    }
+    FILE *file = fopen(path, "rb");
+    TEST_ASSERT_TRUE_MESSAGE(file != nullptr, path);
+    size_t size = fread(capture, 1, sizeof(capture), file);
+    fclose(file);
+    const char *polynomial = getenv("TILTED_POLYNOMIAL");
+    TEST_ASSERT_TRUE(replay(capture, size, polynomial ? polynomial : POLYNOMIAL, first));
+
+    for (int i = 0; i < first.count; i++)
+    {
+        const Reading &r = first.readings[i];
+        printf("%lld %02X:%02X:%02X:%02X:%02X:%02X seq %u tilt %.2f temp %.2f volt %d gravity %.3f %s slope %.4f\n",
+               (long long)r.receivedMs, r.sensorId[0], r.sensorId[1], r.sensorId[2], r.sensorId[3],
+               r.sensorId[4], r.sensorId[5], r.data.seq, r.data.tilt, r.data.temp, r.data.volt, r.gravity,
+               analyticsStageName(r.analytics.stage), r.analytics.slope);
+    }
+    printf("%d readings, %d rejected, %u bytes of batches\n", first.count, first.rejected,
+           (unsigned)first.batchesLen);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_decodes_direct_relayed_and_old_frames);
+    RUN_TEST(test_gravity_from_polynomial);
+    RUN_TEST(test_replay_is_deterministic);
+    RUN_TEST(test_truncated_capture);
+    RUN_TEST(test_capture_file);
+    return UNITY_END();
+}
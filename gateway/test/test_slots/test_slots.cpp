@@ -0,0 +1,179 @@
+#include <unity.h>
+#include <algorithm>
+#include <vector>
+#include "slots.h"
+
+// Slots are handed out in the order sensors are first heard and never given
+// back, so every test uses MACs of its own.
+static void makeMac(uint8_t *mac, uint8_t test, int sensor)
+{
+    const uint8_t base[6] = {0x5c, 0xcf, 0x7f, test, (uint8_t)(sensor >> 8), (uint8_t)sensor};
+    memcpy(mac, base, 6);
+}
+
+// The first sensor heard gets slot 0, at the start of its interval.
+void test_first_sensor_moves_to_its_slot()
+{
+    uint8_t mac[6];
+    makeMac(mac, 1, 0);
+    TEST_ASSERT_EQUAL_INT32(-5000, slotCorrection(mac, 60, 3600000 + 5000));
+    TEST_ASSERT_EQUAL_INT32(0, slotCorrection(mac, 60, 3600000 + SLOT_TOLERANCE - 1));
+    TEST_ASSERT_EQUAL_INT32(0, slotCorrection(mac, 60, 3600000 - SLOT_TOLERANCE + 1));
+}
+
+// The second sensor heard gets slot 1. Corrections take the shorter way
+// round the interval.
+void test_correction_wraps_around()
+{
+    uint8_t mac[6];
+    makeMac(mac, 2, 0);
+    TEST_ASSERT_EQUAL_INT32(3000, slotCorrection(mac, 60, 59000));
+    TEST_ASSERT_EQUAL_INT32(-29000, slotCorrection(mac, 60, 31000));
+    TEST_ASSERT_EQUAL_INT32(-29999, slotCorrection(mac, 60, 31999));
+    TEST_ASSERT_EQUAL_INT32(30000, slotCorrection(mac, 60, 32000));
+}
+
+void test_no_interval_no_correction()
+{
+    uint8_t mac[6];
+    makeMac(mac, 3, 0);
+    TEST_ASSERT_EQUAL_INT32(0, slotCorrection(mac, 0, 12345));
+}
+
+// Sensors on drifting clocks, starting at the same moment, end up spread
+// out over their slots and stay there, each following the corrections it
+// gets, as the sensor firmware does.
+void test_drifting_sensors_spread_out()
+{
+    const int sensors = 8;
+    const uint32_t interval = 60;
+    // Clock error of each sensor, in parts per thousand.
+    const int drift[sensors] = {5, -5, 3, -2, 0, 4, -4, 1};
+    uint8_t macs[sensors][6];
+    int64_t next[sensors];
+    for (int i = 0; i < sensors; i++)
+    {
+        makeMac(macs[i], 4, i);
+        // Woken up together, a few ms apart.
+        next[i] = 1000000 + i * 3;
+    }
+
+    for (int round = 0; round < 20; round++)
+    {
+        std::vector<int64_t> offsets;
+        for (int i = 0; i < sensors; i++)
+        {
+            int64_t received = next[i];
+            int32_t correction = slotCorrection(macs[i], interval, received);
+            next[i] = received + (int64_t)interval * (1000 + drift[i]) + correction;
+            offsets.push_back(received % (interval * 1000));
+        }
+        if (round < 2)
+        {
+            continue;
+        }
+        // From the third round on, no two frames come closer than half a slot.
+        std::sort(offsets.begin(), offsets.end());
+        for (int i = 1; i < sensors; i++)
+        {
+            TEST_ASSERT_GREATER_OR_EQUAL(SLOT_WIDTH / 2, offsets[i] - offsets[i - 1]);
+        }
+    }
+}
+
+static uint32_t seed = 1;
+
+// Uniform in [0, 1).
+static double uniform()
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) / (double)(1 << 24);
+}
+
+// Frames closer than this to each other collide.
+#define FRAME_MS 10
+
+// A day of a fleet of sensors on the default interval, scattered over it
+// at random, with clocks off by up to half a part per thousand and up to
+// 50 ms of jitter per wake. With slotted set, they follow the corrections the
+// way the sensor firmware does, by at most half the sleep. Returns the number
+// of frames that came too close to another one.
+static int simulateFleet(int sensors, bool slotted)
+{
+    const uint32_t interval = SLOT_INTERVAL;
+    const int64_t period = (int64_t)interval * 1000;
+    std::vector<double> drift(sensors);
+    std::vector<int64_t> next(sensors);
+    seed = 1;
+    for (int i = 0; i < sensors; i++)
+    {
+        drift[i] = (uniform() - 0.5) / 1000;
+        next[i] = 1000000 + (int64_t)(uniform() * period);
+    }
+
+    std::vector<int64_t> received;
+    for (int round = 0; round < 48; round++)
+    {
+        for (int i = 0; i < sensors; i++)
+        {
+            int64_t at = next[i] + (int64_t)(uniform() * 50);
+            received.push_back(at);
+            int64_t sleep = period + (int64_t)(period * drift[i]);
+            if (slotted)
+            {
+                uint8_t mac[6];
+                makeMac(mac, 7, i);
+                int64_t correction = slotCorrection(mac, interval, at);
+                sleep += std::max(-period / 2, std::min(correction, period / 2));
+            }
+            next[i] = at + sleep;
+        }
+    }
+
+    std::sort(received.begin(), received.end());
+    int collisions = 0;
+    for (size_t i = 1; i < received.size(); i++)
+    {
+        if (received[i] - received[i - 1] < FRAME_MS)
+        {
+            collisions++;
+        }
+    }
+    return collisions;
+}
+
+// A few hundred sensors collide now and then on their own, and hardly
+// ever once they keep to their slots.
+void test_slots_avoid_collisions_in_fleet()
+{
+    const int sensors = 500;
+    int unslotted = simulateFleet(sensors, false);
+    int slotted = simulateFleet(sensors, true);
+    TEST_ASSERT_GREATER_THAN(10, unslotted);
+    TEST_ASSERT_LESS_THAN(unslotted / 10, slotted);
+}
+
+// Beyond SLOT_MAX_SENSORS, sensors are left alone.
+void test_full_table_leaves_sensors_alone()
+{
+    uint8_t mac[6];
+    for (int i = 0; i < SLOT_MAX_SENSORS; i++)
+    {
+        makeMac(mac, 5, i);
+        slotCorrection(mac, 60, 0);
+    }
+    makeMac(mac, 6, 0);
+    TEST_ASSERT_EQUAL_INT32(0, slotCorrection(mac, 60, 17000));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_sensor_moves_to_its_slot);
+    RUN_TEST(test_correction_wraps_around);
+    RUN_TEST(test_no_interval_no_correction);
+    RUN_TEST(test_drifting_sensors_spread_out);
+    RUN_TEST(test_slots_avoid_collisions_in_fleet);
+    RUN_TEST(test_full_table_leaves_sensors_alone);
+    return UNITY_END();
+}
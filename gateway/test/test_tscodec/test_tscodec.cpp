@@ -0,0 +1,129 @@
+#include <unity.h>
+#include "tscodec.h"
+#include "timeseries.h"
+
+static uint8_t data[TS_BLOCK_BYTES];
+
+// Every prefix class, at both of its edges, comes back as written and takes
+// the documented number of bits.
+void test_timestamp_sizes()
+{
+    const struct
+    {
+        int32_t dod;
+        uint16_t bits;
+    } cases[] = {
+        {0, 1}, {1, 9}, {-1, 9}, {63, 9}, {-64, 9}, {64, 12}, {-65, 12}, {255, 12}, {-256, 12},
+        {256, 16}, {-257, 16}, {2047, 16}, {-2048, 16}, {2048, 36}, {-2049, 36}, {INT32_MAX, 36}, {INT32_MIN, 36},
+    };
+    for (const auto &c : cases)
+    {
+        uint16_t pos = 3;
+        tsEncodeTimestamp(data, pos, c.dod);
+        TEST_ASSERT_EQUAL_UINT(3 + c.bits, pos);
+        pos = 3;
+        TEST_ASSERT_EQUAL_INT32(c.dod, tsDecodeTimestamp(data, pos));
+        TEST_ASSERT_EQUAL_UINT(3 + c.bits, pos);
+    }
+}
+
+void test_value_sizes()
+{
+    const struct
+    {
+        int32_t delta;
+        uint16_t bits;
+    } cases[] = {
+        {0, 1}, {1, 8}, {-1, 8}, {31, 8}, {-32, 8}, {32, 15}, {-33, 15}, {2047, 15}, {-2048, 15},
+        {2048, 35}, {-2049, 35}, {INT32_MAX, 35}, {INT32_MIN, 35},
+    };
+    for (const auto &c : cases)
+    {
+        uint16_t pos = 5;
+        tsEncodeValue(data, pos, c.delta);
+        TEST_ASSERT_EQUAL_UINT(5 + c.bits, pos);
+        pos = 5;
+        TEST_ASSERT_EQUAL_INT32(c.delta, tsDecodeValue(data, pos));
+        TEST_ASSERT_EQUAL_UINT(5 + c.bits, pos);
+    }
+}
+
+// Writing over old data leaves no stray bits behind.
+void test_overwrites_old_bits()
+{
+    memset(data, 0xff, sizeof(data));
+    uint16_t pos = 0;
+    tsEncodeValue(data, pos, 0);
+    tsEncodeValue(data, pos, 5);
+    pos = 0;
+    TEST_ASSERT_EQUAL_INT32(0, tsDecodeValue(data, pos));
+    TEST_ASSERT_EQUAL_INT32(5, tsDecodeValue(data, pos));
+}
+
+void test_worst_case_point()
+{
+    uint16_t pos = 0;
+    tsEncodeTimestamp(data, pos, INT32_MIN);
+    tsEncodeValue(data, pos, INT32_MIN);
+    tsEncodeValue(data, pos, INT32_MAX);
+    TEST_ASSERT_EQUAL_UINT(TS_MAX_POINT_BITS, pos);
+}
+
+// A block filled the way tsAppend does, from a sensor reporting every 15
+// minutes give or take a second, decodes to the same readings, at under ten
+// bits each.
+void test_block_round_trip()
+{
+    const int count = 200;
+    int32_t times[count], gravities[count], temps[count];
+    uint32_t seed = 1;
+    int32_t time = 1700000000;
+    for (int i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        time += 900 + (int32_t)(seed >> 16) % 3 - 1;
+        times[i] = time;
+        gravities[i] = 1050 - i / 8;
+        temps[i] = 195 + (i % 20 == 0 ? 1 : 0);
+    }
+
+    memset(data, 0, sizeof(data));
+    uint16_t pos = 0;
+    int32_t prevDelta = 0;
+    for (int i = 1; i < count; i++)
+    {
+        int32_t delta = times[i] - times[i - 1];
+        tsEncodeTimestamp(data, pos, delta - prevDelta);
+        tsEncodeValue(data, pos, gravities[i] - gravities[i - 1]);
+        tsEncodeValue(data, pos, temps[i] - temps[i - 1]);
+        prevDelta = delta;
+        TEST_ASSERT_TRUE(pos + TS_MAX_POINT_BITS <= TS_BLOCK_BYTES * 8);
+    }
+    TEST_ASSERT_LESS_THAN((count - 1) * 10, pos);
+
+    uint16_t end = pos;
+    pos = 0;
+    int32_t t = times[0], g = gravities[0], c = temps[0], delta = 0;
+    for (int i = 1; i < count; i++)
+    {
+        delta += tsDecodeTimestamp(data, pos);
+        t += delta;
+        g += tsDecodeValue(data, pos);
+        c += tsDecodeValue(data, pos);
+        TEST_ASSERT_EQUAL_INT32(times[i], t);
+        TEST_ASSERT_EQUAL_INT32(gravities[i], g);
+        TEST_ASSERT_EQUAL_INT32(temps[i], c);
+    }
+    TEST_ASSERT_EQUAL_UINT(end, pos);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_timestamp_sizes);
+    RUN_TEST(test_value_sizes);
+    RUN_TEST(test_overwrites_old_bits);
+    RUN_TEST(test_worst_case_point);
+    RUN_TEST(test_block_round_trip);
+    return UNITY_END();
+}
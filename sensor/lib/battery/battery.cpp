@@ -0,0 +1,73 @@
+#include "battery.h"
+
+// LiFePO4 state of charge against resting voltage. The curve is nearly flat
+// between 20% and 90%, so there the charge count does the work.
+static const struct
+{
+    int mv;
+    int percent;
+} dischargeCurve[] = {
+    {3400, 100}, {3350, 95}, {3320, 90}, {3300, 70}, {3280, 50},
+    {3250, 30}, {3200, 20}, {3100, 10}, {3000, 5}, {2800, 0},
+};
+
+float batteryChargeFromVoltage(int mv)
+{
+    const int points = sizeof(dischargeCurve) / sizeof(dischargeCurve[0]);
+    if (mv >= dischargeCurve[0].mv)
+    {
+        return BATTERY_CAPACITY;
+    }
+    for (int i = 1; i < points; i++)
+    {
+        if (mv >= dischargeCurve[i].mv)
+        {
+            float f = (float)(mv - dischargeCurve[i].mv) / (dischargeCurve[i - 1].mv - dischargeCurve[i].mv);
+            float percent = dischargeCurve[i].percent + f * (dischargeCurve[i - 1].percent - dischargeCurve[i].percent);
+            return BATTERY_CAPACITY * percent / 100;
+        }
+    }
+    return 0;
+}
+
+float batteryUpdateCharge(float charge, int mv)
+{
+    float fromCurve = batteryChargeFromVoltage(mv);
+    if (charge < 0)
+    {
+        return fromCurve;
+    }
+    if (fromCurve >= BATTERY_CAPACITY * 0.9 || fromCurve <= BATTERY_CAPACITY * 0.2)
+    {
+        return charge + (fromCurve - charge) * BATTERY_CURVE_WEIGHT;
+    }
+    return charge;
+}
+
+float batteryAverageCurrent(uint32_t awakeMs, long interval)
+{
+    float awake = awakeMs / 1000.0;
+    return SLEEP_CURRENT + awake * (AWAKE_CURRENT - SLEEP_CURRENT) / interval;
+}
+
+float batteryUsed(float uptime, long sleepSeconds)
+{
+    return (uptime * AWAKE_CURRENT + sleepSeconds * SLEEP_CURRENT) / 3600;
+}
+
+long batteryScheduledInterval(float charge, uint32_t targetSeconds, uint32_t awakeMs, long base, long last,
+                              long maxInterval)
+{
+    float budget = charge * 3600 / targetSeconds; // mA
+    float awake = awakeMs / 1000.0;
+    long needed = maxInterval;
+    if (budget > SLEEP_CURRENT)
+    {
+        needed = min((float)maxInterval, awake * (AWAKE_CURRENT - SLEEP_CURRENT) / (budget - SLEEP_CURRENT));
+    }
+    needed = max(needed, base);
+
+    long current = (last != 0) ? last : base;
+    current += (needed - current) / SCHEDULE_STEPS;
+    return min(current, maxInterval);
+}
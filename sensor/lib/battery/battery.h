@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Battery model for the runtime estimate and for stretching the interval to
+// reach a target end date, kept apart from main.cpp so it also builds on the
+// host, for the tests in the native environment. The state lives in RTC
+// memory and is passed in. Capacity in mAh, currents in mA.
+
+#define BATTERY_CAPACITY 600
+#define AWAKE_CURRENT 70
+#define SLEEP_CURRENT 0.02
+// How much the voltage curve corrects the charge count per wake, where the
+// curve is steep enough to be trusted.
+#define BATTERY_CURVE_WEIGHT 0.05
+// The interval moves this fraction of the way to the one the target needs
+// per wake, so it changes gradually instead of jumping.
+#define SCHEDULE_STEPS 8
+
+// Charge going by the resting voltage alone, in mAh.
+float batteryChargeFromVoltage(int mv);
+
+// The charge estimate after a wake at the given voltage. Starts from the
+// voltage curve when charge is negative, as after a battery change, and is
+// pulled towards the curve where the curve is steep.
+float batteryUpdateCharge(float charge, int mv);
+
+// Average current draw when awake for awakeMs every interval seconds, in mA.
+float batteryAverageCurrent(uint32_t awakeMs, long interval);
+
+// Charge used by a wake of uptime seconds and the sleep after it, in mAh.
+float batteryUsed(float uptime, long sleepSeconds);
+
+// The next interval on the way to the one that makes charge last for
+// targetSeconds, starting from last (0 for none). Never shorter than base
+// nor longer than maxInterval.
+long batteryScheduledInterval(float charge, uint32_t targetSeconds, uint32_t awakeMs, long base, long last,
+                              long maxInterval);
@@ -0,0 +1,70 @@
+#include "sampling.h"
+
+float samplingTilt(float ax, float az, float ay)
+{
+    if (ax == 0 && ay == 0 && az == 0)
+        return 0.f;
+
+    return acos(az / (sqrt(ax * ax + ay * ay + az * az))) * 180.0 / PI;
+}
+
+void samplingAdd(TiltSamples &samples, float tilt)
+{
+    if (samples.count >= MAX_SAMPLES)
+    {
+        return;
+    }
+    samples.values[samples.count++] = tilt;
+    float delta = tilt - samples.mean;
+    samples.mean += delta / samples.count;
+    samples.m2 += delta * (tilt - samples.mean);
+}
+
+bool samplingEnough(const TiltSamples &samples)
+{
+    if (samples.count >= MAX_SAMPLES)
+    {
+        return true;
+    }
+    if (samples.count < MIN_SAMPLES)
+    {
+        return false;
+    }
+    // Variance of the mean against the tolerance squared.
+    float variance = samples.m2 / (samples.count - 1);
+    return variance / samples.count <= TILT_TOLERANCE * TILT_TOLERANCE;
+}
+
+float samplingMedian(const TiltSamples &samples)
+{
+    int size = samples.count;
+    if (size == 0)
+    {
+        return 0;
+    }
+    float temp[MAX_SAMPLES];
+    for (int i = 0; i < size; i++)
+    {
+        temp[i] = samples.values[i];
+    }
+
+    // Simple bubble sort, there are only a few.
+    for (int i = 0; i < size - 1; i++)
+    {
+        for (int j = 0; j < size - i - 1; j++)
+        {
+            if (temp[j] > temp[j + 1])
+            {
+                float swap = temp[j];
+                temp[j] = temp[j + 1];
+                temp[j + 1] = swap;
+            }
+        }
+    }
+
+    if (size % 2 == 1)
+    {
+        return temp[size / 2];
+    }
+    return (temp[size / 2 - 1] + temp[size / 2]) / 2.0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Sequential sampling of the tilt: samples are taken until the standard
+// error of their mean is below TILT_TOLERANCE degrees, which on a still
+// sensor takes MIN_SAMPLES. A sensor moving about, e.g. from CO2 bubbling,
+// gets up to MAX_SAMPLES. Kept apart from main.cpp so that recorded traces
+// can be replayed through it on the host, in the native environment.
+
+#define MIN_SAMPLES 3
+#define MAX_SAMPLES 20
+#define TILT_TOLERANCE 0.05
+
+struct TiltSamples
+{
+    unsigned int count;
+    float values[MAX_SAMPLES];
+    // Running mean and sum of squared deviations (Welford).
+    float mean;
+    float m2;
+};
+
+// Tilt from the vertical, in degrees, of an accelerometer reading, or 0 if
+// the reading is all zeros.
+float samplingTilt(float ax, float az, float ay);
+
+void samplingAdd(TiltSamples &samples, float tilt);
+
+// Whether the samples taken pin the tilt down well enough, or there is no
+// room for more.
+bool samplingEnough(const TiltSamples &samples);
+
+// Median of the samples, to leave out the odd outlier.
+float samplingMedian(const TiltSamples &samples);
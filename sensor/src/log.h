@@ -0,0 +1,44 @@
+#pragma once
+
+// Compile-time filtered logging. Messages below LOG_LEVEL are removed by the
+// preprocessor, and with LOG_LEVEL_NONE (the production environment) the
+// sensor never even starts the UART, so no wake pays for Serial output.
+// A newline is appended to every message.
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_ENABLED (LOG_LEVEL > LOG_LEVEL_NONE)
+
+#define LOG_PRINT(format, ...) Serial.printf(format "\n", ##__VA_ARGS__)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOGE(...) LOG_PRINT(__VA_ARGS__)
+#else
+#define LOGE(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOGW(...) LOG_PRINT(__VA_ARGS__)
+#else
+#define LOGW(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOGI(...) LOG_PRINT(__VA_ARGS__)
+#else
+#define LOGI(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOGD(...) LOG_PRINT(__VA_ARGS__)
+#else
+#define LOGD(...) do {} while (0)
+#endif
@@ -1,9 +1,15 @@
 #include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
 #include <ESP8266httpUpdate.h>
 #include <espnow.h>
+#include <coredecls.h>
+#include <user_interface.h>
 #include <Wire.h>
 #include "MPU6050.h"
 #include "credentials.h"
+#include "log.h"
+#include "battery.h"
+#include "sampling.h"
 
 // Set ADC mode for voltage reading.
 ADC_MODE(ADC_VCC);
@@ -16,8 +22,39 @@ ADC_MODE(ADC_VCC);
 #define SDA_PIN 4
 #define SCL_PIN 5
 
-// number of tilt samples to average
-#define MAX_SAMPLES 5
+// The MPU keeps its registers through deep sleep, so wakes skip configuring
+// it when RTC memory says it was configured with MPU_CONFIG_VERSION and its
+// rate, filter and range registers read back as expected. Bump the version
+// whenever configureMpu() changes.
+#define MPU_CONFIG_VERSION 1
+#define MPU_ADDRESS 0x68
+#define MPU_REG_SMPLRT_DIV 0x19 // Followed by CONFIG, GYRO_CONFIG, ACCEL_CONFIG.
+
+// Samples taken while the sensor rotates faster than this, in degrees per
+// second, are discarded. After MAX_DISTURBED_SAMPLES of them the sensor
+// sleeps SETTLE_INTERVAL seconds and tries again, up to SETTLE_MAX_WAKES
+// times before it takes what it gets.
+#define GYRO_DISTURBANCE 4.0
+#define GYRO_LSB_PER_DPS 131.0 // At MPU6050_GYRO_FS_250.
+#define MAX_DISTURBED_SAMPLES 10
+#define SETTLE_INTERVAL 60
+#define SETTLE_MAX_WAKES 3
+
+// Wake on motion. Needs the MPU INT pin wired to RST, which resets the ESP
+// when the sensor is handled while asleep. It then reads again once things
+// settle instead of at the next scheduled wake. The ESP reports such a reset
+// as an ordinary deep sleep wake, so motion is told apart by waking more than
+// EARLY_WAKE_MARGIN percent before the sleep was due, going by the RTC timer. The MPU stays in its low
+// power cycle mode between wakes, checking for motion MOTION_WAKE_FREQ
+// times a second. Enable with -DMOTION_WAKE.
+#ifdef MOTION_WAKE
+#define MOTION_THRESHOLD 20 // 2 mg per unit.
+#define MOTION_WAKE_FREQ MPU6050_WAKE_FREQ_1P25
+// The data ready interrupt would reset the ESP too, so samples are timed
+// from the sample rate instead: 1 kHz / (1 + 17).
+#define SAMPLE_PERIOD 18
+#define EARLY_WAKE_MARGIN 10
+#endif
 
 // Normal interval should be long enough to stretch out battery life. Since
 // we're using the MPU temp sensor, we're probably going to see slower
@@ -28,42 +65,247 @@ ADC_MODE(ADC_VCC);
 // Here we define the RTC address to use and the number of iterations.
 // 60 iterations with an interval of 30 equals 30 minutes.
 #define CALIBRATION_INTERVAL 30
-#define RTC_ADDRESS 0
+#define RTC_ADDRESS RTC_USER_FIRST
 #define CALIBRATION_ITERATIONS 60
 #define CALIBRATION_TILT_ANGLE_MIN 170
 #define CALIBRATION_TILT_ANGLE_MAX 180
+// After a reset the sensor waits CALIBRATION_SETUP_TIME ms for being turned
+// upside down, which starts calibration mode. It deep sleeps in between,
+// looking again every FLIP_CHECK_INTERVAL ms, or at once when the MPU sees
+// motion with MOTION_WAKE.
 #define CALIBRATION_SETUP_TIME 30000
+#define FLIP_CHECK_INTERVAL 2000
 #define WIFI_TIMEOUT 10000
 
+// Limits for an interval set from the gateway, in seconds. Deep sleep on the
+// ESP8266 tops out at a little over three hours, so no interval, however it
+// was stretched, goes beyond MAX_INTERVAL.
+#define MIN_INTERVAL 10
+#define MAX_INTERVAL 10800
+
+// After sending, wait this long for the gateway to acknowledge the frame,
+// and then keep listening this long for commands, in ms.
+#define SEND_ACK_TIMEOUT 50
+#define DOWNLINK_WINDOW 30
+
+// RTC user memory is 128 blocks of 4 bytes. The first 32 hold the eboot
+// command with which Update.end() has the bootloader copy in a new image, so
+// anything written there after an update would cancel it.
+#define RTC_USER_FIRST 32
+#define RTC_USER_BLOCKS 128
+
+// State kept in RTC memory across deep sleep, after calibrationIterations.
+#define RTC_STATE_ADDRESS (RTC_ADDRESS + 1)
+#define RTC_STATE_MAGIC 0x5254430C
+
+// Readings are only sent when tilt or temperature moved by more than these
+// since the last one the gateway received, or after HEARTBEAT_WAKES wakes
+// without sending, so the gateway can tell a quiet sensor from a dead one.
+#define TILT_DEADBAND 0.2
+#define TEMP_DEADBAND 0.2
+#define HEARTBEAT_WAKES 4
+
+// Firmware updates served by the gateway. The AP must match otaApSSID and
+// otaApPassword in the gateway.
+// Without GATEWAY_OTA_PASS the sensor ignores OTA commands.
+#ifndef GATEWAY_OTA_SSID
+#define GATEWAY_OTA_SSID "TiltedGateway-OTA"
+#endif
+#define GATEWAY_OTA_URL "http://192.168.4.1/sensor/firmware"
+#define GATEWAY_PATCH_URL "http://192.168.4.1/sensor/patch"
+
+// Delta updates, see tools/sensorpatch. The patch is applied in chunks of
+// PATCH_CHUNK bytes, so RAM use does not depend on the image size.
+#define PATCH_MAGIC "TDP1"
+#define PATCH_VERSION_LEN 40
+#define PATCH_CHUNK 256
+#define PATCH_TIMEOUT 5000
+
+// Average current draw while updating over WiFi, in mA, for the energy
+// estimate reported after an update.
+#define OTA_CURRENT 80
+
 // When the battery cell (LiFePO4 in this case) gets this low,
 // the ESP switches to every LOW_VOLTAGE_MULTIPLIER*SLEEP_UPDATE_INTERVAL second updates.
 #define LOW_VOLTAGE_THRESHOLD 3000
 #define LOW_VOLTAGE_MULTIPLIER 4
 
+// Voltage is read once per wake and smoothed over this many wakes. The
+// battery model itself is in lib/battery.
+#define VOLTAGE_FILTER_WAKES 4
+
 // Version identifier for OTA.
 const char versionTimestamp[] = "TiltedSensor " __DATE__ " " __TIME__;
 
 // Low-pass filter coefficient (0 = no filtering, 1 = ignore new readings)
 #define FILTER_ALPHA 0.2
 
-// the following three settings must match the slave settings
+// the following settings must match the slave settings
 uint8_t remoteMac[] = {0x3A, 0x33, 0x33, 0x33, 0x33, 0x33};
-const uint8_t channel = 1;
+
+// The gateway sits on the channel of its WiFi AP. The sensor finds it by
+// sending on each channel until one is acknowledged, most common ones
+// first, and then sticks to that channel until CHANNEL_MAX_FAILURES frames
+// in a row go unacknowledged.
+static const uint8_t channelOrder[] = {1, 6, 11, 2, 3, 4, 5, 7, 8, 9, 10, 12, 13};
+#define CHANNEL_MAX_FAILURES 3
+// A search that finds nothing is only repeated after 1, 2, 4, ... up to
+// SEARCH_MAX_BACKOFF wakes, which send once on the last channel instead, so
+// a gateway that is down for a day does not cost a full search every wake.
+#define SEARCH_MAX_BACKOFF 16
+
+// RF calibration policy. Waking without calibration saves time and power,
+// but the stored calibration drifts with temperature. A full calibration is
+// done every RFCAL_EVERY_WAKES wakes, after the temperature moved
+// RFCAL_TEMP_DELTA degrees since the last one, and after a failed send.
+#define RFCAL_EVERY_WAKES 48
+#define RFCAL_TEMP_DELTA 5.0
 struct __attribute__((packed)) DataStruct
 {
 	float tilt;
 	float temp;
 	int volt;
 	long interval;
+	// Duration and estimated energy of the last firmware update, only sent
+	// on the first wake after it.
+	uint32_t otaMillis;
+	uint32_t otaEnergy; // mJ
+	uint32_t batteryHours; // Estimated remaining runtime.
+	uint32_t heartbeatWakes; // Longest run of wakes without a frame.
+	uint32_t samples; // Tilt samples taken.
+	uint32_t disturbed; // Samples discarded because the sensor was moving.
+	uint32_t seq; // Per frame, so gateways can drop relayed duplicates.
+	// Time and frames spent on the last channel search, sent until the
+	// gateway has them.
+	uint32_t discoveryMillis;
+	uint32_t discoveryProbes;
+	uint32_t rfCalibrated; // This wake started with a full RF calibration.
+	uint32_t firstSampleMillis; // From boot to the first MPU sample.
+	uint32_t mpuConfigured; // The MPU had to be configured this wake.
+	uint32_t flipWaitMillis; // Spent waiting for a flip after a reset.
 };
 
 DataStruct tiltData;
 
+// Commands from the gateway. This must match CommandFrame in the gateway.
+#define FRAME_COMMAND 0xC1
+#define DOWNLINK_MAX_COMMANDS 4
+
+enum Command : uint8_t
+{
+	COMMAND_SET_INTERVAL = 1,
+	COMMAND_CALIBRATION = 2,
+	COMMAND_OTA_CHECK = 3,
+	COMMAND_TARGET_RUNTIME = 4,
+	COMMAND_SLOT = 5 // Milliseconds to move the next wake by.
+};
+
+struct __attribute__((packed)) CommandEntry
+{
+	uint8_t command;
+	int32_t value;
+};
+
+struct __attribute__((packed)) CommandFrame
+{
+	uint8_t type;
+	uint8_t count;
+	CommandEntry commands[DOWNLINK_MAX_COMMANDS];
+};
+
+static CommandFrame commandFrame;
+static volatile bool commandsReceived = false;
+static volatile int sendStatus = -1; // -1 while waiting for the ack
+
+enum SendResult
+{
+	SEND_SKIPPED,
+	SEND_OK,
+	SEND_FAILED
+};
+static SendResult sendResult = SEND_SKIPPED;
+static bool otaRequested = false;
+// From the gateway, which spreads sensors over the interval so their frames
+// do not collide.
+static int32_t slotCorrection = 0;
+
+// Settings that survive deep sleep. RTC memory is garbage after a power
+// cycle, hence the magic and CRC.
+struct RtcState
+{
+	uint32_t magic;
+	uint32_t interval; // Set by the gateway, 0 for NORMAL_INTERVAL.
+	uint32_t otaMillis; // Last firmware update, until it has been reported.
+	uint32_t otaEnergy;
+	// Battery model.
+	int32_t voltage;          // Smoothed, mV. 0 until the first reading.
+	float charge;             // Remaining, mAh. Negative until estimated.
+	uint32_t awakeMs;         // Average time awake per wake.
+	uint32_t targetSeconds;   // Left until the target end date, 0 for none.
+	uint32_t scheduledInterval; // Interval stretched for the target, 0 if none.
+	// Last reading the gateway acknowledged, for send-on-change.
+	float sentTilt;           // 0 if none yet.
+	float sentTemp;
+	uint32_t quietWakes;      // Wakes since then.
+	// Gyro zero rate offset, learned from still wakes.
+	float gyroBias[3];
+	uint32_t gyroLearned;
+	uint32_t settleWakes;     // Wakes put off because the sensor was moving.
+	uint32_t seq;             // Of the last frame sent.
+	uint32_t channel;         // Where the gateway was found, 0 if not yet.
+	uint32_t sendFailures;    // Unacknowledged frames in a row.
+	uint32_t searchBackoff;   // Wakes between searches, 0 after a success.
+	uint32_t searchSkips;     // Wakes left until the next search.
+	uint32_t discoveryMillis;
+	uint32_t discoveryProbes;
+	// RF calibration, see rfCalibrationMode().
+	uint32_t wakesSinceRfCal;
+	float rfCalTemp;          // Temperature at the last calibration.
+	uint32_t rfCalibrated;    // Whether this wake was calibrated.
+	uint32_t mpuConfig;       // MPU_CONFIG_VERSION once the MPU is configured.
+	// Waiting for a flip into calibration mode after a reset.
+	uint32_t flipWaiting;
+	uint32_t flipWaitMs;      // Until it ended, until it has been reported.
+	// RTC timer when going to sleep, and for how long, to tell a motion wake
+	// from a scheduled one.
+	uint32_t sleepRtc;
+	uint32_t sleepMs;
+	uint32_t crc;
+};
+
+static RtcState rtcState;
+static_assert(RTC_STATE_ADDRESS * 4 + sizeof(RtcState) <= RTC_USER_BLOCKS * 4, "RtcState does not fit in RTC memory");
+
 // when we booted
-static unsigned long bootTime, wifiTime, mqttTime, sent, calibrationSetupStart, calibrationWifiStart = 0;
+static unsigned long bootTime, wifiTime, mqttTime, sent, calibrationWifiStart = 0;
 
 uint32_t calibrationIterations = 0;
 
+// Returns false if there was no valid state, i.e. after a power cycle.
+static bool loadRtcState()
+{
+	ESP.rtcUserMemoryRead(RTC_STATE_ADDRESS, (uint32_t *)&rtcState, sizeof(rtcState));
+	if (rtcState.magic != RTC_STATE_MAGIC ||
+		rtcState.crc != crc32(&rtcState, offsetof(RtcState, crc)))
+	{
+		LOGD("RTC state invalid, using defaults");
+		memset(&rtcState, 0, sizeof(rtcState));
+		rtcState.magic = RTC_STATE_MAGIC;
+		rtcState.charge = -1;
+		rtcState.awakeMs = 1000;
+		// Booting from power on always calibrates.
+		rtcState.rfCalibrated = 1;
+		return false;
+	}
+	return true;
+}
+
+static void saveRtcState()
+{
+	rtcState.crc = crc32(&rtcState, offsetof(RtcState, crc));
+	ESP.rtcUserMemoryWrite(RTC_STATE_ADDRESS, (uint32_t *)&rtcState, sizeof(rtcState));
+}
+
 // Sensor state variables
 enum SensorState {
     STATE_INIT,
@@ -80,9 +322,8 @@ RF_PRE_INIT()
 	bootTime = millis();
 }
 
-// Disable RF calibration after deep-sleep wake up.
-// This is probably not needed.
-//RF_MODE(RF_NO_CAL);
+// RF calibration after deep sleep is decided before each sleep, see
+// rfCalibrationMode().
 
 //------------------------------------------------------------
 static MPU6050 mpu;
@@ -104,52 +345,207 @@ static inline void ledOff()
 static void putMpuToSleep()
 {
 	mpu.setSleepEnabled(true);
-    Serial.println("MPU put to sleep");
+    LOGD("MPU put to sleep");
+}
+
+static void configureMpu()
+{
+	mpu.initialize();
+	mpu.setFullScaleAccelRange(MPU6050_ACCEL_FS_2);
+	mpu.setFullScaleGyroRange(MPU6050_GYRO_FS_250);
+	mpu.setDLPFMode(MPU6050_DLPF_BW_5);
+	mpu.setTempSensorEnabled(true);
+	mpu.setInterruptLatch(0); // pulse
+	mpu.setInterruptMode(1);  // Active Low
+	mpu.setInterruptDrive(1); // Open drain
+	mpu.setRate(17);
+#ifndef MOTION_WAKE
+	mpu.setIntDataReadyEnabled(true);
+#endif
+	rtcState.mpuConfig = MPU_CONFIG_VERSION;
+}
+
+// Whether the MPU still holds the configuration from configureMpu().
+static bool mpuConfigured()
+{
+	// SMPLRT_DIV, CONFIG, GYRO_CONFIG and ACCEL_CONFIG. The low bits of
+	// ACCEL_CONFIG are the motion detection filter, see armMotionWake().
+	static const uint8_t expected[4] = {17, MPU6050_DLPF_BW_5, MPU6050_GYRO_FS_250 << 3, MPU6050_ACCEL_FS_2 << 3};
+	if (rtcState.mpuConfig != MPU_CONFIG_VERSION)
+	{
+		return false;
+	}
+	Wire.beginTransmission(MPU_ADDRESS);
+	Wire.write(MPU_REG_SMPLRT_DIV);
+	if (Wire.endTransmission(false) != 0 || Wire.requestFrom(MPU_ADDRESS, 4) != 4)
+	{
+		return false;
+	}
+	uint8_t regs[4];
+	for (int i = 0; i < 4; i++)
+	{
+		regs[i] = Wire.read();
+	}
+	regs[3] &= 0xF8;
+	return memcmp(regs, expected, sizeof(regs)) == 0;
 }
 
-// Calculate tilt angle from accelerometer readings
-static float calculateTilt(float ax, float az, float ay)
+// Start measuring, from sleep or from the cycle mode used for wake on motion.
+static void wakeMpu()
 {
-	if (ax == 0 && ay == 0 && az == 0)
-		return 0.f;
+#ifdef MOTION_WAKE
+	// Back from cycle mode, see armMotionWake().
+	mpu.setWakeCycleEnabled(false);
+	mpu.setIntMotionEnabled(false);
+	mpu.setStandbyXGyroEnabled(false);
+	mpu.setStandbyYGyroEnabled(false);
+	mpu.setStandbyZGyroEnabled(false);
+	mpu.setTempSensorEnabled(true);
+#endif
+	mpu.setSleepEnabled(false);
+}
 
-	return acos(az / (sqrt(ax * ax + ay * ay + az * az))) * 180.0 / PI;
+#ifdef MOTION_WAKE
+// Leave the MPU in cycle mode with only the accelerometer and the motion
+// interrupt, which pulses INT and so RST.
+static void armMotionWake()
+{
+	mpu.setIntDataReadyEnabled(false);
+	mpu.setDHPFMode(MPU6050_DHPF_5);
+	mpu.setMotionDetectionThreshold(MOTION_THRESHOLD);
+	mpu.setMotionDetectionDuration(1);
+	mpu.setIntMotionEnabled(true);
+	mpu.setTempSensorEnabled(false);
+	mpu.setStandbyXGyroEnabled(true);
+	mpu.setStandbyYGyroEnabled(true);
+	mpu.setStandbyZGyroEnabled(true);
+	mpu.setWakeFrequency(MOTION_WAKE_FREQ);
+	mpu.setSleepEnabled(false);
+	mpu.setWakeCycleEnabled(true);
+	LOGD("MPU armed for wake on motion");
 }
+#endif
+
+//-----------------------------------------------------------------
+static int voltage = 0;
 
-// Apply median filter to remove outliers
-static float medianFilter(float values[], int size)
+static inline int readVoltage()
 {
-    // Create a copy of the array for sorting
-    float temp[size];
-    for (int i = 0; i < size; i++) {
-        temp[i] = values[i];
+    // One read per wake, smoothed across wakes in RTC memory, rather than
+    // several reads with delays in between on every wake.
+    int raw = ESP.getVcc();
+    if (rtcState.voltage == 0)
+    {
+        rtcState.voltage = raw;
     }
-    
-    // Simple bubble sort
-    for (int i = 0; i < size - 1; i++) {
-        for (int j = 0; j < size - i - 1; j++) {
-            if (temp[j] > temp[j + 1]) {
-                float swap = temp[j];
-                temp[j] = temp[j + 1];
-                temp[j + 1] = swap;
-            }
-        }
+    else
+    {
+        rtcState.voltage += (raw - rtcState.voltage) / VOLTAGE_FILTER_WAKES;
     }
-    
-    // Return middle value for odd-sized array
-    if (size % 2 == 1) {
-        return temp[size / 2];
-    } 
-    // Return average of two middle values for even-sized array
-    else {
-        return (temp[size / 2 - 1] + temp[size / 2]) / 2.0;
+    return (voltage = rtcState.voltage);
+}
+
+// Start the charge estimate from the voltage curve after a battery change,
+// and pull it towards the curve where the curve is steep.
+static void updateBattery()
+{
+    rtcState.charge = batteryUpdateCharge(rtcState.charge, voltage);
+}
+
+// Average current draw with the given interval, in mA.
+static float averageCurrent(long interval)
+{
+    return batteryAverageCurrent(rtcState.awakeMs, interval);
+}
+
+static uint32_t batteryHours()
+{
+    return (rtcState.charge > 0) ? rtcState.charge / averageCurrent(sleep_interval) : 0;
+}
+
+// Remember when the coming sleep started and how long it should last.
+static void recordSleep(int64_t sleepMs)
+{
+	rtcState.sleepRtc = system_get_rtc_time();
+	rtcState.sleepMs = sleepMs;
+}
+
+#ifdef MOTION_WAKE
+// Whether this deep sleep wake came well before the sleep was due. The RTC
+// timer keeps counting through deep sleep, in cycles of a calibrated period
+// (us << 12), and wraps after hours, well beyond MAX_INTERVAL.
+static bool wokeEarly(bool rtcValid)
+{
+	if (!rtcValid || rtcState.sleepMs == 0 || ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE)
+	{
+		return false;
+	}
+	uint32_t cycles = system_get_rtc_time() - rtcState.sleepRtc;
+	uint64_t sleptMs = ((uint64_t)cycles * system_rtc_clock_cali_proc() >> 12) / 1000;
+	LOGD("Slept %u of %u ms", (uint32_t)sleptMs, rtcState.sleepMs);
+	return sleptMs * 100 < (uint64_t)rtcState.sleepMs * (100 - EARLY_WAKE_MARGIN);
+}
+#endif
+
+// Count the charge used by this wake and the coming sleep, right before
+// sleeping.
+static void accountBattery(float uptime, long willsleep)
+{
+    if (rtcState.charge > 0)
+    {
+        rtcState.charge = max(rtcState.charge - batteryUsed(uptime, willsleep), 0.f);
+    }
+    // Leave the long first boot out of the average.
+    if (uptime * 1000 < WAKE_TIMEOUT)
+    {
+        rtcState.awakeMs += ((long)(uptime * 1000) - (long)rtcState.awakeMs) / 8;
+    }
+    if (rtcState.targetSeconds != 0)
+    {
+        uint32_t elapsed = willsleep + uptime;
+        rtcState.targetSeconds = (rtcState.targetSeconds > elapsed) ? rtcState.targetSeconds - elapsed : 0;
     }
+    saveRtcState();
+}
+
+// Decide whether the next wake calibrates the radio.
+static RFMode rfCalibrationMode()
+{
+	bool calibrate = rtcState.wakesSinceRfCal + 1 >= RFCAL_EVERY_WAKES || sendResult == SEND_FAILED ||
+					 (tiltData.temp != 0 && fabs(tiltData.temp - rtcState.rfCalTemp) >= RFCAL_TEMP_DELTA);
+	if (calibrate)
+	{
+		rtcState.wakesSinceRfCal = 0;
+		if (tiltData.temp != 0)
+		{
+			rtcState.rfCalTemp = tiltData.temp;
+		}
+	}
+	else
+	{
+		rtcState.wakesSinceRfCal++;
+	}
+	rtcState.rfCalibrated = calibrate;
+	return calibrate ? WAKE_RFCAL : WAKE_NO_RFCAL;
 }
 
 static void actuallySleep()
 {
     // Put MPU to sleep if not already done
+#ifdef MOTION_WAKE
+    // Not while waiting for the sensor to settle, or in calibration mode,
+    // where it is handled on purpose.
+    if (rtcState.settleWakes == 0 && sleep_interval != CALIBRATION_INTERVAL)
+    {
+        armMotionWake();
+    }
+    else
+    {
+        putMpuToSleep();
+    }
+#else
     putMpuToSleep();
+#endif
     
     // Turn off WiFi completely to save power
     WiFi.mode(WIFI_OFF);
@@ -159,36 +555,190 @@ static void actuallySleep()
     double uptime = (millis() - bootTime) / 1000.;
 
     long willsleep = sleep_interval - uptime;
+    int64_t sleepMs = (int64_t)sleep_interval * 1000 - (millis() - bootTime);
     if (willsleep <= sleep_interval / 2)
     {
         // If we somehow ended up awake longer than half a sleep interval,
         // sleep longer. This shouldn't happen in practice.
         willsleep = sleep_interval;
+        sleepMs = (int64_t)sleep_interval * 1000;
     }
-    Serial.printf("bootTime: %ld WifiTime: %ld mqttTime: %ld\n", bootTime, wifiTime, mqttTime);
-    Serial.printf("Deep sleeping %ld seconds after %.3g awake\n", willsleep, uptime);
+    // Move towards our transmit slot, by no more than half the sleep.
+    int64_t maxCorrection = sleepMs / 2;
+    sleepMs += max(-maxCorrection, min((int64_t)slotCorrection, maxCorrection));
+    static const char *sendResults[] = {"skipped", "ok", "failed"};
+    LOGI("RF calibrated: %s, send: %s, awake: %lu ms",
+         rtcState.rfCalibrated ? "yes" : "no", sendResults[sendResult], millis() - bootTime);
+    RFMode rfMode = rfCalibrationMode();
+    recordSleep(sleepMs);
+    accountBattery(uptime, willsleep);
+    LOGD("bootTime: %ld WifiTime: %ld mqttTime: %ld", bootTime, wifiTime, mqttTime);
+    LOGI("Deep sleeping %ld seconds after %.3g awake%s", willsleep, uptime,
+         rfMode == WAKE_RFCAL ? ", calibrating RF on wake" : "");
+
+    ESP.deepSleepInstant(sleepMs * 1000, rfMode);
+}
+
 
-    ESP.deepSleepInstant(willsleep * 1000000, WAKE_NO_RFCAL);
+//--------------------------------------------------------------
+// ESP-NOW callbacks, run from the SDK between calls to delay().
+static void sendCallback(uint8_t *mac, uint8_t status)
+{
+	sendStatus = status;
 }
 
-//-----------------------------------------------------------------
-static int voltage = 0;
+static void receiveCallback(uint8_t *mac, uint8_t *data, uint8_t len)
+{
+	if (commandsReceived || memcmp(mac, remoteMac, 6) != 0 ||
+		len < offsetof(CommandFrame, commands) || data[0] != FRAME_COMMAND)
+	{
+		return;
+	}
+	uint8_t count = data[1];
+	if (count > DOWNLINK_MAX_COMMANDS ||
+		len < offsetof(CommandFrame, commands) + count * sizeof(CommandEntry))
+	{
+		return;
+	}
+	memcpy(&commandFrame, data, offsetof(CommandFrame, commands) + count * sizeof(CommandEntry));
+	commandsReceived = true;
+}
 
-static inline int readVoltage()
+// Give the gateway a moment to answer with commands. Only worth it if the
+// gateway actually heard us.
+static void waitForCommands()
 {
-    // Read voltage multiple times and average for better accuracy
-    const int readings = 3;
-    int sum = 0;
-    for (int i = 0; i < readings; i++) {
-        sum += ESP.getVcc();
-        delay(5);
-    }
-    return (voltage = sum / readings);
+	unsigned long start = millis();
+	while (!commandsReceived && (millis() - start) < DOWNLINK_WINDOW)
+	{
+		delay(1);
+	}
+}
+
+// Send the frame on a channel and wait for the gateway's MAC layer ack.
+static bool sendOnChannel(uint8_t channel, uint8_t *data, size_t len)
+{
+	wifi_set_channel(channel);
+	esp_now_del_peer(remoteMac);
+	esp_now_add_peer(remoteMac, ESP_NOW_ROLE_COMBO, channel, NULL, 0);
+
+	sendStatus = -1;
+	esp_now_send(remoteMac, data, len);
+	unsigned long start = millis();
+	while (sendStatus < 0 && (millis() - start) < SEND_ACK_TIMEOUT)
+	{
+		delay(1);
+	}
+	return sendStatus == 0;
+}
+
+// Send on the known channel, or look for the gateway on all of them.
+static bool sendFrame(uint8_t *data, size_t len)
+{
+	if ((rtcState.channel != 0 && rtcState.sendFailures < CHANNEL_MAX_FAILURES) || rtcState.searchSkips > 0)
+	{
+		uint8_t channel = (rtcState.channel != 0) ? rtcState.channel : channelOrder[0];
+		if (sendOnChannel(channel, data, len))
+		{
+			rtcState.channel = channel;
+			rtcState.sendFailures = 0;
+			rtcState.searchBackoff = 0;
+			rtcState.searchSkips = 0;
+			return true;
+		}
+		if (rtcState.searchSkips > 0)
+		{
+			rtcState.searchSkips--;
+		}
+		rtcState.sendFailures++;
+		LOGD("Frame not acknowledged on channel %u", channel);
+		return false;
+	}
+
+	unsigned long start = millis();
+	uint32_t probes = 0;
+	for (uint8_t channel : channelOrder)
+	{
+		probes++;
+		if (sendOnChannel(channel, data, len))
+		{
+			rtcState.channel = channel;
+			rtcState.sendFailures = 0;
+			rtcState.searchBackoff = 0;
+			// Reported with the next frame.
+			rtcState.discoveryMillis = millis() - start;
+			rtcState.discoveryProbes = probes;
+			LOGI("Found gateway on channel %u after %u ms", channel, rtcState.discoveryMillis);
+			return true;
+		}
+	}
+	rtcState.searchBackoff = constrain(rtcState.searchBackoff * 2, 1, SEARCH_MAX_BACKOFF);
+	rtcState.searchSkips = rtcState.searchBackoff;
+	LOGW("No gateway found on any channel, searching again in %u wakes", rtcState.searchBackoff);
+	return false;
 }
 
 //--------------------------------------------------------------
-static unsigned int nsamples = 0;
-static float samples[MAX_SAMPLES];
+static TiltSamples samples = {};
+static bool samplingDone = false;
+static unsigned int ndisturbed = 0;
+// Gyro readings of the samples kept, for learning the bias.
+static float gyroSum[3] = {0, 0, 0};
+static unsigned long lastSampleTime = 0;
+static unsigned long firstSampleTime = 0;
+static bool mpuFullInit = false;
+
+// Whether the sensor is rotating, going by the gyro minus its learned
+// offset. Until the offset is known nothing counts as disturbed, and in
+// calibration mode the sensor is handled on purpose.
+static bool isDisturbed(const int16_t *gyro)
+{
+	if (!rtcState.gyroLearned || rtcState.settleWakes >= SETTLE_MAX_WAKES ||
+		sleep_interval == CALIBRATION_INTERVAL)
+	{
+		return false;
+	}
+	float squares = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		float rate = (gyro[i] - rtcState.gyroBias[i]) / GYRO_LSB_PER_DPS;
+		squares += rate * rate;
+	}
+	return squares > GYRO_DISTURBANCE * GYRO_DISTURBANCE;
+}
+
+// Move the gyro offset towards the average of this wake's kept samples.
+static void learnGyroBias()
+{
+	if (samples.count == 0)
+	{
+		return;
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		float mean = gyroSum[i] / samples.count;
+		rtcState.gyroBias[i] = rtcState.gyroLearned ? rtcState.gyroBias[i] + (mean - rtcState.gyroBias[i]) / 2 : mean;
+	}
+	rtcState.gyroLearned = 1;
+}
+
+static bool sampleReady()
+{
+#ifdef MOTION_WAKE
+	return millis() - lastSampleTime >= SAMPLE_PERIOD;
+#else
+	return mpu.getIntDataReadyStatus();
+#endif
+}
+
+// Put the reading off for a moment, the sensor is being moved.
+static void settle()
+{
+	rtcState.settleWakes++;
+	LOGI("Sensor is moving, reading again in %d s", SETTLE_INTERVAL);
+	sleep_interval = SETTLE_INTERVAL;
+	currentState = STATE_SLEEPING;
+}
 static float temperature = 0.0;
 
 float round1(float value)
@@ -196,17 +746,44 @@ float round1(float value)
 	return (int)(value * 10 + 0.5) / 10.0;
 }
 
-static void sendSensorData()
+static void prepareSensorData()
 {
-    Serial.println("Processing and sending data...");
-
     // Apply median filter to samples to remove outliers
-    float filteredValue = medianFilter(samples, nsamples);
+    float filteredValue = samplingMedian(samples);
     
     tiltData.tilt = round1(filteredValue);
     tiltData.temp = round1(temperature);
     tiltData.volt = voltage;
     tiltData.interval = sleep_interval;
+    tiltData.otaMillis = rtcState.otaMillis;
+    tiltData.otaEnergy = rtcState.otaEnergy;
+    tiltData.batteryHours = batteryHours();
+    tiltData.heartbeatWakes = HEARTBEAT_WAKES;
+    tiltData.samples = samples.count;
+    tiltData.disturbed = ndisturbed;
+    tiltData.firstSampleMillis = firstSampleTime - bootTime;
+    tiltData.mpuConfigured = mpuFullInit;
+    LOGD("First sample %lu ms after boot, MPU %s", firstSampleTime - bootTime,
+         mpuFullInit ? "configured" : "already configured");
+    learnGyroBias();
+    rtcState.settleWakes = 0;
+}
+
+// Whether this reading is worth powering up the radio for.
+static bool readingChanged()
+{
+    if (sleep_interval == CALIBRATION_INTERVAL || rtcState.otaMillis != 0 || rtcState.sentTilt == 0 ||
+        rtcState.quietWakes + 1 >= HEARTBEAT_WAKES)
+    {
+        return true;
+    }
+    return fabs(tiltData.tilt - rtcState.sentTilt) >= TILT_DEADBAND ||
+           fabs(tiltData.temp - rtcState.sentTemp) >= TEMP_DEADBAND;
+}
+
+static void sendSensorData()
+{
+    LOGD("Sending data...");
 
     // Initialize WiFi in STA mode
     WiFi.forceSleepWake();
@@ -227,24 +804,57 @@ static void sendSensorData()
     }
     
     if (!init_success) {
-        Serial.println("ESP-NOW init failed, sleeping without sending data");
+        LOGE("ESP-NOW init failed, sleeping without sending data");
         actuallySleep();
         return;
     }
 
-    esp_now_set_self_role(ESP_NOW_ROLE_CONTROLLER);
-    esp_now_add_peer(remoteMac, ESP_NOW_ROLE_SLAVE, channel, NULL, 0);
+    // Combo, since the gateway may answer with commands.
+    esp_now_set_self_role(ESP_NOW_ROLE_COMBO);
+    esp_now_register_send_cb(sendCallback);
+    esp_now_register_recv_cb(receiveCallback);
 
     wifiTime = millis();
 
+    // Never 0, which the gateway takes as no sequence number.
+    tiltData.seq = ++rtcState.seq ? rtcState.seq : ++rtcState.seq;
+    tiltData.discoveryMillis = rtcState.discoveryMillis;
+    tiltData.discoveryProbes = rtcState.discoveryProbes;
+    tiltData.rfCalibrated = rtcState.rfCalibrated;
+    tiltData.flipWaitMillis = rtcState.flipWaiting ? 0 : rtcState.flipWaitMs;
+
     uint8_t bs[sizeof(tiltData)];
     memcpy(bs, &tiltData, sizeof(tiltData));
 
-    esp_now_send(NULL, bs, sizeof(tiltData)); // NULL means send to all peers
+    bool acknowledged = sendFrame(bs, sizeof(tiltData));
+    sendResult = acknowledged ? SEND_OK : SEND_FAILED;
     sent = millis();
     mqttTime = millis();
+
+    if (acknowledged)
+    {
+        waitForCommands();
+
+        rtcState.sentTilt = tiltData.tilt;
+        rtcState.sentTemp = tiltData.temp;
+        rtcState.quietWakes = 0;
+
+        // Only report an update or a channel search once, and only once
+        // the gateway has it. A search made for this very frame goes out
+        // with the next one.
+        rtcState.otaMillis = 0;
+        rtcState.otaEnergy = 0;
+        if (rtcState.discoveryMillis == tiltData.discoveryMillis &&
+            rtcState.discoveryProbes == tiltData.discoveryProbes)
+        {
+            rtcState.discoveryMillis = 0;
+            rtcState.discoveryProbes = 0;
+        }
+        rtcState.flipWaitMs = 0;
+    }
+    saveRtcState();
     
-    Serial.println("Data sent, preparing to sleep");
+    LOGD("Data sent, preparing to sleep");
     
     // Clean up ESP-NOW to save power
     esp_now_deinit();
@@ -255,6 +865,7 @@ static void sendSensorData()
 void calibrationMode(bool firstIteration)
 {
 	readVoltage();
+	updateBattery();
 	sleep_interval = CALIBRATION_INTERVAL;
 	if (firstIteration)
 	{
@@ -272,54 +883,434 @@ static bool isCalibrationMode()
 	return (calibrationIterations != 0) ? true : false;
 }
 
-void normalMode()
+// Whether the sensor is upside down, asking for calibration mode.
+static bool isFlipped()
 {
-	readVoltage();
-	Serial.println(voltage);
+	unsigned long start = millis();
+	while (!sampleReady() && millis() - start < 100)
+	{
+		delay(1);
+	}
+	int16_t ax, ay, az;
+	mpu.getAcceleration(&ax, &az, &ay);
+	float tilt = samplingTilt(ax, az, ay);
+	return tilt > CALIBRATION_TILT_ANGLE_MIN && tilt < CALIBRATION_TILT_ANGLE_MAX;
+}
+
+// One look at the sensor while waiting for a flip. Returns whether it is
+// flipped, once it is or the time is up. Otherwise deep sleeps until the
+// next look, without RF calibration since the radio stays off.
+static bool waitForFlip()
+{
+	bool flipped = isFlipped();
+	rtcState.flipWaitMs += millis() - bootTime;
+	if (flipped || rtcState.flipWaitMs >= CALIBRATION_SETUP_TIME)
+	{
+		rtcState.flipWaiting = 0;
+		LOGI("%s after waiting %u ms", flipped ? "Flipped" : "Not flipped", rtcState.flipWaitMs);
+		return flipped;
+	}
+
+	// Counted in full even if motion cuts the sleep short.
+	rtcState.flipWaitMs += FLIP_CHECK_INTERVAL;
+#ifdef MOTION_WAKE
+	armMotionWake();
+#else
+	putMpuToSleep();
+#endif
+	rtcState.rfCalibrated = 0;
+	recordSleep(FLIP_CHECK_INTERVAL);
+	saveRtcState();
+	ESP.deepSleepInstant(FLIP_CHECK_INTERVAL * 1000, WAKE_NO_RFCAL);
+	return false;
+}
+
+// Interval needed to last until the target end date, moved gradually from
+// the last one. Never shorter than the interval set from the gateway.
+static long scheduledInterval(long base)
+{
+	rtcState.scheduledInterval = batteryScheduledInterval(rtcState.charge, rtcState.targetSeconds, rtcState.awakeMs,
+														  base, rtcState.scheduledInterval, MAX_INTERVAL);
+	return rtcState.scheduledInterval;
+}
+
+// Sleep interval outside calibration, as set from the gateway and stretched
+// to meet the target end date, if any.
+static void setNormalInterval()
+{
+	sleep_interval = (rtcState.interval != 0) ? rtcState.interval : NORMAL_INTERVAL;
+	if (rtcState.targetSeconds != 0 && rtcState.charge > 0)
+	{
+		sleep_interval = scheduledInterval(sleep_interval);
+		LOGD("Interval %ld s to reach the target in %u s", sleep_interval, rtcState.targetSeconds);
+		return;
+	}
+	rtcState.scheduledInterval = 0;
 	bool lowv = !(voltage != 0 && voltage > LOW_VOLTAGE_THRESHOLD);
 	if (lowv)
 	{
-		Serial.println("Voltage below threshold, sleeping longer");
-		sleep_interval *= LOW_VOLTAGE_MULTIPLIER;
+		LOGW("Voltage below threshold, sleeping longer");
+		sleep_interval = min(sleep_interval * LOW_VOLTAGE_MULTIPLIER, (long)MAX_INTERVAL);
+	}
+}
+
+void normalMode()
+{
+	readVoltage();
+	updateBattery();
+	LOGD("Voltage: %d mV, %.0f mAh left", voltage, rtcState.charge);
+	setNormalInterval();
+}
+
+// Apply commands received from the gateway. Interval and calibration changes
+// already count for the coming sleep.
+static void applyCommands()
+{
+	for (int i = 0; i < commandFrame.count; i++)
+	{
+		const CommandEntry &entry = commandFrame.commands[i];
+		switch (entry.command)
+		{
+		case COMMAND_SET_INTERVAL:
+			rtcState.interval = (entry.value == 0) ? 0 : constrain(entry.value, MIN_INTERVAL, MAX_INTERVAL);
+			saveRtcState();
+			LOGI("Interval set to %u s", rtcState.interval);
+			if (sleep_interval != CALIBRATION_INTERVAL)
+			{
+				setNormalInterval();
+			}
+			break;
+		case COMMAND_CALIBRATION:
+			if (entry.value)
+			{
+				LOGI("Calibration mode started by gateway");
+				calibrationMode(true);
+			}
+			else
+			{
+				LOGI("Calibration mode stopped by gateway");
+				calibrationIterations = 0;
+				ESP.rtcUserMemoryWrite(RTC_ADDRESS, &calibrationIterations, sizeof(calibrationIterations));
+				setNormalInterval();
+			}
+			break;
+		case COMMAND_OTA_CHECK:
+			otaRequested = true;
+			break;
+		case COMMAND_SLOT:
+			slotCorrection = entry.value;
+			LOGD("Moving next wake by %d ms", entry.value);
+			break;
+		case COMMAND_TARGET_RUNTIME:
+			rtcState.targetSeconds = constrain(entry.value, 0, 100000) * 3600;
+			rtcState.scheduledInterval = 0;
+			saveRtcState();
+			LOGI("Target runtime set to %d hours", entry.value);
+			if (sleep_interval != CALIBRATION_INTERVAL)
+			{
+				setNormalInterval();
+			}
+			break;
+		default:
+			LOGW("Unknown command %u", entry.command);
+			break;
+		}
 	}
 }
 
-void wifiConnect()
+void wifiConnect(const char *ssid, const char *pass)
 {
     WiFi.forceSleepWake();
     delay(1);
     WiFi.mode(WIFI_STA);
-    WiFi.begin(WIFI_SSID, WIFI_PASS);
+    WiFi.begin(ssid, pass);
 
     calibrationWifiStart = millis();
     while (WiFi.status() != WL_CONNECTED && (millis() - calibrationWifiStart) < WIFI_TIMEOUT)
     {
         delay(250);
-        Serial.print(".");
     }
 
-    Serial.print("\nWiFi connected, IP address: ");
-    Serial.println(WiFi.localIP());
+    LOGI("WiFi connected, IP address: %s", WiFi.localIP().toString().c_str());
 }
 
 void checkOTAUpdate()
 {
 	WiFiClient wifiClient;
-	wifiConnect();
+	wifiConnect(WIFI_SSID, WIFI_PASS);
 
 	t_httpUpdate_return ret = ESPhttpUpdate.update(wifiClient, OTA_SERVER, OTA_PORT, OTA_PATH, versionTimestamp);
 	switch (ret)
 	{
 	case HTTP_UPDATE_FAILED:
-		Serial.println("[OTA] Update failed.");
+		LOGW("[OTA] Update failed.");
+		break;
+	case HTTP_UPDATE_NO_UPDATES:
+		LOGI("[OTA] No update available.");
+		break;
+	case HTTP_UPDATE_OK:
+		LOGI("[OTA] Update ok."); // may not be called since we reboot the ESP
+		break;
+	}
+}
+
+//--------------------------------------------------------------
+// Delta updates. This must match the format written by tools/sensorpatch.
+struct __attribute__((packed)) PatchHeader
+{
+	char magic[4];
+	char fromVersion[PATCH_VERSION_LEN];
+	char toVersion[PATCH_VERSION_LEN];
+	uint32_t oldSize;
+	char oldMd5[32];
+	uint32_t newSize;
+	char newMd5[32];
+};
+
+enum PatchOp : uint8_t
+{
+	PATCH_END = 0,
+	PATCH_COPY = 1,
+	PATCH_ADD = 2,
+	PATCH_INSERT = 3
+};
+
+static bool readExact(Stream &stream, uint8_t *data, size_t len)
+{
+	return stream.readBytes(data, len) == len;
+}
+
+static bool readVarint(Stream &stream, uint32_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35; shift += 7)
+	{
+		uint8_t b;
+		if (!readExact(stream, &b, 1))
+		{
+			return false;
+		}
+		value |= (uint32_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Copy len bytes of the running image, optionally adding a difference read
+// from the patch, into the update.
+static bool patchFromFlash(Stream &stream, uint32_t offset, uint32_t len, bool add)
+{
+	uint8_t buffer[PATCH_CHUNK];
+	uint8_t diff[PATCH_CHUNK];
+	while (len > 0)
+	{
+		size_t n = min(len, (uint32_t)PATCH_CHUNK);
+		if (!ESP.flashRead(offset, buffer, n))
+		{
+			return false;
+		}
+		if (add)
+		{
+			if (!readExact(stream, diff, n))
+			{
+				return false;
+			}
+			for (size_t i = 0; i < n; i++)
+			{
+				buffer[i] += diff[i];
+			}
+		}
+		if (Update.write(buffer, n) != n)
+		{
+			return false;
+		}
+		offset += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool patchFromStream(Stream &stream, uint32_t len)
+{
+	uint8_t buffer[PATCH_CHUNK];
+	while (len > 0)
+	{
+		size_t n = min(len, (uint32_t)PATCH_CHUNK);
+		if (!readExact(stream, buffer, n) || Update.write(buffer, n) != n)
+		{
+			return false;
+		}
+		len -= n;
+	}
+	return true;
+}
+
+// Rebuild the new image into the update area from our own flash and the
+// patch. Update.end() checks the MD5 of the result before it is committed.
+static bool applyPatch(Stream &stream)
+{
+	PatchHeader header;
+	if (!readExact(stream, (uint8_t *)&header, sizeof(header)) || memcmp(header.magic, PATCH_MAGIC, 4) != 0)
+	{
+		LOGW("[OTA] Not a patch");
+		return false;
+	}
+	// The patch only fits the exact image it was made against.
+	if (header.oldSize != ESP.getSketchSize() || memcmp(header.oldMd5, ESP.getSketchMD5().c_str(), 32) != 0)
+	{
+		LOGW("[OTA] Patch is for a different image");
+		return false;
+	}
+	if (!Update.begin(header.newSize))
+	{
+		return false;
+	}
+	char newMd5[33];
+	memcpy(newMd5, header.newMd5, 32);
+	newMd5[32] = '\0';
+	Update.setMD5(newMd5);
+
+	for (;;)
+	{
+		uint8_t op;
+		uint32_t offset, len;
+		if (!readExact(stream, &op, 1))
+		{
+			break;
+		}
+		if (op == PATCH_END)
+		{
+			return Update.end();
+		}
+		if (op == PATCH_INSERT)
+		{
+			if (!readVarint(stream, len) || !patchFromStream(stream, len))
+			{
+				break;
+			}
+			continue;
+		}
+		if ((op != PATCH_COPY && op != PATCH_ADD) || !readVarint(stream, offset) || !readVarint(stream, len) ||
+			offset + len > header.oldSize)
+		{
+			break;
+		}
+		if (op == PATCH_COPY)
+		{
+			if (!patchFromFlash(stream, offset, len, false))
+			{
+				break;
+			}
+			continue;
+		}
+		// ADD: runs of unchanged bytes alternating with runs of differences.
+		bool ok = true;
+		for (uint32_t done = 0; ok && done < len;)
+		{
+			uint32_t same, changed;
+			ok = readVarint(stream, same) && readVarint(stream, changed) && done + same + changed <= len &&
+				 patchFromFlash(stream, offset + done, same, false) &&
+				 patchFromFlash(stream, offset + done + same, changed, true);
+			done += same + changed;
+		}
+		if (!ok)
+		{
+			break;
+		}
+	}
+
+	// Incomplete, so this throws the partial image away.
+	Update.end();
+	LOGW("[OTA] Applying patch failed");
+	return false;
+}
+
+enum PatchResult
+{
+	PATCH_APPLIED,
+	PATCH_NO_UPDATES,
+	PATCH_UNAVAILABLE
+};
+
+static PatchResult gatewayPatchUpdate(WiFiClient &wifiClient)
+{
+	HTTPClient http;
+	http.begin(wifiClient, GATEWAY_PATCH_URL);
+	http.setTimeout(PATCH_TIMEOUT);
+	http.addHeader("x-ESP8266-STA-MAC", WiFi.macAddress());
+	http.addHeader("x-ESP8266-sketch-md5", ESP.getSketchMD5());
+	http.addHeader("x-ESP8266-version", versionTimestamp);
+
+	PatchResult result = PATCH_UNAVAILABLE;
+	int code = http.GET();
+	if (code == HTTP_CODE_NOT_MODIFIED)
+	{
+		result = PATCH_NO_UPDATES;
+	}
+	else if (code == HTTP_CODE_OK)
+	{
+		Stream &stream = http.getStream();
+		stream.setTimeout(PATCH_TIMEOUT);
+		result = applyPatch(stream) ? PATCH_APPLIED : PATCH_UNAVAILABLE;
+	}
+	http.end();
+	return result;
+}
+
+// Fetch firmware from the gateway's soft AP, which it opens after telling us
+// to update. The updater checks the image against the MD5 the gateway sends
+// before switching to it. Time and energy spent are kept in RTC memory and
+// reported on the next wake.
+void checkGatewayOTAUpdate()
+{
+#ifndef GATEWAY_OTA_PASS
+	LOGW("[OTA] GATEWAY_OTA_PASS not set in credentials.h, ignoring the update command.");
+#else
+	unsigned long start = millis();
+	WiFiClient wifiClient;
+	wifiConnect(GATEWAY_OTA_SSID, GATEWAY_OTA_PASS);
+
+	// Try a patch first, and only fall back to the full image if there is
+	// none for this version or it did not work out.
+	t_httpUpdate_return ret;
+	switch (gatewayPatchUpdate(wifiClient))
+	{
+	case PATCH_APPLIED:
+		ret = HTTP_UPDATE_OK;
+		break;
+	case PATCH_NO_UPDATES:
+		ret = HTTP_UPDATE_NO_UPDATES;
+		break;
+	default:
+		LOGI("[OTA] No usable patch, fetching the full image.");
+		ESPhttpUpdate.rebootOnUpdate(false);
+		ret = ESPhttpUpdate.update(wifiClient, GATEWAY_OTA_URL, versionTimestamp);
+		break;
+	}
+	switch (ret)
+	{
+	case HTTP_UPDATE_FAILED:
+		LOGW("[OTA] Update from gateway failed: %s", ESPhttpUpdate.getLastErrorString().c_str());
 		break;
 	case HTTP_UPDATE_NO_UPDATES:
-		Serial.println("[OTA] No update available.");
+		LOGI("[OTA] Gateway has no newer firmware.");
 		break;
 	case HTTP_UPDATE_OK:
-		Serial.println("[OTA] Update ok."); // may not be called since we reboot the ESP
+		rtcState.otaMillis = millis() - start;
+		rtcState.otaEnergy = (uint64_t)rtcState.otaMillis * OTA_CURRENT * readVoltage() / 1000000;
+		if (rtcState.charge > 0)
+		{
+			rtcState.charge = max(rtcState.charge - (float)rtcState.otaMillis * OTA_CURRENT / 3600000, 0.f);
+		}
+		saveRtcState();
+		LOGI("[OTA] Updated from gateway in %u ms, rebooting.", rtcState.otaMillis);
+		ESP.restart();
 		break;
 	}
+#endif
 }
 
 void setup()
@@ -327,75 +1318,77 @@ void setup()
 	pinMode(led, OUTPUT);
 	ledOff();
 
+#if LOG_ENABLED
 	Serial.begin(115200);
-	Serial.println("Reboot");
-
-	Serial.print("Booting because ");
-	Serial.println(ESP.getResetReason());
-
-	Serial.println("Build: " + String(versionTimestamp));
+#endif
+	LOGI("Reboot");
+	LOGI("Booting because %s", ESP.getResetReason().c_str());
+	LOGI("Build: %s", versionTimestamp);
 
 	// Turn off WiFi by default to save power
 	WiFi.mode(WIFI_OFF);
 	WiFi.forceSleepBegin();
 
 	// INITIALIZE MPU
-	Serial.println("Starting MPU-6050");
+	LOGD("Starting MPU-6050");
 	Wire.begin(SDA_PIN, SCL_PIN);
 	Wire.setClock(400000);
 
-	mpu.initialize();
-	mpu.setFullScaleAccelRange(MPU6050_ACCEL_FS_2);
-	mpu.setFullScaleGyroRange(MPU6050_GYRO_FS_250);
-	mpu.setDLPFMode(MPU6050_DLPF_BW_5);
-	mpu.setTempSensorEnabled(true);
-	mpu.setInterruptLatch(0); // pulse
-	mpu.setInterruptMode(1);  // Active Low
-	mpu.setInterruptDrive(1); // Open drain
-	mpu.setRate(17);
-	mpu.setIntDataReadyEnabled(true);
-
 	// Read RTC memory to get current number of calibration iterations.
 	ESP.rtcUserMemoryRead(RTC_ADDRESS, &calibrationIterations, sizeof(calibrationIterations));
+	bool rtcValid = loadRtcState();
+
+	mpuFullInit = !mpuConfigured();
+	if (mpuFullInit)
+	{
+		LOGD("Configuring MPU");
+		configureMpu();
+	}
+	wakeMpu();
 
 	rst_info *resetInfo;
 	resetInfo = ESP.getResetInfoPtr();
-	if (resetInfo->reason != REASON_DEEP_SLEEP_AWAKE)
+#ifdef MOTION_WAKE
+	// Woken early by the MPU seeing motion. Read again once the sensor is
+	// left alone. While waiting for a flip, motion just means looking again
+	// right away.
+	if (wokeEarly(rtcValid) && rtcState.settleWakes == 0 && !rtcState.flipWaiting)
 	{
-		int16_t ax, ay, az;
-		float tilt;
-
-		calibrationSetupStart = millis();
-		while ((millis() - calibrationSetupStart) < CALIBRATION_SETUP_TIME)
+		LOGI("Woken by motion");
+		settle();
+		return;
+	}
+#endif
+	// Right after an update there is nobody around to flip the sensor.
+	if (resetInfo->reason != REASON_DEEP_SLEEP_AWAKE && rtcState.otaMillis == 0)
+	{
+		rtcState.flipWaiting = 1;
+		rtcState.flipWaitMs = 0;
+	}
+	if (rtcState.flipWaiting)
+	{
+		if (waitForFlip())
 		{
-			mpu.getAcceleration(&ax, &az, &ay);
-			tilt = calculateTilt(ax, az, ay);
-			if (tilt > 0.0 && tilt > CALIBRATION_TILT_ANGLE_MIN && tilt < CALIBRATION_TILT_ANGLE_MAX)
-			{
-				Serial.println("Checking for OTA update...");
-				checkOTAUpdate();
+			LOGI("Checking for OTA update...");
+			checkOTAUpdate();
 
-				Serial.println("Initiate calibration mode");
-				calibrationMode(true);
-
-				break;
-			}
-			delay(2000);
+			LOGI("Initiate calibration mode");
+			calibrationMode(true);
 		}
 	}
 	else if (isCalibrationMode() && calibrationIterations < CALIBRATION_ITERATIONS)
 	{
-		Serial.printf("Calibration mode, %d iterations...", calibrationIterations);
+		LOGI("Calibration mode, %u iterations...", calibrationIterations);
 		calibrationMode(false);
 	}
 	else
 	{
-		Serial.println("Normal mode");
+		LOGI("Normal mode");
 		normalMode();
 	}
 
 	currentState = STATE_SAMPLING;
-	Serial.println("Finished setup");
+	LOGD("Finished setup");
 }
 
 void loop()
@@ -408,19 +1401,37 @@ void loop()
             else if ((millis() - bootTime) > WAKE_TIMEOUT && !isCalibrationMode()) {
                 currentState = STATE_SLEEPING;
             }
-            else if (nsamples < MAX_SAMPLES && mpu.getIntDataReadyStatus()) {
+            else if (!samplingDone && sampleReady()) {
                 int16_t ax, ay, az;
-                mpu.getAcceleration(&ax, &az, &ay);
+                int16_t gyro[3];
+                lastSampleTime = millis();
+                if (firstSampleTime == 0) {
+                    firstSampleTime = lastSampleTime;
+                }
+                mpu.getMotion6(&ax, &az, &ay, &gyro[0], &gyro[1], &gyro[2]);
 
-                float tilt = calculateTilt(ax, az, ay);
+                float tilt = samplingTilt(ax, az, ay);
                 
                 // Ignore zero readings as well as readings of precisely 90.
                 // Both of these indicate failures to read correct data from the MPU.
                 if (tilt > 0.0 && tilt != 90) {
-                    samples[nsamples++] = tilt;
+                    if (isDisturbed(gyro)) {
+                        ndisturbed++;
+                    } else {
+                        samplingAdd(samples, tilt);
+                        for (int i = 0; i < 3; i++) {
+                            gyroSum[i] += gyro[i];
+                        }
+                    }
+                }
+
+                if (ndisturbed >= MAX_DISTURBED_SAMPLES) {
+                    settle();
                 }
+                else if (samplingEnough(samples)) {
+                    samplingDone = true;
+                    LOGD("%u samples, mean %.2f", samples.count, samples.mean);
 
-                if (nsamples >= MAX_SAMPLES) {
                     // As soon as we have all our samples, read the temperature.
                     // This offset is from the MPU documentation. Displays temperature in degrees C.
                     temperature = mpu.getTemperature() / 340.0 + 36.53;
@@ -436,17 +1447,32 @@ void loop()
 			// to poll every ms while we're gathering samples. Once we have
 			// the samples we're just waiting for the transmit to clear, so
 			// loop a bit quicker.
-            delay((nsamples < MAX_SAMPLES) ? 10 : 1);
+            delay(samplingDone ? 1 : 10);
             break;
             
         case STATE_PROCESSING:
             // Process data and prepare for transmission
+            prepareSensorData();
             currentState = STATE_TRANSMITTING;
             break;
             
         case STATE_TRANSMITTING:
-            // Send sensor data through ESP-NOW
+            // Send sensor data through ESP-NOW, unless nothing changed.
+            // The RTC state is saved before sleeping.
+            if (!readingChanged()) {
+                rtcState.quietWakes++;
+                LOGI("Reading unchanged, not sending (%u quiet wakes)", rtcState.quietWakes);
+                currentState = STATE_SLEEPING;
+                break;
+            }
             sendSensorData();
+            if (commandsReceived) {
+                applyCommands();
+            }
+            if (otaRequested) {
+                LOGI("Checking gateway for OTA update...");
+                checkGatewayOTAUpdate();
+            }
             currentState = STATE_SLEEPING;
             break;
             
@@ -0,0 +1,146 @@
+#include <unity.h>
+#include "battery.h"
+
+#define WAKE_INTERVAL 900
+#define UPTIME 2.0
+#define MAX_INTERVAL 10800
+
+// A LiFePO4 cell following the curve the model assumes, to get the voltage
+// for a true state of charge.
+static const struct
+{
+    int mv;
+    int percent;
+} cell[] = {
+    {3400, 100}, {3350, 95}, {3320, 90}, {3300, 70}, {3280, 50},
+    {3250, 30}, {3200, 20}, {3100, 10}, {3000, 5}, {2800, 0},
+};
+
+static uint32_t seed = 1;
+
+// Voltage for the charge, with a few mV of noise.
+static int cellVoltage(float charge)
+{
+    float percent = charge * 100 / BATTERY_CAPACITY;
+    int mv = cell[0].mv;
+    for (size_t i = 1; i < sizeof(cell) / sizeof(cell[0]); i++)
+    {
+        if (percent >= cell[i].percent)
+        {
+            float f = (percent - cell[i].percent) / (cell[i - 1].percent - cell[i].percent);
+            mv = cell[i].mv + f * (cell[i - 1].mv - cell[i].mv);
+            break;
+        }
+    }
+    seed = seed * 1103515245 + 12345;
+    return mv + (int)(seed >> 16) % 7 - 3;
+}
+
+void test_charge_from_voltage()
+{
+    TEST_ASSERT_EQUAL_FLOAT(BATTERY_CAPACITY, batteryChargeFromVoltage(3500));
+    TEST_ASSERT_EQUAL_FLOAT(BATTERY_CAPACITY, batteryChargeFromVoltage(3400));
+    TEST_ASSERT_FLOAT_WITHIN(0.01, BATTERY_CAPACITY * 0.6, batteryChargeFromVoltage(3290));
+    TEST_ASSERT_FLOAT_WITHIN(0.01, BATTERY_CAPACITY * 0.05, batteryChargeFromVoltage(3000));
+    TEST_ASSERT_EQUAL_FLOAT(0, batteryChargeFromVoltage(2800));
+    TEST_ASSERT_EQUAL_FLOAT(0, batteryChargeFromVoltage(2500));
+}
+
+// The first estimate comes from the curve, and in the flat middle of the
+// curve the charge count is left alone.
+void test_update_charge()
+{
+    TEST_ASSERT_FLOAT_WITHIN(0.01, BATTERY_CAPACITY * 0.95, batteryUpdateCharge(-1, 3350));
+    TEST_ASSERT_EQUAL_FLOAT(250, batteryUpdateCharge(250, 3290));
+    TEST_ASSERT_TRUE(batteryUpdateCharge(250, 3400) > 250);
+    TEST_ASSERT_TRUE(batteryUpdateCharge(250, 3000) < 250);
+}
+
+// Runs a cell from full to empty, waking every WAKE_INTERVAL, with the real
+// current off from the model by currentError (1.1 for 10% more). Returns
+// the largest error of the estimate, in mAh, while the cell still has
+// more than 5% left, and checks the estimate is low before the cell is.
+static float discharge(float currentError)
+{
+    float charge = BATTERY_CAPACITY;
+    float estimate = -1;
+    float worst = 0;
+    bool warned = false;
+    while (charge > 0)
+    {
+        estimate = batteryUpdateCharge(estimate, cellVoltage(charge));
+        if (charge > BATTERY_CAPACITY * 0.05)
+        {
+            worst = max(worst, fabsf(estimate - charge));
+        }
+        warned = warned || estimate < BATTERY_CAPACITY * 0.2;
+        float used = batteryUsed(UPTIME, WAKE_INTERVAL);
+        estimate = max(estimate - used, 0.f);
+        charge -= used * currentError;
+        if (charge < BATTERY_CAPACITY * 0.1)
+        {
+            TEST_ASSERT_TRUE(warned);
+        }
+    }
+    return worst;
+}
+
+void test_discharge_with_exact_model()
+{
+    TEST_ASSERT_LESS_THAN(BATTERY_CAPACITY * 0.05, discharge(1.0));
+}
+
+// Where the count drifts, the steep ends of the curve pull it back.
+void test_discharge_with_current_off()
+{
+    TEST_ASSERT_LESS_THAN(BATTERY_CAPACITY * 0.15, discharge(1.15));
+    TEST_ASSERT_LESS_THAN(BATTERY_CAPACITY * 0.15, discharge(0.85));
+}
+
+// Stretching the interval for a target date makes the cell last until it,
+// without being much longer than needed.
+void test_schedule_reaches_target()
+{
+    const uint32_t target = 200 * 86400;
+    float charge = BATTERY_CAPACITY * 0.95;
+    float estimate = -1;
+    uint32_t left = target;
+    long interval = 0;
+    while (left > 0)
+    {
+        TEST_ASSERT_TRUE(charge > 0);
+        estimate = batteryUpdateCharge(estimate, cellVoltage(charge));
+        interval = batteryScheduledInterval(estimate, left, UPTIME * 1000, WAKE_INTERVAL, interval, MAX_INTERVAL);
+        TEST_ASSERT_TRUE(interval >= WAKE_INTERVAL && interval <= MAX_INTERVAL);
+        float used = batteryUsed(UPTIME, interval);
+        estimate = max(estimate - used, 0.f);
+        charge -= used;
+        left = (left > interval + UPTIME) ? left - interval - UPTIME : 0;
+    }
+    TEST_ASSERT_TRUE(charge > 0);
+    TEST_ASSERT_LESS_THAN(BATTERY_CAPACITY * 0.25, charge);
+}
+
+// A target the battery cannot reach even at the longest interval gets the
+// longest interval, give or take the rounding of the steps towards it.
+void test_schedule_caps_interval()
+{
+    long interval = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        interval = batteryScheduledInterval(10, 1000 * 86400, 2000, WAKE_INTERVAL, interval, MAX_INTERVAL);
+    }
+    TEST_ASSERT_INT_WITHIN(SCHEDULE_STEPS, MAX_INTERVAL, interval);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_charge_from_voltage);
+    RUN_TEST(test_update_charge);
+    RUN_TEST(test_discharge_with_exact_model);
+    RUN_TEST(test_discharge_with_current_off);
+    RUN_TEST(test_schedule_reaches_target);
+    RUN_TEST(test_schedule_caps_interval);
+    return UNITY_END();
+}
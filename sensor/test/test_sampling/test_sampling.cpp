@@ -0,0 +1,161 @@
+#include <unity.h>
+#include "sampling.h"
+
+// Accelerometer counts per g at MPU6050_ACCEL_FS_2, and the time between
+// samples in ms, as on the sensor.
+#define LSB_PER_G 16384
+#define SAMPLE_PERIOD 18
+#define WAKES 200
+
+static uint32_t seed = 1;
+
+static float uniform()
+{
+    seed = seed * 1103515245 + 12345;
+    return ((seed >> 8) + 0.5f) / (1 << 24);
+}
+
+static float gaussian()
+{
+    return sqrtf(-2 * logf(uniform())) * cosf(2 * PI * uniform());
+}
+
+// A trace of accelerometer readings for a wake, as they come off the MPU
+// with the 5 Hz filter: the sensor floats at tilt degrees, swinging by
+// swing degrees at swingHz, with noise in g on every axis.
+struct Trace
+{
+    float tilt;
+    float swing;
+    float swingHz;
+    float noise;
+};
+
+static void reading(const Trace &trace, float phase, int i, int16_t *ax, int16_t *az, int16_t *ay)
+{
+    float t = i * SAMPLE_PERIOD / 1000.0;
+    float angle = (trace.tilt + trace.swing * sinf(2 * PI * trace.swingHz * t + phase)) * PI / 180;
+    *ax = LSB_PER_G * (sinf(angle) + trace.noise * gaussian());
+    *az = LSB_PER_G * (cosf(angle) + trace.noise * gaussian());
+    *ay = LSB_PER_G * trace.noise * gaussian();
+}
+
+struct Result
+{
+    float meanCount;
+    float rmsError;
+    float worstError;
+};
+
+// Samples WAKES wakes of the trace, each at a random point of the swing,
+// stopping after at most limit samples.
+static Result replay(const Trace &trace, unsigned int limit)
+{
+    Result result = {0, 0, 0};
+    for (int wake = 0; wake < WAKES; wake++)
+    {
+        float phase = 2 * PI * uniform();
+        TiltSamples samples = {};
+        for (int i = 0; samples.count < limit; i++)
+        {
+            int16_t ax, az, ay;
+            reading(trace, phase, i, &ax, &az, &ay);
+            samplingAdd(samples, samplingTilt(ax, az, ay));
+            if (samplingEnough(samples))
+            {
+                break;
+            }
+        }
+        TEST_ASSERT_TRUE(samples.count >= min(limit, (unsigned int)MIN_SAMPLES) && samples.count <= MAX_SAMPLES);
+        float error = fabsf(samplingMedian(samples) - trace.tilt);
+        result.meanCount += (float)samples.count / WAKES;
+        result.rmsError += error * error / WAKES;
+        result.worstError = max(result.worstError, error);
+    }
+    result.rmsError = sqrtf(result.rmsError);
+    return result;
+}
+
+// A still sensor: about 1 mg of noise is what the MPU6050 gives at 5 Hz.
+static const Trace quiet = {45, 0, 0, 0.001};
+// In a vigorous ferment the sensor is pushed about by bubbles.
+static const Trace agitated = {45, 0.5, 3, 0.003};
+
+void test_tilt_from_acceleration()
+{
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0, samplingTilt(0, LSB_PER_G, 0));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 90, samplingTilt(LSB_PER_G, 0, 0));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 45, samplingTilt(1000, 1000, 0));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 45, samplingTilt(0, 1000, 1000));
+    TEST_ASSERT_EQUAL_FLOAT(0, samplingTilt(0, 0, 0));
+}
+
+void test_median()
+{
+    TiltSamples samples = {};
+    samplingAdd(samples, 45.1);
+    samplingAdd(samples, 80);
+    samplingAdd(samples, 44.9);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 45.1, samplingMedian(samples));
+    samplingAdd(samples, 45.0);
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 45.05, samplingMedian(samples));
+}
+
+void test_steady_tilt_stops_at_minimum()
+{
+    TiltSamples samples = {};
+    for (int i = 0; i < MIN_SAMPLES - 1; i++)
+    {
+        samplingAdd(samples, 45);
+        TEST_ASSERT_FALSE(samplingEnough(samples));
+    }
+    samplingAdd(samples, 45);
+    TEST_ASSERT_TRUE(samplingEnough(samples));
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 45, samples.mean);
+}
+
+void test_scattered_tilt_stops_at_maximum()
+{
+    TiltSamples samples = {};
+    for (int i = 0; i < MAX_SAMPLES - 1; i++)
+    {
+        samplingAdd(samples, i % 2 ? 44 : 46);
+        TEST_ASSERT_FALSE(samplingEnough(samples));
+    }
+    samplingAdd(samples, 45);
+    TEST_ASSERT_TRUE(samplingEnough(samples));
+    samplingAdd(samples, 45);
+    TEST_ASSERT_EQUAL(MAX_SAMPLES, samples.count);
+}
+
+// A still sensor gets by with few samples, and they are enough.
+void test_quiet_trace()
+{
+    Result result = replay(quiet, MAX_SAMPLES);
+    TEST_ASSERT_TRUE(result.meanCount < MIN_SAMPLES + 1);
+    TEST_ASSERT_TRUE(result.rmsError < TILT_TOLERANCE * 2);
+    TEST_ASSERT_TRUE(result.worstError < 0.2);
+}
+
+// An agitated sensor takes more samples, and they are worth it: a fixed
+// MIN_SAMPLES would be noticeably further off, on average and at worst.
+void test_agitated_trace()
+{
+    Result result = replay(agitated, MAX_SAMPLES);
+    Result fixed = replay(agitated, MIN_SAMPLES);
+    TEST_ASSERT_TRUE(result.meanCount > MIN_SAMPLES * 2);
+    TEST_ASSERT_TRUE(result.rmsError < fixed.rmsError * 0.75);
+    TEST_ASSERT_TRUE(result.worstError < fixed.worstError);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tilt_from_acceleration);
+    RUN_TEST(test_median);
+    RUN_TEST(test_steady_tilt_stops_at_minimum);
+    RUN_TEST(test_scattered_tilt_stops_at_maximum);
+    RUN_TEST(test_quiet_trace);
+    RUN_TEST(test_agitated_trace);
+    return UNITY_END();
+}
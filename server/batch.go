@@ -0,0 +1,295 @@
+package main
+
+import (
+	"context"
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"io"
+	"log"
+	"net"
+	"net/http"
+
+	"github.com/labstack/echo/v4"
+	"zombiezen.com/go/sqlite/sqlitex"
+)
+
+// Batches are CBOR encoded by batchEncode in gateway/src/batch.cpp, with
+// small integer keys, sensors listed once and referred to by index, and
+// fixed point values:
+//
+//	{0: gateway ID, 1: gateway name, 2: [sensor MAC (6 bytes), ...],
+//	 3: [[sensor index, time (Unix ms, 0 if unknown), gravity (1/10000),
+//	      tilt (1/100 degree), temp (1/100 C), volt (mV), interval (s)], ...]}
+const (
+	batchGatewayID   = 0
+	batchGatewayName = 1
+	batchSensors     = 2
+	batchReadings    = 3
+
+	batchReadingFields = 7
+
+	// Far more than a gateway sends at once.
+	maxBatchSize = 64 << 10
+)
+
+type batch struct {
+	GatewayID   string
+	GatewayName string
+	Readings    []Reading
+}
+
+// handleBatch stores a batch of readings in a single transaction.
+func handleBatch(c echo.Context) error {
+	body, err := io.ReadAll(io.LimitReader(c.Request().Body, maxBatchSize+1))
+	if err != nil || len(body) > maxBatchSize {
+		return c.JSON(http.StatusBadRequest, map[string]string{
+			"error": "Invalid request format",
+		})
+	}
+	b, err := decodeBatch(body)
+	if err != nil {
+		log.Printf("Invalid batch: %v", err)
+		return c.JSON(http.StatusBadRequest, map[string]string{
+			"error": "Invalid request format",
+		})
+	}
+
+	log.Printf("Received %d readings (%d bytes) from gateway: %s (%s)",
+		len(b.Readings), len(body), b.GatewayName, b.GatewayID)
+
+	if err := saveBatch(b); err != nil {
+		log.Printf("Error saving to database: %v", err)
+		return c.JSON(http.StatusInternalServerError, map[string]string{
+			"status": "error",
+			"error":  "Failed to store metrics",
+		})
+	}
+
+	return c.JSON(http.StatusOK, map[string]string{
+		"status": "success",
+	})
+}
+
+// saveBatch looks up the gateway and every sensor once, and inserts all
+// readings in one transaction.
+func saveBatch(b *batch) (err error) {
+	conn, err := dbPool.Take(context.Background())
+	if err != nil {
+		return fmt.Errorf("failed to get database connection: %v", err)
+	}
+	defer dbPool.Put(conn)
+
+	endTx := sqlitex.Transaction(conn)
+	defer endTx(&err)
+
+	gatewayInternalID, err := gatewayID(conn, b.GatewayID, b.GatewayName)
+	if err != nil {
+		return err
+	}
+	sensors := make(map[string]int64)
+	for i := range b.Readings {
+		r := &b.Readings[i]
+		sensorInternalID, ok := sensors[r.SensorID]
+		if !ok {
+			sensorInternalID, err = sensorID(conn, r.SensorID)
+			if err != nil {
+				return err
+			}
+			sensors[r.SensorID] = sensorInternalID
+		}
+		// The statement is prepared once and cached by the connection.
+		err = sqlitex.Execute(conn, insertReadingQuery, &sqlitex.ExecOptions{
+			Args: readingArgs(r, sensorInternalID, gatewayInternalID),
+		})
+		if err != nil {
+			return fmt.Errorf("failed to insert reading: %v", err)
+		}
+	}
+	return nil
+}
+
+func decodeBatch(data []byte) (*batch, error) {
+	d := cborDecoder{data: data}
+	b := new(batch)
+	var sensors []string
+	var readings [][]int64
+
+	fields, err := d.head(cborMap)
+	if err != nil {
+		return nil, err
+	}
+	for ; fields > 0; fields-- {
+		key, err := d.head(cborUint)
+		if err != nil {
+			return nil, err
+		}
+		switch key {
+		case batchGatewayID:
+			b.GatewayID, err = d.text()
+		case batchGatewayName:
+			b.GatewayName, err = d.text()
+		case batchSensors:
+			sensors, err = d.sensors()
+		case batchReadings:
+			readings, err = d.readings()
+		default:
+			err = fmt.Errorf("unknown key %d", key)
+		}
+		if err != nil {
+			return nil, err
+		}
+	}
+	if d.pos != len(data) {
+		return nil, errors.New("trailing data")
+	}
+
+	b.Readings = make([]Reading, len(readings))
+	for i, v := range readings {
+		if v[0] < 0 || v[0] >= int64(len(sensors)) {
+			return nil, fmt.Errorf("reading %d refers to unknown sensor %d", i, v[0])
+		}
+		b.Readings[i] = Reading{
+			SensorID:  sensors[v[0]],
+			Timestamp: v[1],
+			Gravity:   float64(v[2]) / 10000,
+			Tilt:      float64(v[3]) / 100,
+			Temp:      float64(v[4]) / 100,
+			Volt:      float64(v[5]),
+			Interval:  int(v[6]),
+		}
+	}
+	return b, nil
+}
+
+// cborDecoder reads the subset of CBOR (RFC 8949) that batches use: definite
+// length maps, arrays, byte and text strings, and integers.
+type cborDecoder struct {
+	data []byte
+	pos  int
+}
+
+const (
+	cborUint   = 0
+	cborNegInt = 1
+	cborBytes  = 2
+	cborText   = 3
+	cborArray  = 4
+	cborMap    = 5
+)
+
+var errTruncated = errors.New("truncated")
+
+// next reads a head, returning its major type and argument.
+func (d *cborDecoder) next() (byte, uint64, error) {
+	if d.pos >= len(d.data) {
+		return 0, 0, errTruncated
+	}
+	major, info := d.data[d.pos]>>5, d.data[d.pos]&0x1f
+	d.pos++
+	if info < 24 {
+		return major, uint64(info), nil
+	}
+	if info > 27 {
+		return 0, 0, fmt.Errorf("unsupported additional info %d", info)
+	}
+	size := 1 << (info - 24)
+	if d.pos+size > len(d.data) {
+		return 0, 0, errTruncated
+	}
+	var buf [8]byte
+	copy(buf[8-size:], d.data[d.pos:d.pos+size])
+	d.pos += size
+	return major, binary.BigEndian.Uint64(buf[:]), nil
+}
+
+// head reads a head of the given major type. For strings and containers the
+// argument is a length, which is checked against the remaining data.
+func (d *cborDecoder) head(want byte) (uint64, error) {
+	major, value, err := d.next()
+	if err != nil {
+		return 0, err
+	}
+	if major != want {
+		return 0, fmt.Errorf("expected major type %d, got %d", want, major)
+	}
+	if want != cborUint && value > uint64(len(d.data)-d.pos) {
+		return 0, errTruncated
+	}
+	return value, nil
+}
+
+func (d *cborDecoder) integer() (int64, error) {
+	major, value, err := d.next()
+	if err != nil {
+		return 0, err
+	}
+	if value > 1<<63-1 {
+		return 0, errors.New("integer out of range")
+	}
+	switch major {
+	case cborUint:
+		return int64(value), nil
+	case cborNegInt:
+		return -1 - int64(value), nil
+	}
+	return 0, fmt.Errorf("expected integer, got major type %d", major)
+}
+
+func (d *cborDecoder) bytes(major byte) ([]byte, error) {
+	n, err := d.head(major)
+	if err != nil {
+		return nil, err
+	}
+	b := d.data[d.pos : d.pos+int(n)]
+	d.pos += int(n)
+	return b, nil
+}
+
+func (d *cborDecoder) text() (string, error) {
+	b, err := d.bytes(cborText)
+	return string(b), err
+}
+
+func (d *cborDecoder) sensors() ([]string, error) {
+	n, err := d.head(cborArray)
+	if err != nil {
+		return nil, err
+	}
+	sensors := make([]string, n)
+	for i := range sensors {
+		mac, err := d.bytes(cborBytes)
+		if err != nil {
+			return nil, err
+		}
+		if len(mac) != 6 {
+			return nil, fmt.Errorf("sensor %d is not a MAC address", i)
+		}
+		sensors[i] = net.HardwareAddr(mac).String()
+	}
+	return sensors, nil
+}
+
+func (d *cborDecoder) readings() ([][]int64, error) {
+	n, err := d.head(cborArray)
+	if err != nil {
+		return nil, err
+	}
+	readings := make([][]int64, n)
+	for i := range readings {
+		fields, err := d.head(cborArray)
+		if err != nil {
+			return nil, err
+		}
+		if fields != batchReadingFields {
+			return nil, fmt.Errorf("reading %d has %d fields", i, fields)
+		}
+		readings[i] = make([]int64, fields)
+		for j := range readings[i] {
+			if readings[i][j], err = d.integer(); err != nil {
+				return nil, err
+			}
+		}
+	}
+	return readings, nil
+}
@@ -0,0 +1,259 @@
+package main
+
+import (
+	"encoding/binary"
+	"encoding/json"
+	"io"
+	"log"
+	"os"
+	"path/filepath"
+	"reflect"
+	"strings"
+	"testing"
+)
+
+// cborEncoder writes heads in the shortest form, like the gateway's
+// CborWriter.
+type cborEncoder []byte
+
+func (e *cborEncoder) head(major byte, value uint64) {
+	switch {
+	case value < 24:
+		*e = append(*e, major<<5|byte(value))
+	case value <= 0xff:
+		*e = append(*e, major<<5|24, byte(value))
+	case value <= 0xffff:
+		*e = binary.BigEndian.AppendUint16(append(*e, major<<5|25), uint16(value))
+	case value <= 0xffffffff:
+		*e = binary.BigEndian.AppendUint32(append(*e, major<<5|26), uint32(value))
+	default:
+		*e = binary.BigEndian.AppendUint64(append(*e, major<<5|27), value)
+	}
+}
+
+func (e *cborEncoder) integer(v int64) {
+	if v < 0 {
+		e.head(cborNegInt, uint64(-1-v))
+	} else {
+		e.head(cborUint, uint64(v))
+	}
+}
+
+func (e *cborEncoder) text(s string) {
+	e.head(cborText, uint64(len(s)))
+	*e = append(*e, s...)
+}
+
+// encodeBatch lays out a batch the way the gateway's batchEncode does.
+func encodeBatch(gatewayID, gatewayName string, sensors [][]byte, readings [][]int64) []byte {
+	var e cborEncoder
+	e.head(cborMap, 4)
+	e.head(cborUint, batchGatewayID)
+	e.text(gatewayID)
+	e.head(cborUint, batchGatewayName)
+	e.text(gatewayName)
+	e.head(cborUint, batchSensors)
+	e.head(cborArray, uint64(len(sensors)))
+	for _, mac := range sensors {
+		e.head(cborBytes, uint64(len(mac)))
+		e = append(e, mac...)
+	}
+	e.head(cborUint, batchReadings)
+	e.head(cborArray, uint64(len(readings)))
+	for _, r := range readings {
+		e.head(cborArray, uint64(len(r)))
+		for _, v := range r {
+			e.integer(v)
+		}
+	}
+	return e
+}
+
+var (
+	testSensors = [][]byte{
+		{0x5c, 0xcf, 0x7f, 0x01, 0x02, 0x03},
+		{0x5c, 0xcf, 0x7f, 0xaa, 0xbb, 0xcc},
+	}
+	testReadings = [][]int64{
+		{0, 1718000000123, 10452, 4512, 1875, 3301, 1800},
+		{1, 0, 9987, 2550, -150, 2950, 900},
+		{0, 1718001800456, 10448, 4498, 1880, 3299, 1800},
+	}
+)
+
+func TestDecodeBatchRoundTrip(t *testing.T) {
+	data := encodeBatch("24:6F:28:AA:BB:CC", "Cellar", testSensors, testReadings)
+	b, err := decodeBatch(data)
+	if err != nil {
+		t.Fatal(err)
+	}
+	if b.GatewayID != "24:6F:28:AA:BB:CC" || b.GatewayName != "Cellar" {
+		t.Errorf("gateway %q %q", b.GatewayID, b.GatewayName)
+	}
+	want := []Reading{
+		{SensorID: "5c:cf:7f:01:02:03", Timestamp: 1718000000123, Gravity: 1.0452, Tilt: 45.12, Temp: 18.75, Volt: 3301, Interval: 1800},
+		{SensorID: "5c:cf:7f:aa:bb:cc", Timestamp: 0, Gravity: 0.9987, Tilt: 25.5, Temp: -1.5, Volt: 2950, Interval: 900},
+		{SensorID: "5c:cf:7f:01:02:03", Timestamp: 1718001800456, Gravity: 1.0448, Tilt: 44.98, Temp: 18.8, Volt: 3299, Interval: 1800},
+	}
+	if !reflect.DeepEqual(b.Readings, want) {
+		t.Errorf("got %+v, want %+v", b.Readings, want)
+	}
+}
+
+func TestDecodeBatchRejectsTruncated(t *testing.T) {
+	data := encodeBatch("id", "name", testSensors, testReadings)
+	for n := 0; n < len(data); n++ {
+		if _, err := decodeBatch(data[:n]); err == nil {
+			t.Fatalf("accepted the first %d of %d bytes", n, len(data))
+		}
+	}
+}
+
+func TestDecodeBatchRejectsMalformed(t *testing.T) {
+	tests := []struct {
+		name string
+		data []byte
+		err  string
+	}{
+		{"unknown sensor", encodeBatch("id", "name", testSensors[:1], testReadings), "unknown sensor"},
+		{"short reading", encodeBatch("id", "name", testSensors, [][]int64{{0, 0, 10000, 0, 0, 0}}), "fields"},
+		{"short MAC", encodeBatch("id", "name", [][]byte{{1, 2, 3, 4, 5}}, nil), "MAC"},
+		{"trailing data", append(encodeBatch("id", "name", testSensors, testReadings), 0), "trailing"},
+		{"not a map", []byte{0x80}, "major type"},
+		{"unknown key", []byte{0xa1, 0x09, 0x00}, "unknown key"},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			_, err := decodeBatch(tt.data)
+			if err == nil || !strings.Contains(err.Error(), tt.err) {
+				t.Errorf("got error %v, want one about %q", err, tt.err)
+			}
+		})
+	}
+}
+
+// benchmarkReadings is a typical backlog after a WiFi outage: 32 readings
+// from four sensors.
+func benchmarkReadings() [][]int64 {
+	readings := make([][]int64, 32)
+	for i := range readings {
+		readings[i] = []int64{int64(i % 4), 1718000000000 + int64(i)*450000, 10450 - int64(i), 4500 - int64(i)*3, 1850 + int64(i%5), 3300, 1800}
+	}
+	return readings
+}
+
+// BenchmarkDecodeBatch and BenchmarkDecodeJSON compare the two uplinks for
+// the same readings, in time and in bytes per reading.
+func BenchmarkDecodeBatch(b *testing.B) {
+	sensors := [][]byte{testSensors[0], testSensors[1], {0x5c, 0xcf, 0x7f, 0, 0, 3}, {0x5c, 0xcf, 0x7f, 0, 0, 4}}
+	readings := benchmarkReadings()
+	data := encodeBatch("24:6F:28:AA:BB:CC", "Cellar", sensors, readings)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		if _, err := decodeBatch(data); err != nil {
+			b.Fatal(err)
+		}
+	}
+	b.ReportMetric(float64(len(data))/float64(len(readings)), "bytes/reading")
+}
+
+func BenchmarkDecodeJSON(b *testing.B) {
+	readings := benchmarkReadings()
+	docs := make([][]byte, len(readings))
+	size := 0
+	for i, r := range readings {
+		doc, err := json.Marshal(SensorReading{
+			Reading: Reading{
+				SensorID:  "5c:cf:7f:00:00:0" + string(rune('1'+r[0])),
+				Timestamp: r[1],
+				Gravity:   float64(r[2]) / 10000,
+				Tilt:      float64(r[3]) / 100,
+				Temp:      float64(r[4]) / 100,
+				Volt:      float64(r[5]),
+				Interval:  int(r[6]),
+			},
+			GatewayID:   "24:6F:28:AA:BB:CC",
+			GatewayName: "Cellar",
+		})
+		if err != nil {
+			b.Fatal(err)
+		}
+		docs[i] = doc
+		size += len(doc)
+	}
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		for _, doc := range docs {
+			var r SensorReading
+			if err := json.Unmarshal(doc, &r); err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+	b.ReportMetric(float64(size)/float64(len(readings)), "bytes/reading")
+}
+
+// openBenchmarkDB points dbPool at a new database in a temporary directory.
+func openBenchmarkDB(b *testing.B) {
+	pool, err := initDB(filepath.Join(b.TempDir(), "tilted.db"))
+	if err != nil {
+		b.Fatal(err)
+	}
+	dbPool = pool
+	b.Cleanup(func() {
+		pool.Close()
+		dbPool = nil
+	})
+	// saveToDatabase logs every reading.
+	log.SetOutput(io.Discard)
+	b.Cleanup(func() { log.SetOutput(os.Stderr) })
+}
+
+// benchmarkBatch is the benchmark readings as the server decodes them.
+func benchmarkBatch(b *testing.B) *batch {
+	sensors := [][]byte{testSensors[0], testSensors[1], {0x5c, 0xcf, 0x7f, 0, 0, 3}, {0x5c, 0xcf, 0x7f, 0, 0, 4}}
+	decoded, err := decodeBatch(encodeBatch("24:6F:28:AA:BB:CC", "Cellar", sensors, benchmarkReadings()))
+	if err != nil {
+		b.Fatal(err)
+	}
+	return decoded
+}
+
+// BenchmarkSaveBatch and BenchmarkSaveReadings compare storing the same
+// readings as one batch in a single transaction, and one at a time as posted
+// to the JSON endpoint, in inserts per second. Timestamps are the primary
+// key, so every round moves them on.
+func BenchmarkSaveBatch(b *testing.B) {
+	openBenchmarkDB(b)
+	saved := benchmarkBatch(b)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		for j := range saved.Readings {
+			saved.Readings[j].Timestamp += 1 << 32
+		}
+		if err := saveBatch(saved); err != nil {
+			b.Fatal(err)
+		}
+	}
+	b.ReportMetric(float64(b.N*len(saved.Readings))/b.Elapsed().Seconds(), "inserts/s")
+}
+
+func BenchmarkSaveReadings(b *testing.B) {
+	openBenchmarkDB(b)
+	saved := benchmarkBatch(b)
+	b.ResetTimer()
+	for i := 0; i < b.N; i++ {
+		for j := range saved.Readings {
+			saved.Readings[j].Timestamp += 1 << 32
+			err := saveToDatabase(&SensorReading{
+				Reading:     saved.Readings[j],
+				GatewayID:   saved.GatewayID,
+				GatewayName: saved.GatewayName,
+			})
+			if err != nil {
+				b.Fatal(err)
+			}
+		}
+	}
+	b.ReportMetric(float64(b.N*len(saved.Readings))/b.Elapsed().Seconds(), "inserts/s")
+}
@@ -25,12 +25,15 @@ type SensorReading struct {
 
 // Reading contains the actual sensor data
 type Reading struct {
-	SensorID string  `json:"sensorId"`
-	Gravity  float64 `json:"gravity"`
-	Tilt     float64 `json:"tilt"`
-	Temp     float64 `json:"temp"`
-	Volt     float64 `json:"volt"`
-	Interval int     `json:"interval"`
+	SensorID string `json:"sensorId"`
+	// When the gateway received the reading, in Unix ms. Missing if the
+	// gateway's clock was not set.
+	Timestamp int64   `json:"timestamp"`
+	Gravity   float64 `json:"gravity"`
+	Tilt      float64 `json:"tilt"`
+	Temp      float64 `json:"temp"`
+	Volt      float64 `json:"volt"`
+	Interval  int     `json:"interval"`
 }
 
 // DataPoint represents a point of data for frontend visualization
@@ -55,9 +58,12 @@ type SensorData struct {
 var dbPool *sqlitex.Pool
 
 func main() {
+	databaseLocation := flag.String("database", "tilted.db", "")
+	flag.Parse()
+
 	// Initialize SQLite database
 	var err error
-	dbPool, err = initDB()
+	dbPool, err = initDB(*databaseLocation)
 	if err != nil {
 		log.Fatalf("Failed to initialize database: %v", err)
 	}
@@ -73,6 +79,7 @@ func main() {
 
 	// Routes
 	e.POST("/api/readings", handleSensorData)
+	e.POST("/api/readings/batch", handleBatch)
 	e.GET("/api/sensors", getSensorIDs)
 	e.GET("/api/readings/:sensorId", getSensorData)
 	e.GET("/health", healthCheck)
@@ -89,11 +96,8 @@ func main() {
 }
 
 // initDB initializes the SQLite database and creates necessary tables
-func initDB() (*sqlitex.Pool, error) {
-	databaseLocation := flag.String("database", "tilted.db", "")
-	flag.Parse()
-
-	pool, err := sqlitex.NewPool(*databaseLocation, sqlitex.PoolOptions{})
+func initDB(databaseLocation string) (*sqlitex.Pool, error) {
+	pool, err := sqlitex.NewPool(databaseLocation, sqlitex.PoolOptions{})
 	if err != nil {
 		return nil, fmt.Errorf("failed to open database: %v", err)
 	}
@@ -199,109 +203,84 @@ func saveToDatabase(data *SensorReading) error {
 		endTx(&err)
 	}()
 
-	// 1. Get or create sensor ID
-	var sensorInternalID int64
-
-	found := false
-	err = sqlitex.Execute(conn,
-		"SELECT id FROM sensors WHERE sensor_id = ?",
-		&sqlitex.ExecOptions{
-			Args: []any{data.Reading.SensorID},
-			ResultFunc: func(stmt *sqlite.Stmt) error {
-				sensorInternalID = stmt.ColumnInt64(0)
-				found = true
-				return nil
-			},
-		})
-
+	sensorInternalID, err := sensorID(conn, data.Reading.SensorID)
+	if err != nil {
+		return err
+	}
+	gatewayInternalID, err := gatewayID(conn, data.GatewayID, data.GatewayName)
+	if err != nil {
+		return err
+	}
+	err = sqlitex.Execute(conn, insertReadingQuery, &sqlitex.ExecOptions{
+		Args: readingArgs(&data.Reading, sensorInternalID, gatewayInternalID),
+	})
 	if err != nil {
-		return fmt.Errorf("failed to query sensor: %v", err)
+		return fmt.Errorf("failed to insert reading: %v", err)
 	}
 
-	if !found {
-		// Insert new sensor
-		err = sqlitex.Execute(conn,
-			"INSERT INTO sensors (sensor_id) VALUES (?)",
-			&sqlitex.ExecOptions{
-				Args: []any{data.Reading.SensorID},
-			})
-		if err != nil {
-			return fmt.Errorf("failed to insert sensor: %v", err)
-		}
+	log.Printf("Successfully saved metrics to SQLite database")
+	return nil
+}
 
-		// Get the last insert ID
-		err = sqlitex.Execute(conn, "SELECT last_insert_rowid()", &sqlitex.ExecOptions{
-			ResultFunc: func(stmt *sqlite.Stmt) error {
-				sensorInternalID = stmt.ColumnInt64(0)
-				return nil
-			},
-		})
-		if err != nil {
-			return fmt.Errorf("failed to get sensor ID: %v", err)
-		}
+// sensorID returns the internal ID of a sensor, creating it if needed.
+func sensorID(conn *sqlite.Conn, sensor string) (int64, error) {
+	id, err := lookupOrInsert(conn,
+		"SELECT id FROM sensors WHERE sensor_id = ?",
+		"INSERT INTO sensors (sensor_id) VALUES (?)",
+		sensor)
+	if err != nil {
+		return 0, fmt.Errorf("failed to get sensor ID: %v", err)
 	}
+	return id, nil
+}
 
-	// 2. Get or create gateway ID
-	var gatewayInternalID int64
-
-	found = false
-	err = sqlitex.Execute(conn,
+// gatewayID returns the internal ID of a gateway, creating it if needed.
+func gatewayID(conn *sqlite.Conn, gateway, name string) (int64, error) {
+	id, err := lookupOrInsert(conn,
 		"SELECT id FROM gateways WHERE gateway_id = ? AND gateway_name = ?",
-		&sqlitex.ExecOptions{
-			Args: []any{data.GatewayID, data.GatewayName},
-			ResultFunc: func(stmt *sqlite.Stmt) error {
-				gatewayInternalID = stmt.ColumnInt64(0)
-				found = true
-				return nil
-			},
-		})
-
+		"INSERT INTO gateways (gateway_id, gateway_name) VALUES (?, ?)",
+		gateway, name)
 	if err != nil {
-		return fmt.Errorf("failed to query gateway: %v", err)
+		return 0, fmt.Errorf("failed to get gateway ID: %v", err)
 	}
+	return id, nil
+}
 
-	if !found {
-		// Insert new gateway
-		err = sqlitex.Execute(conn,
-			"INSERT INTO gateways (gateway_id, gateway_name) VALUES (?, ?)",
-			&sqlitex.ExecOptions{
-				Args: []any{data.GatewayID, data.GatewayName},
-			})
-		if err != nil {
-			return fmt.Errorf("failed to insert gateway: %v", err)
-		}
-
-		// Get the last insert ID
-		err = sqlitex.Execute(conn, "SELECT last_insert_rowid()", &sqlitex.ExecOptions{
-			ResultFunc: func(stmt *sqlite.Stmt) error {
-				gatewayInternalID = stmt.ColumnInt64(0)
-				return nil
-			},
-		})
-		if err != nil {
-			return fmt.Errorf("failed to get gateway ID: %v", err)
-		}
+func lookupOrInsert(conn *sqlite.Conn, query, insert string, args ...any) (int64, error) {
+	var id int64
+	found := false
+	err := sqlitex.Execute(conn, query, &sqlitex.ExecOptions{
+		Args: args,
+		ResultFunc: func(stmt *sqlite.Stmt) error {
+			id = stmt.ColumnInt64(0)
+			found = true
+			return nil
+		},
+	})
+	if err != nil || found {
+		return id, err
 	}
-
-	// 3. Insert reading with the current timestamp
-	timestamp := time.Now().UnixMilli()
-	err = sqlitex.Execute(conn,
-		`INSERT INTO readings (
-			timestamp, sensor_id, gateway_id, gravity, tilt, temp, volt, interval
-		) VALUES (?, ?, ?, ?, ?, ?, ?, ?)`,
-		&sqlitex.ExecOptions{
-			Args: []any{
-				timestamp, sensorInternalID, gatewayInternalID,
-				data.Reading.Gravity, data.Reading.Tilt, data.Reading.Temp,
-				data.Reading.Volt, data.Reading.Interval,
-			},
-		})
-	if err != nil {
-		return fmt.Errorf("failed to insert reading: %v", err)
+	if err := sqlitex.Execute(conn, insert, &sqlitex.ExecOptions{Args: args}); err != nil {
+		return 0, err
 	}
+	return conn.LastInsertRowID(), nil
+}
 
-	log.Printf("Successfully saved metrics to SQLite database")
-	return nil
+const insertReadingQuery = `INSERT INTO readings (
+	timestamp, sensor_id, gateway_id, gravity, tilt, temp, volt, interval
+) VALUES (?, ?, ?, ?, ?, ?, ?, ?)`
+
+// readingArgs binds a reading for insertReadingQuery, with the gateway's
+// timestamp, or the current time for gateways without one.
+func readingArgs(r *Reading, sensorInternalID, gatewayInternalID int64) []any {
+	timestamp := r.Timestamp
+	if timestamp <= 0 {
+		timestamp = time.Now().UnixMilli()
+	}
+	return []any{
+		timestamp, sensorInternalID, gatewayInternalID,
+		r.Gravity, r.Tilt, r.Temp, r.Volt, r.Interval,
+	}
 }
 
 // healthCheck provides a simple health check endpoint
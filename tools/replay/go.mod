@@ -0,0 +1,3 @@
+module github.com/Ordspilleren/Tilted/tools/replay
+
+go 1.21
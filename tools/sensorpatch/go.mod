@@ -0,0 +1,3 @@
+module github.com/Ordspilleren/Tilted/tools/sensorpatch
+
+go 1.21
@@ -0,0 +1,310 @@
+// Command sensorpatch creates a delta update between two TiltedSensor
+// firmware images, to be uploaded to the gateway and applied by sensors
+// running the old image.
+//
+//	sensorpatch -old old/firmware.bin -new new/firmware.bin -out update.patch
+//
+// A patch is a header followed by a list of operations that rebuild the new
+// image from the old one, which the sensor reads from its own flash:
+//
+//	COPY   old offset, length         copy bytes from the old image
+//	ADD    old offset, length, diff   add a bytewise difference to old bytes
+//	INSERT length, bytes              bytes not found in the old image
+//
+// Recompiling shifts code around, which changes a few bytes in every
+// instruction referring to moved code. ADD covers those regions, and since
+// the difference is mostly zero it is stored as runs of zeros and literals.
+//
+// Patches are keyed by the versionTimestamp string embedded in both images.
+// The header also carries the MD5 of both images, so the sensor can check
+// that it runs the expected image and verify the result before switching.
+package main
+
+import (
+	"bytes"
+	"crypto/md5"
+	"encoding/binary"
+	"encoding/hex"
+	"errors"
+	"flag"
+	"fmt"
+	"io"
+	"log"
+	"os"
+	"regexp"
+)
+
+const (
+	magic      = "TDP1"
+	versionLen = 40
+
+	opEnd    = 0
+	opCopy   = 1
+	opAdd    = 2
+	opInsert = 3
+
+	// Shortest exact match worth switching to a new alignment for.
+	minMatch = 8
+	// An ADD region ends after this many bytes without a match.
+	maxMismatch = 16
+	// Candidate alignments checked per lookup.
+	maxCandidates = 32
+)
+
+// header must match PatchHeader in the sensor firmware.
+type header struct {
+	Magic       [4]byte
+	FromVersion [versionLen]byte
+	ToVersion   [versionLen]byte
+	OldSize     uint32
+	OldMD5      [32]byte
+	NewSize     uint32
+	NewMD5      [32]byte
+}
+
+var versionPattern = regexp.MustCompile(`TiltedSensor [A-Z][a-z]{2} [ 0-9]\d \d{4} \d{2}:\d{2}:\d{2}`)
+
+func main() {
+	oldPath := flag.String("old", "", "firmware image the sensors are running")
+	newPath := flag.String("new", "", "firmware image to update to")
+	outPath := flag.String("out", "update.patch", "where to write the patch")
+	flag.Parse()
+
+	if *oldPath == "" || *newPath == "" {
+		flag.Usage()
+		os.Exit(2)
+	}
+
+	oldImage, err := os.ReadFile(*oldPath)
+	if err != nil {
+		log.Fatal(err)
+	}
+	newImage, err := os.ReadFile(*newPath)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	patch, err := createPatch(oldImage, newImage)
+	if err != nil {
+		log.Fatal(err)
+	}
+
+	// Never ship a patch that does not rebuild the new image.
+	rebuilt, err := applyPatch(oldImage, patch)
+	if err != nil {
+		log.Fatalf("patch does not apply: %v", err)
+	}
+	if !bytes.Equal(rebuilt, newImage) {
+		log.Fatal("patch does not reproduce the new image")
+	}
+
+	if err := os.WriteFile(*outPath, patch, 0o644); err != nil {
+		log.Fatal(err)
+	}
+	fmt.Printf("%s -> %s\n", findVersion(oldImage), findVersion(newImage))
+	fmt.Printf("image %d bytes, patch %d bytes (%.1f%%)\n",
+		len(newImage), len(patch), 100*float64(len(patch))/float64(len(newImage)))
+}
+
+func findVersion(image []byte) string {
+	return string(versionPattern.Find(image))
+}
+
+func createPatch(oldImage, newImage []byte) ([]byte, error) {
+	var h header
+	copy(h.Magic[:], magic)
+	from, to := findVersion(oldImage), findVersion(newImage)
+	if from == "" || to == "" {
+		return nil, errors.New("no TiltedSensor version string found, is this a sensor image?")
+	}
+	if from == to {
+		return nil, errors.New("both images have the same version")
+	}
+	copy(h.FromVersion[:], from)
+	copy(h.ToVersion[:], to)
+	h.OldSize = uint32(len(oldImage))
+	h.NewSize = uint32(len(newImage))
+	oldSum := md5.Sum(oldImage)
+	newSum := md5.Sum(newImage)
+	hex.Encode(h.OldMD5[:], oldSum[:])
+	hex.Encode(h.NewMD5[:], newSum[:])
+
+	var out bytes.Buffer
+	binary.Write(&out, binary.LittleEndian, &h)
+
+	index := buildIndex(oldImage)
+	var pending []byte // bytes waiting to be inserted
+	flushInsert := func() {
+		if len(pending) > 0 {
+			out.WriteByte(opInsert)
+			putUvarint(&out, uint64(len(pending)))
+			out.Write(pending)
+			pending = pending[:0]
+		}
+	}
+
+	for i := 0; i < len(newImage); {
+		oldPos, length := longestMatch(index, oldImage, newImage, i)
+		if length < minMatch {
+			pending = append(pending, newImage[i])
+			i++
+			continue
+		}
+		flushInsert()
+
+		// Follow this alignment for as long as it keeps matching now and then.
+		shift := oldPos - i
+		end, lastMatch := i, i
+		for end < len(newImage) && end+shift < len(oldImage) && end-lastMatch < maxMismatch {
+			if newImage[end] == oldImage[end+shift] {
+				lastMatch = end + 1
+			}
+			end++
+		}
+		end = lastMatch
+
+		writeRegion(&out, oldImage[oldPos:oldPos+end-i], newImage[i:end], oldPos)
+		i = end
+	}
+	flushInsert()
+	out.WriteByte(opEnd)
+	return out.Bytes(), nil
+}
+
+// writeRegion emits a COPY if the region is identical, otherwise an ADD.
+func writeRegion(out *bytes.Buffer, oldBytes, newBytes []byte, oldPos int) {
+	if bytes.Equal(oldBytes, newBytes) {
+		out.WriteByte(opCopy)
+		putUvarint(out, uint64(oldPos))
+		putUvarint(out, uint64(len(newBytes)))
+		return
+	}
+	out.WriteByte(opAdd)
+	putUvarint(out, uint64(oldPos))
+	putUvarint(out, uint64(len(newBytes)))
+	for j := 0; j < len(newBytes); {
+		zeros := 0
+		for j+zeros < len(newBytes) && newBytes[j+zeros] == oldBytes[j+zeros] {
+			zeros++
+		}
+		literals := 0
+		for k := j + zeros; k < len(newBytes) && newBytes[k] != oldBytes[k]; k++ {
+			literals++
+		}
+		putUvarint(out, uint64(zeros))
+		putUvarint(out, uint64(literals))
+		for k := j + zeros; k < j+zeros+literals; k++ {
+			out.WriteByte(newBytes[k] - oldBytes[k])
+		}
+		j += zeros + literals
+	}
+}
+
+// buildIndex maps every minMatch byte sequence in the old image to where it
+// occurs, keeping the first few occurrences.
+func buildIndex(image []byte) map[string][]int {
+	index := make(map[string][]int)
+	for i := 0; i+minMatch <= len(image); i++ {
+		key := string(image[i : i+minMatch])
+		if len(index[key]) < maxCandidates {
+			index[key] = append(index[key], i)
+		}
+	}
+	return index
+}
+
+func longestMatch(index map[string][]int, oldImage, newImage []byte, pos int) (int, int) {
+	if pos+minMatch > len(newImage) {
+		return 0, 0
+	}
+	bestPos, bestLen := 0, 0
+	for _, candidate := range index[string(newImage[pos:pos+minMatch])] {
+		length := 0
+		for candidate+length < len(oldImage) && pos+length < len(newImage) &&
+			oldImage[candidate+length] == newImage[pos+length] {
+			length++
+		}
+		if length > bestLen {
+			bestPos, bestLen = candidate, length
+		}
+	}
+	return bestPos, bestLen
+}
+
+func putUvarint(out *bytes.Buffer, value uint64) {
+	var buf [binary.MaxVarintLen64]byte
+	out.Write(buf[:binary.PutUvarint(buf[:], value)])
+}
+
+// applyPatch mirrors the sensor's implementation.
+func applyPatch(oldImage, patch []byte) ([]byte, error) {
+	r := bytes.NewReader(patch)
+	var h header
+	if err := binary.Read(r, binary.LittleEndian, &h); err != nil {
+		return nil, err
+	}
+	if string(h.Magic[:]) != magic || int(h.OldSize) != len(oldImage) {
+		return nil, errors.New("patch is not for this image")
+	}
+
+	out := make([]byte, 0, h.NewSize)
+	for {
+		op, err := r.ReadByte()
+		if err != nil {
+			return nil, err
+		}
+		switch op {
+		case opEnd:
+			sum := md5.Sum(out)
+			if hex.EncodeToString(sum[:]) != string(h.NewMD5[:]) {
+				return nil, errors.New("MD5 mismatch")
+			}
+			return out, nil
+		case opCopy, opAdd:
+			offset, err1 := binary.ReadUvarint(r)
+			length, err2 := binary.ReadUvarint(r)
+			if err := errors.Join(err1, err2); err != nil {
+				return nil, err
+			}
+			if offset+length > uint64(len(oldImage)) {
+				return nil, errors.New("region outside old image")
+			}
+			region := oldImage[offset : offset+length]
+			if op == opCopy {
+				out = append(out, region...)
+				continue
+			}
+			for j := uint64(0); j < length; {
+				zeros, err1 := binary.ReadUvarint(r)
+				literals, err2 := binary.ReadUvarint(r)
+				if err := errors.Join(err1, err2); err != nil {
+					return nil, err
+				}
+				if j+zeros+literals > length {
+					return nil, errors.New("diff longer than region")
+				}
+				out = append(out, region[j:j+zeros]...)
+				for k := j + zeros; k < j+zeros+literals; k++ {
+					d, err := r.ReadByte()
+					if err != nil {
+						return nil, err
+					}
+					out = append(out, region[k]+d)
+				}
+				j += zeros + literals
+			}
+		case opInsert:
+			length, err := binary.ReadUvarint(r)
+			if err != nil {
+				return nil, err
+			}
+			data := make([]byte, length)
+			if _, err := io.ReadFull(r, data); err != nil {
+				return nil, err
+			}
+			out = append(out, data...)
+		default:
+			return nil, fmt.Errorf("unknown operation %d", op)
+		}
+	}
+}
@@ -0,0 +1,3 @@
+module github.com/Ordspilleren/Tilted/tools/upstream
+
+go 1.21
@@ -0,0 +1,129 @@
+// Command upstream stands in for an integration that misbehaves, to check on
+// a gateway that the per-integration timeouts hold and that a dead upstream
+// only ever holds up its own publisher.
+//
+//	upstream -listen :8081 -mode hang -tls
+//	upstream -listen :8082 -mode ok
+//
+// Point one integration at a stub that hangs or refuses, and another at one
+// that works, e.g. the Tilted API URL at https://<host>:8081 and Brewfather
+// at http://<host>:8082/. Every connection is logged with how long the
+// gateway held on to it, which for a hanging stub is the integration's
+// connect or request timeout. The working stub logs every request with the
+// time since the one before, which should keep following the sensors while
+// the other one hangs, and the gateway's /metrics should show the hanging
+// integration's breaker open.
+//
+// Modes:
+//
+//	hang    accept connections and read them, but never answer
+//	refuse  reset connections as soon as they are accepted
+//	ok      answer every HTTP request with 200
+//
+// -tls serves TLS with a throwaway certificate, which the gateway accepts
+// since it does not check certificates.
+package main
+
+import (
+	"crypto/ecdsa"
+	"crypto/elliptic"
+	"crypto/rand"
+	"crypto/tls"
+	"crypto/x509"
+	"crypto/x509/pkix"
+	"flag"
+	"io"
+	"log"
+	"math/big"
+	"net"
+	"net/http"
+	"time"
+)
+
+func main() {
+	listen := flag.String("listen", ":8081", "address to listen on")
+	mode := flag.String("mode", "hang", "hang, refuse or ok")
+	useTLS := flag.Bool("tls", false, "serve TLS with a throwaway certificate")
+	flag.Parse()
+
+	ln, err := net.Listen("tcp", *listen)
+	if err != nil {
+		log.Fatal(err)
+	}
+	if *useTLS {
+		cert, err := throwawayCertificate()
+		if err != nil {
+			log.Fatal(err)
+		}
+		ln = tls.NewListener(ln, &tls.Config{Certificates: []tls.Certificate{cert}})
+	}
+	log.Printf("%s on %s", *mode, *listen)
+
+	switch *mode {
+	case "hang":
+		serve(ln, hang)
+	case "refuse":
+		serve(ln, refuse)
+	case "ok":
+		var last time.Time
+		err = http.Serve(ln, http.HandlerFunc(func(w http.ResponseWriter, r *http.Request) {
+			n, _ := io.Copy(io.Discard, r.Body)
+			now := time.Now()
+			if last.IsZero() {
+				log.Printf("%s %s %s, %d bytes", r.RemoteAddr, r.Method, r.URL, n)
+			} else {
+				log.Printf("%s %s %s, %d bytes, %v after the last one", r.RemoteAddr, r.Method, r.URL, n, now.Sub(last).Round(time.Millisecond))
+			}
+			last = now
+		}))
+		log.Fatal(err)
+	default:
+		log.Fatalf("unknown mode %q", *mode)
+	}
+}
+
+func serve(ln net.Listener, handle func(net.Conn)) {
+	for {
+		conn, err := ln.Accept()
+		if err != nil {
+			log.Fatal(err)
+		}
+		go handle(conn)
+	}
+}
+
+// hang reads whatever the gateway sends until it gives up on the
+// connection.
+func hang(conn net.Conn) {
+	start := time.Now()
+	n, _ := io.Copy(io.Discard, conn)
+	log.Printf("%s gave up after %v, sent %d bytes", conn.RemoteAddr(), time.Since(start).Round(time.Millisecond), n)
+	conn.Close()
+}
+
+// refuse closes with a reset, as a port nobody listens on would answer.
+func refuse(conn net.Conn) {
+	if tcp, ok := conn.(*net.TCPConn); ok {
+		tcp.SetLinger(0)
+	}
+	log.Printf("%s refused", conn.RemoteAddr())
+	conn.Close()
+}
+
+func throwawayCertificate() (tls.Certificate, error) {
+	key, err := ecdsa.GenerateKey(elliptic.P256(), rand.Reader)
+	if err != nil {
+		return tls.Certificate{}, err
+	}
+	template := &x509.Certificate{
+		SerialNumber: big.NewInt(1),
+		Subject:      pkix.Name{CommonName: "upstream"},
+		NotBefore:    time.Now().Add(-time.Hour),
+		NotAfter:     time.Now().Add(24 * time.Hour),
+	}
+	der, err := x509.CreateCertificate(rand.Reader, template, template, &key.PublicKey, key)
+	if err != nil {
+		return tls.Certificate{}, err
+	}
+	return tls.Certificate{Certificate: [][]byte{der}, PrivateKey: key}, nil
+}